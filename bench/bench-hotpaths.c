@@ -0,0 +1,173 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "bench.h"
+#include "bindings.h"
+#include "dbus.h"
+#include "gesture.h"
+#include "virtkey.h"
+
+#define LOOKUP_KEYSYMS 256
+
+static const char *const config_names[] = {
+    "short_press_predefined",
+    "double_press_predefined",
+};
+
+static char home[PATH_MAX];
+
+static struct gesture new_gesture() {
+    struct gesture gesture = {
+        .short_press_max = 500,
+        .double_press_max = 200,
+    };
+    return gesture;
+}
+
+static void bench_gesture_double_press(void *data, long iterations) {
+    struct gesture gesture = new_gesture();
+    int bound = GESTURE_BOUND_DOUBLE;
+    long long now = 0;
+
+    for (long i = 0; i < iterations; i++) {
+        gesture_key(&gesture, 1, now, bound);
+        gesture_timeout(&gesture, now + 40, bound);
+        gesture_key(&gesture, 0, now + 40, bound);
+        gesture_timeout(&gesture, now + 80, bound);
+        gesture_key(&gesture, 1, now + 120, bound);
+        bench_sink += gesture_key(&gesture, 0, now + 160, bound);
+        now += 1000;
+    }
+}
+
+static void bench_gesture_long_press(void *data, long iterations) {
+    struct gesture gesture = new_gesture();
+    int bound = GESTURE_BOUND_LONG | GESTURE_BOUND_DOUBLE;
+    long long now = 0;
+
+    for (long i = 0; i < iterations; i++) {
+        gesture_key(&gesture, 1, now, bound);
+        gesture_timeout(&gesture, now + 10, bound);
+        bench_sink += gesture_expire(&gesture, now + 500);
+        gesture_key(&gesture, 0, now + 700, bound);
+        now += 1000;
+    }
+}
+
+static void bench_has_action(void *data, long iterations) {
+    for (long i = 0; i < iterations; i++)
+        bench_sink += has_action(SHORT_PRESS);
+}
+
+static void bench_bound_gestures(void *data, long iterations) {
+    for (long i = 0; i < iterations; i++)
+        bench_sink += bound_gestures();
+}
+
+static void bench_build_keymap(void *data, long iterations) {
+    struct wtype *wtype = data;
+
+    for (long i = 0; i < iterations; i++) {
+        build_keymap(wtype);
+        bench_sink += wtype->keymap_size;
+    }
+}
+
+static void bench_keysym_lookup(void *data, long iterations) {
+    struct wtype *wtype = data;
+
+    for (long i = 0; i < iterations; i++)
+        bench_sink += get_key_code_by_xkb(wtype, 0x100 + (i % LOOKUP_KEYSYMS));
+}
+
+static void bench_action_signal(void *data, long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        DBusMessage *msg = new_action_signal(i & 7, SHORT_PRESS);
+        bench_sink += msg != NULL;
+        dbus_message_unref(msg);
+    }
+}
+
+/* a throwaway HOME with a predefined short and double press, nothing else bound */
+static int setup_home() {
+    char path[PATH_MAX];
+
+    snprintf(home, sizeof(home), "%s/assistant-button-bench-XXXXXX", getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+    if (mkdtemp(home) == NULL) {
+        perror("Failed to create the bench home");
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s/.config", home);
+    mkdir(path, 0700);
+    snprintf(path, sizeof(path), "%s/.config/assistant-button", home);
+    mkdir(path, 0700);
+
+    for (size_t i = 0; i < ARRAY_SIZE(config_names); i++) {
+        snprintf(path, sizeof(path), "%s/.config/assistant-button/%s", home, config_names[i]);
+        FILE *file = fopen(path, "w");
+        if (file == NULL) {
+            perror("Failed to write the bench config");
+            return -1;
+        }
+        fputs("1\n", file);
+        fclose(file);
+    }
+
+    setenv("HOME", home, 1);
+    return 0;
+}
+
+static void cleanup_home() {
+    char path[PATH_MAX];
+
+    for (size_t i = 0; i < ARRAY_SIZE(config_names); i++) {
+        snprintf(path, sizeof(path), "%s/.config/assistant-button/%s", home, config_names[i]);
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/.config/assistant-button", home);
+    rmdir(path);
+    snprintf(path, sizeof(path), "%s/.config", home);
+    rmdir(path);
+    rmdir(home);
+}
+
+int main(int argc, char *argv[]) {
+    struct wtype keymap_wtype;
+    struct wtype lookup_wtype;
+    struct wtype_command cmd;
+
+    if (setup_home() != 0)
+        return EXIT_FAILURE;
+    // what a press looks up is compiled once up front, like the daemon does
+    bindings_init(NULL, NULL);
+
+    memset(&keymap_wtype, 0, sizeof(keymap_wtype));
+    if (compile_text(&keymap_wtype, &cmd, "The quick brown fox jumps over the lazy dog. 0123456789 "
+                     "\xc3\xa0\xc3\xa9\xc3\xae\xc3\xb5\xc3\xbc \xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e", 0) != 0)
+        return EXIT_FAILURE;
+    free(cmd.key_codes);
+
+    memset(&lookup_wtype, 0, sizeof(lookup_wtype));
+    for (unsigned int i = 0; i < LOOKUP_KEYSYMS; i++)
+        get_key_code_by_xkb(&lookup_wtype, 0x100 + i);
+
+    bench_run("gesture_double_press", bench_gesture_double_press, NULL);
+    bench_run("gesture_long_press", bench_gesture_long_press, NULL);
+    bench_run("has_action", bench_has_action, NULL);
+    bench_run("bound_gestures", bench_bound_gestures, NULL);
+    bench_run("build_keymap", bench_build_keymap, &keymap_wtype);
+    bench_run("keysym_lookup", bench_keysym_lookup, &lookup_wtype);
+    bench_run("action_signal", bench_action_signal, NULL);
+
+    free_keymap(&keymap_wtype);
+    free_keymap(&lookup_wtype);
+    cleanup_home();
+    return 0;
+}
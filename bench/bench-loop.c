@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <linux/input.h>
+#include "loop.h"
+#include "stats.h"
+
+#define PRESSES 200
+#define EDGE_GAP_US 1000
+#define ASSISTANT_KEY 112
+
+/*
+ * Feeds presses through a pipe standing in for the evdev device and drives
+ * the daemon's loop over it, the way handle_events() does. Every backend
+ * runs in a process of its own, as the loop can only be set up once. Prints
+ * one JSON line per backend with the loop's syscalls and wakeups per press.
+ */
+
+static void *feed(void *data) {
+    int fd = *(int *)data;
+
+    for (int i = 0; i < PRESSES * 2; i++) {
+        struct input_event events[2] = {
+            { .type = EV_KEY, .code = ASSISTANT_KEY, .value = !(i & 1) },
+            { .type = EV_SYN, .code = SYN_REPORT },
+        };
+        usleep(EDGE_GAP_US);
+        if (write(fd, events, sizeof(events)) != sizeof(events))
+            break;
+    }
+    return NULL;
+}
+
+/* of the loop's thread only, the feeder costs the same under every backend */
+static double cpu_us() {
+    struct rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e6 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static int run(const char *backend) {
+    struct input_event events[16];
+    pthread_t thread;
+    int pipe_fds[2];
+    int releases = 0;
+
+    if (pipe(pipe_fds) != 0 || fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK) != 0) {
+        perror("pipe");
+        return EXIT_FAILURE;
+    }
+
+    if (loop_init(backend) != 0)
+        return EXIT_FAILURE;
+    if (strcmp(loop_backend_name(), backend) != 0) {
+        fprintf(stderr, "%s is unavailable here, skipping it\n", backend);
+        return EXIT_SUCCESS;
+    }
+
+    struct pollfd pfd = { .fd = pipe_fds[0], .events = POLLIN };
+    double start = cpu_us();
+    pthread_create(&thread, NULL, feed, &pipe_fds[1]);
+
+    while (releases < PRESSES) {
+        if (loop_poll(&pfd, 1, -1) <= 0)
+            continue;
+
+        ssize_t len;
+        while ((len = loop_read(pfd.fd, events, sizeof(events))) > 0) {
+            for (size_t i = 0; i < len / sizeof(events[0]); i++) {
+                if (events[i].type == EV_KEY && events[i].value == 0)
+                    releases++;
+            }
+            if (len < (ssize_t)sizeof(events))
+                break;
+        }
+    }
+
+    double cpu = cpu_us() - start;
+    pthread_join(thread, NULL);
+
+    printf("{\"name\":\"loop_%s\",\"presses\":%d,\"syscalls_per_press\":%.2f,\"wakeups_per_press\":%.2f,"
+           "\"cpu_us_per_press\":%.1f}\n",
+           backend, PRESSES, (double)stats_get(STAT_LOOP_SYSCALLS) / PRESSES,
+           (double)stats_get(STAT_LOOP_WAKEUPS) / PRESSES, cpu / PRESSES);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+    static const char *const backends[] = { "poll", "epoll", "io_uring" };
+    int failed = 0;
+
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0)
+            exit(run(backends[i]));
+
+        int status;
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed = 1;
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "virtkey.h"
+
+#define DEFAULT_TEXT_SIZE 4096
+#define COMPILE_ITERATIONS 200
+#define LEGACY_TEXT_SIZE 256
+
+static long long now_ns() {
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1000000000LL + spec.tv_nsec;
+}
+
+/* mix of ascii, latin-1 and cjk so the keymap ends up with a few hundred distinct entries */
+static char *make_text(size_t size) {
+    static const char *const pieces[] = {
+        "The quick brown fox jumps over the lazy dog. ",
+        "0123456789 !\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~\n",
+        "\xc3\xa0\xc3\xa9\xc3\xae\xc3\xb5\xc3\xbc \xc3\x9f\xc3\xb8\xc3\xa6 ",
+        "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe3\x81\xae\xe3\x83\x86\xe3\x82\xad\xe3\x82\xb9\xe3\x83\x88\t",
+    };
+    char *text = malloc(size + 1);
+    size_t len = 0;
+
+    for (size_t i = 0; ; i++) {
+        const char *piece = pieces[i % ARRAY_SIZE(pieces)];
+        size_t piece_len = strlen(piece);
+        if (len + piece_len > size)
+            break;
+        memcpy(text + len, piece, piece_len);
+        len += piece_len;
+    }
+    text[len] = '\0';
+    return text;
+}
+
+static void bench_compile(const char *text) {
+    size_t keys = 0;
+    size_t entries = 0;
+    long long start = now_ns();
+
+    for (int i = 0; i < COMPILE_ITERATIONS; i++) {
+        struct wtype wtype;
+        struct wtype_command cmd;
+        memset(&wtype, 0, sizeof(wtype));
+
+        if (compile_text(&wtype, &cmd, text, 0) != 0)
+            exit(EXIT_FAILURE);
+        build_keymap(&wtype);
+
+        keys = cmd.key_codes_len;
+        entries = wtype.keymap_len;
+        free(cmd.key_codes);
+        free_keymap(&wtype);
+    }
+
+    long long elapsed = now_ns() - start;
+    printf("compile: %zu keys, %zu keymap entries, %.1f us/iter, %.1f ns/key\n",
+           keys, entries,
+           elapsed / 1000.0 / COMPILE_ITERATIONS,
+           (double)elapsed / COMPILE_ITERATIONS / keys);
+}
+
+static void type_text(struct wtype *wtype, const char *label, const char *text,
+                      int batch, unsigned int key_delay_us) {
+    struct wtype_command cmd;
+
+    if (compile_text(wtype, &cmd, text, 0) != 0)
+        exit(EXIT_FAILURE);
+    wtype->commands = &cmd;
+    wtype->command_count = 1;
+    wtype->batch = batch;
+    wtype->key_delay_us = key_delay_us;
+
+    long long start = now_ns();
+    upload_keymap(wtype);
+    run_commands(wtype);
+    wl_display_roundtrip(wtype->display);
+    long long elapsed = now_ns() - start;
+
+    printf("type %s: %zu keys in %.1f ms, %.0f keys/s\n",
+           label, cmd.key_codes_len, elapsed / 1e6,
+           cmd.key_codes_len / (elapsed / 1e9));
+
+    free(cmd.key_codes);
+    wtype->commands = NULL;
+    wtype->command_count = 0;
+}
+
+static void bench_type(const char *text) {
+    struct wtype wtype;
+    memset(&wtype, 0, sizeof(wtype));
+
+    wtype.display = wl_display_connect(NULL);
+    if (wtype.display == NULL) {
+        printf("type: skipped, no Wayland display\n");
+        return;
+    }
+    wtype.registry = wl_display_get_registry(wtype.display);
+    wl_registry_add_listener(wtype.registry, &registry_listener, &wtype);
+    wl_display_roundtrip(wtype.display);
+
+    if (wtype.manager == NULL || wtype.seat == NULL) {
+        printf("type: skipped, compositor lacks a seat or the virtual keyboard protocol\n");
+        wl_display_disconnect(wtype.display);
+        return;
+    }
+
+    wtype.keyboard = zwp_virtual_keyboard_manager_v1_create_virtual_keyboard(
+        wtype.manager, wtype.seat
+    );
+
+    // the old path needs two roundtrips and 4 ms of sleep per key, only type a slice with it
+    size_t slice_len = strlen(text) < LEGACY_TEXT_SIZE ? strlen(text) : LEGACY_TEXT_SIZE;
+    while (slice_len > 0 && (text[slice_len] & 0xc0) == 0x80)
+        slice_len--;
+    char *slice = strndup(text, slice_len);
+    type_text(&wtype, "sync", slice, 0, WTYPE_LEGACY_KEY_DELAY_US);
+    type_text(&wtype, "batch", slice, 1, 0);
+    type_text(&wtype, "batch-full", text, 1, 0);
+    free(slice);
+
+    free_keymap(&wtype);
+    zwp_virtual_keyboard_v1_destroy(wtype.keyboard);
+    zwp_virtual_keyboard_manager_v1_destroy(wtype.manager);
+    wl_registry_destroy(wtype.registry);
+    wl_display_disconnect(wtype.display);
+}
+
+int main(int argc, char *argv[]) {
+    size_t size = DEFAULT_TEXT_SIZE;
+    if (argc > 1)
+        size = strtoul(argv[1], NULL, 10);
+
+    char *text = make_text(size);
+    printf("text: %zu bytes\n", strlen(text));
+
+    bench_compile(text);
+    bench_type(text);
+
+    free(text);
+    return 0;
+}
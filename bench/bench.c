@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+
+#define BENCH_MIN_NS 200000000LL
+#define BENCH_MAX_ITERATIONS (1L << 30)
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+volatile unsigned long bench_sink;
+
+static unsigned long alloc_count;
+static unsigned long alloc_bytes;
+
+/* the allocator is interposed so every benchmark also reports what it allocates per op */
+void *malloc(size_t size) {
+    alloc_count++;
+    alloc_bytes += size;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    alloc_count++;
+    alloc_bytes += nmemb * size;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    alloc_count++;
+    alloc_bytes += size;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+static long long now_ns() {
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1000000000LL + spec.tv_nsec;
+}
+
+void bench_run(const char *name, bench_fn fn, void *data) {
+    long iterations = 1;
+    long long elapsed;
+    unsigned long allocs, bytes;
+
+    // warm caches and lazily built state before anything is counted
+    fn(data, 1);
+
+    while (1) {
+        unsigned long start_allocs = alloc_count;
+        unsigned long start_bytes = alloc_bytes;
+        long long start = now_ns();
+
+        fn(data, iterations);
+
+        elapsed = now_ns() - start;
+        allocs = alloc_count - start_allocs;
+        bytes = alloc_bytes - start_bytes;
+
+        if (elapsed >= BENCH_MIN_NS || iterations >= BENCH_MAX_ITERATIONS)
+            break;
+
+        // aim a bit past the target so the next round is usually the last one
+        long next = elapsed > 0 ? (long)(iterations * 1.2 * BENCH_MIN_NS / elapsed) : iterations * 100;
+        if (next <= iterations)
+            next = iterations * 2;
+        if (next > iterations * 100)
+            next = iterations * 100;
+        iterations = next < BENCH_MAX_ITERATIONS ? next : BENCH_MAX_ITERATIONS;
+    }
+
+    printf("{\"name\":\"%s\",\"iterations\":%ld,\"ns_per_op\":%.2f,\"allocs_per_op\":%.2f,\"bytes_per_op\":%.2f}\n",
+           name, iterations,
+           (double)elapsed / iterations,
+           (double)allocs / iterations,
+           (double)bytes / iterations);
+    fflush(stdout);
+}
@@ -0,0 +1,16 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#ifndef BENCH_H
+#define BENCH_H
+
+/* runs the body of one benchmark `iterations` times */
+typedef void (*bench_fn)(void *data, long iterations);
+
+/* calibrates, runs and prints one JSON line with ns_per_op, allocs_per_op and bytes_per_op */
+void bench_run(const char *name, bench_fn fn, void *data);
+
+/* keeps a result alive so the compiler can't drop the work that produced it */
+extern volatile unsigned long bench_sink;
+
+#endif // BENCH_H
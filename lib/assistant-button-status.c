@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "assistant-button-status.h"
+
+/* a writer holds seq odd for microseconds, anything longer means it died mid-update */
+#define READ_TRIES 1000
+
+struct ab_status {
+    const struct ab_status_page *page;
+    size_t size;
+};
+
+struct ab_status *ab_status_open(const char *path) {
+    char default_path[512];
+    struct stat st;
+
+    if (path == NULL) {
+        const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+        if (runtime_dir)
+            snprintf(default_path, sizeof(default_path), "%s/%s", runtime_dir, AB_STATUS_FILE);
+        else
+            snprintf(default_path, sizeof(default_path), "/run/user/%u/%s", getuid(), AB_STATUS_FILE);
+        path = default_path;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+    if ((size_t)st.st_size < sizeof(struct ab_status_page)) {
+        close(fd);
+        errno = EPROTO;
+        return NULL;
+    }
+
+    void *mapped = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        return NULL;
+
+    struct ab_status *status = malloc(sizeof(*status));
+    if (status == NULL) {
+        munmap(mapped, st.st_size);
+        return NULL;
+    }
+
+    status->page = mapped;
+    status->size = st.st_size;
+    return status;
+}
+
+int ab_status_read(struct ab_status *status, struct ab_status_page *snapshot) {
+    _Atomic uint32_t *seq = (_Atomic uint32_t *)&status->page->seq;
+
+    for (int i = 0; i < READ_TRIES; i++) {
+        uint32_t before = atomic_load_explicit(seq, memory_order_acquire);
+        if (before & 1) {
+            sched_yield();
+            continue;
+        }
+
+        memcpy(snapshot, status->page, sizeof(*snapshot));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(seq, memory_order_relaxed) != before)
+            continue;
+
+        // created but not written yet, the daemon is still starting
+        if (snapshot->magic[0] == '\0')
+            break;
+        if (memcmp(snapshot->magic, AB_STATUS_MAGIC, sizeof(snapshot->magic)) != 0 ||
+            snapshot->version != AB_STATUS_VERSION) {
+            errno = EPROTO;
+            return -1;
+        }
+        return 0;
+    }
+
+    errno = EAGAIN;
+    return -1;
+}
+
+int ab_status_counter(const struct ab_status_page *snapshot, const char *name, uint64_t *value) {
+    uint32_t count = snapshot->counter_count < AB_STATUS_MAX_COUNTERS ? snapshot->counter_count : AB_STATUS_MAX_COUNTERS;
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (strncmp(snapshot->counter_names[i], name, AB_STATUS_NAME_SIZE) == 0) {
+            *value = snapshot->counters[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void ab_status_close(struct ab_status *status) {
+    if (status == NULL)
+        return;
+    munmap((void *)status->page, status->size);
+    free(status);
+}
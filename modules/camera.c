@@ -0,0 +1,438 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <gst/gst.h>
+#include "assistant-button-module.h"
+
+// videotestsrc and a software encoder let the whole thing run without camera hardware
+#define SOURCE_ENV "ASSISTANT_BUTTON_CAMERA_SOURCE"
+#define ENCODER_ENV "ASSISTANT_BUTTON_VIDEO_ENCODER"
+#define DEFAULT_SOURCE "droidcamsrc"
+#define RECORD_QUEUE_BUFFERS 30  // about a second of frames the encoder may fall behind by
+#define RECORD_EOS_TIMEOUT_MS 5000
+
+/* tried in order when ENCODER_ENV doesn't name one */
+static const char *const video_encoders[] = { "v4l2h264enc", "x264enc", "openh264enc" };
+
+static const struct ab_host *host;
+
+/* the recording in progress, toggled from the main loop or an executor thread */
+static struct {
+    GMutex lock;
+    GstElement *pipeline;
+    gchar *filename;
+    gboolean stopping;
+    guint bus_watch;
+    guint eos_timeout;
+    gint64 started_us;
+    gint64 first_frame_us;
+    gint have_first_frame;
+    gint frames;
+    gint dropped;
+} recording;
+
+static gboolean bus_call(GstBus *bus, GstMessage *msg, gpointer data) {
+    GMainLoop *loop = (GMainLoop *)data;
+
+    switch (GST_MESSAGE_TYPE(msg)) {
+        case GST_MESSAGE_EOS:
+            g_print("End-Of-Stream reached.\n");
+            g_main_loop_quit(loop);
+            break;
+        case GST_MESSAGE_ERROR: {
+            gchar *debug;
+            GError *error;
+
+            gst_message_parse_error(msg, &error, &debug);
+            g_printerr("Error: %s\n", error->message);
+            g_error_free(error);
+            g_free(debug);
+
+            g_main_loop_quit(loop);
+            break;
+        }
+        default:
+            break;
+    }
+
+    return TRUE;
+}
+
+/* argument is the camera device to take it with, the first one if none */
+static GstElement *make_source(const char *argument) {
+    const char *name = getenv(SOURCE_ENV);
+    GstElement *source = gst_element_factory_make(name ? name : DEFAULT_SOURCE, "source");
+
+    if (source == NULL)
+        return NULL;
+
+    if (name && g_strcmp0(name, DEFAULT_SOURCE) != 0) {
+        // stand-ins get paced like a camera would be
+        if (g_object_class_find_property(G_OBJECT_GET_CLASS(source), "is-live"))
+            g_object_set(source, "is-live", TRUE, NULL);
+        return source;
+    }
+
+    g_object_set(source, "camera_device", argument ? atoi(argument) : 0, "mode", 2, NULL);
+    return source;
+}
+
+static gboolean is_recording() {
+    g_mutex_lock(&recording.lock);
+    gboolean busy = recording.pipeline != NULL;
+    g_mutex_unlock(&recording.lock);
+    return busy;
+}
+
+static int take_picture(const char *argument) {
+    GstElement *pipeline, *source, *convert, *flip, *enc, *sink;
+    GstBus *bus;
+    GstStateChangeReturn ret;
+    GMainContext *context;
+    GMainLoop *loop;
+    gchar *filename;
+    time_t now;
+    struct tm *t;
+    gchar datetime[32];
+
+    const char *home_dir = getenv("HOME");
+    if (home_dir == NULL)
+        return -1;
+
+    gchar *pictures_dir = g_strdup_printf("%s/Pictures", home_dir);
+
+    if (g_mkdir_with_parents(pictures_dir, 0755) == -1) {
+        g_printerr("Failed to create directory %s\n", pictures_dir);
+        g_free(pictures_dir);
+        return -1;
+    }
+
+    // the camera can only feed one pipeline at a time
+    if (is_recording()) {
+        g_printerr("Can't take a picture while recording\n");
+        g_free(pictures_dir);
+        return -1;
+    }
+
+    gst_init(NULL, NULL);
+
+    pipeline = gst_pipeline_new("camera-pipeline");
+    source = make_source(argument);
+    convert = gst_element_factory_make("videoconvert", "convert");
+    flip = gst_element_factory_make("videoflip", "flip");
+    enc = gst_element_factory_make("jpegenc", "encoder");
+    sink = gst_element_factory_make("filesink", "sink");
+
+    if (!pipeline || !source || !convert || !flip || !enc || !sink) {
+        g_printerr("Not all elements could be created.\n");
+        return -1;
+    }
+
+    now = time(NULL);
+    t = localtime(&now);
+    strftime(datetime, sizeof(datetime), "photo_%Y%m%d_%H%M%S", t);
+    filename = g_strdup_printf("%s/%s.jpeg", pictures_dir, datetime);
+
+    g_object_set(sink, "location", filename, NULL);
+    g_object_set(flip, "video-direction", 8, NULL); // 8 corresponds to GST_VIDEO_FLIP_METHOD_AUTO
+    g_object_set(enc, "snapshot", TRUE, NULL); // exit out after the first frame
+
+    gst_bin_add_many(GST_BIN(pipeline), source, convert, flip, enc, sink, NULL);
+    if (!gst_element_link_many(source, convert, flip, enc, sink, NULL)) {
+        g_printerr("Elements could not be linked.\n");
+        gst_object_unref(pipeline);
+        return -1;
+    }
+
+    ret = gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    if (ret == GST_STATE_CHANGE_FAILURE) {
+        g_printerr("Unable to set the pipeline to the playing state.\n");
+        gst_object_unref(pipeline);
+        return -1;
+    }
+
+    // a private context, so this works both on the daemon's main loop and on an executor thread
+    context = g_main_context_new();
+    g_main_context_push_thread_default(context);
+    loop = g_main_loop_new(context, FALSE);
+
+    bus = gst_element_get_bus(pipeline);
+    gst_bus_add_watch(bus, bus_call, loop);
+
+    g_main_loop_run(loop);
+
+    gst_bus_remove_watch(bus);
+    gst_object_unref(bus);
+    g_main_context_pop_thread_default(context);
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    g_print("Picture saved to: %s\n", filename);
+    host->notify(AB_NOTIFY_PICTURE, filename);
+
+    gst_object_unref(pipeline);
+    g_main_loop_unref(loop);
+    g_main_context_unref(context);
+    g_free(filename);
+    return 0;
+}
+
+static GstElement *make_encoder() {
+    const char *name = getenv(ENCODER_ENV);
+    GstElement *encoder = NULL;
+
+    if (name)
+        return gst_element_factory_make(name, "encoder");
+
+    for (size_t i = 0; i < G_N_ELEMENTS(video_encoders) && encoder == NULL; i++)
+        encoder = gst_element_factory_make(video_encoders[i], "encoder");
+
+    // x264enc defaults to buffering dozens of frames for the best compression
+    if (encoder && g_strcmp0(GST_OBJECT_NAME(gst_element_get_factory(encoder)), "x264enc") == 0) {
+        gst_util_set_object_arg(G_OBJECT(encoder), "tune", "zerolatency");
+        gst_util_set_object_arg(G_OBJECT(encoder), "speed-preset", "ultrafast");
+    }
+    return encoder;
+}
+
+/* on the streaming thread, for every frame that made it out of the source */
+static GstPadProbeReturn on_source_frame(GstPad *pad, GstPadProbeInfo *info, gpointer data) {
+    if (g_atomic_int_compare_and_exchange(&recording.have_first_frame, 0, 1))
+        recording.first_frame_us = g_get_monotonic_time();
+    g_atomic_int_inc(&recording.frames);
+    return GST_PAD_PROBE_OK;
+}
+
+/* the queue is leaky, every overrun is a frame the encoder had no time for */
+static void on_queue_overrun(GstElement *queue, gpointer data) {
+    g_atomic_int_inc(&recording.dropped);
+}
+
+/* on the main loop once the muxer wrote its last bytes, or gave up, source is the one
+ * calling, it goes away by returning G_SOURCE_REMOVE */
+static void record_finish(gboolean saved, guint *source) {
+    g_mutex_lock(&recording.lock);
+    *source = 0;
+    GstElement *pipeline = recording.pipeline;
+    gchar *filename = recording.filename;
+    gint64 first_frame_ms = recording.have_first_frame ?
+                            (recording.first_frame_us - recording.started_us) / 1000 : -1;
+
+    // a start that failed after its bus watch fired already cleaned up after itself
+    if (pipeline == NULL) {
+        g_mutex_unlock(&recording.lock);
+        return;
+    }
+
+    if (recording.eos_timeout)
+        g_source_remove(recording.eos_timeout);
+    if (recording.bus_watch)
+        g_source_remove(recording.bus_watch);
+    recording.pipeline = NULL;
+    recording.filename = NULL;
+    recording.stopping = FALSE;
+    recording.eos_timeout = 0;
+    recording.bus_watch = 0;
+    g_mutex_unlock(&recording.lock);
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+
+    g_print("Video %s to: %s, first frame after %" G_GINT64_FORMAT " ms, %d frames, %d dropped\n",
+            saved ? "saved" : "cut short", filename, first_frame_ms,
+            g_atomic_int_get(&recording.frames), g_atomic_int_get(&recording.dropped));
+    host->notify(AB_NOTIFY_VIDEO, filename);
+    g_free(filename);
+}
+
+static gboolean on_record_message(GstBus *bus, GstMessage *msg, gpointer data) {
+    switch (GST_MESSAGE_TYPE(msg)) {
+        case GST_MESSAGE_EOS:
+            record_finish(TRUE, &recording.bus_watch);
+            return G_SOURCE_REMOVE;
+        case GST_MESSAGE_ERROR: {
+            GError *error;
+            gchar *debug;
+
+            gst_message_parse_error(msg, &error, &debug);
+            g_printerr("Recording failed: %s\n", error->message);
+            g_error_free(error);
+            g_free(debug);
+
+            record_finish(FALSE, &recording.bus_watch);
+            return G_SOURCE_REMOVE;
+        }
+        default:
+            return G_SOURCE_CONTINUE;
+    }
+}
+
+static gboolean on_eos_timeout(gpointer data) {
+    g_printerr("No end of stream after %d ms, closing the recording as is\n", RECORD_EOS_TIMEOUT_MS);
+    record_finish(FALSE, &recording.eos_timeout);
+    return G_SOURCE_REMOVE;
+}
+
+/* a GSource on the daemon's main loop, whichever thread the toggle ran on */
+static guint attach_to_main_loop(GSource *source) {
+    guint id = g_source_attach(source, NULL);
+    g_source_unref(source);
+    return id;
+}
+
+/* called with recording.lock held */
+static int record_start(const char *argument) {
+    GstElement *source, *convert, *flip, *queue, *enc, *parse, *mux, *sink;
+    gchar datetime[32];
+    time_t now;
+
+    const char *home_dir = getenv("HOME");
+    if (home_dir == NULL)
+        return -1;
+
+    gchar *videos_dir = g_strdup_printf("%s/Videos", home_dir);
+    if (g_mkdir_with_parents(videos_dir, 0755) == -1) {
+        g_printerr("Failed to create directory %s\n", videos_dir);
+        g_free(videos_dir);
+        return -1;
+    }
+
+    gst_init(NULL, NULL);
+
+    GstElement *pipeline = gst_pipeline_new("record-pipeline");
+    source = make_source(argument);
+    convert = gst_element_factory_make("videoconvert", "convert");
+    flip = gst_element_factory_make("videoflip", "flip");
+    queue = gst_element_factory_make("queue", "queue");
+    enc = make_encoder();
+    parse = gst_element_factory_make("h264parse", "parse");
+    // matroska stays playable up to the last cluster written, even if the stop never finishes
+    mux = gst_element_factory_make("matroskamux", "mux");
+    sink = gst_element_factory_make("filesink", "sink");
+
+    if (!pipeline || !source || !convert || !flip || !queue || !enc || !parse || !mux || !sink) {
+        g_printerr("Not all elements could be created.\n");
+        g_free(videos_dir);
+        return -1;
+    }
+
+    now = time(NULL);
+    strftime(datetime, sizeof(datetime), "video_%Y%m%d_%H%M%S", localtime(&now));
+    recording.filename = g_strdup_printf("%s/%s.mkv", videos_dir, datetime);
+    g_free(videos_dir);
+
+    g_object_set(sink, "location", recording.filename, NULL);
+    g_object_set(flip, "video-direction", 8, NULL); // 8 corresponds to GST_VIDEO_FLIP_METHOD_AUTO
+    // drops the oldest frames instead of stalling the camera when the encoder falls behind
+    g_object_set(queue, "leaky", 2, "max-size-buffers", RECORD_QUEUE_BUFFERS, "max-size-bytes", 0,
+                 "max-size-time", (guint64)0, NULL);
+    g_signal_connect(queue, "overrun", G_CALLBACK(on_queue_overrun), NULL);
+
+    gst_bin_add_many(GST_BIN(pipeline), source, convert, flip, queue, enc, parse, mux, sink, NULL);
+    if (!gst_element_link_many(source, convert, flip, queue, enc, parse, mux, sink, NULL)) {
+        g_printerr("Elements could not be linked.\n");
+        gst_object_unref(pipeline);
+        g_free(recording.filename);
+        recording.filename = NULL;
+        return -1;
+    }
+
+    // droidcamsrc has a pad per stream, whichever feeds convert is the one recorded
+    GstPad *pad = gst_element_get_static_pad(convert, "sink");
+    if (pad) {
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_source_frame, NULL, NULL);
+        gst_object_unref(pad);
+    }
+
+    recording.have_first_frame = 0;
+    recording.frames = 0;
+    recording.dropped = 0;
+    recording.started_us = g_get_monotonic_time();
+
+    GstBus *bus = gst_element_get_bus(pipeline);
+    GSource *watch = gst_bus_create_watch(bus);
+    g_source_set_callback(watch, (GSourceFunc)on_record_message, NULL, NULL);
+    recording.bus_watch = attach_to_main_loop(watch);
+    gst_object_unref(bus);
+
+    if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        g_printerr("Unable to set the pipeline to the playing state.\n");
+        g_source_remove(recording.bus_watch);
+        recording.bus_watch = 0;
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        gst_object_unref(pipeline);
+        g_free(recording.filename);
+        recording.filename = NULL;
+        return -1;
+    }
+
+    recording.pipeline = pipeline;
+    g_print("Recording to: %s\n", recording.filename);
+    return 0;
+}
+
+/*
+ * Starts recording to ~/Videos, or stops the recording in progress.
+ * Stopping only sends EOS, the muxer finalizes the file on the streaming
+ * threads and the main loop picks it up from the bus, so neither blocks.
+ * argument is the camera device, as for take_picture.
+ */
+static int record_toggle(const char *argument) {
+    int ret = 0;
+
+    g_mutex_lock(&recording.lock);
+    if (recording.pipeline == NULL) {
+        ret = record_start(argument);
+    } else if (recording.stopping) {
+        g_print("Still finishing the last recording\n");
+    } else {
+        recording.stopping = TRUE;
+        GSource *timeout = g_timeout_source_new(RECORD_EOS_TIMEOUT_MS);
+        g_source_set_callback(timeout, on_eos_timeout, NULL, NULL);
+        recording.eos_timeout = attach_to_main_loop(timeout);
+        gst_element_send_event(recording.pipeline, gst_event_new_eos());
+    }
+    g_mutex_unlock(&recording.lock);
+    return ret;
+}
+
+static gpointer gst_prewarm(gpointer data) {
+    // loads the plugin registry, the slow part of the first picture
+    gst_init(NULL, NULL);
+
+    // and the encoder and muxer plugins, the slow part of the first recording
+    const char *const elements[] = { "queue", "h264parse", "matroskamux" };
+    for (size_t i = 0; i < G_N_ELEMENTS(elements); i++) {
+        GstElement *element = gst_element_factory_make(elements[i], NULL);
+        if (element)
+            gst_object_unref(element);
+    }
+    GstElement *encoder = make_encoder();
+    if (encoder)
+        gst_object_unref(encoder);
+    return NULL;
+}
+
+static void camera_prewarm() {
+    g_thread_unref(g_thread_new("gst-prewarm", gst_prewarm, NULL));
+}
+
+static int camera_init(const struct ab_host *daemon) {
+    host = daemon;
+    return 0;
+}
+
+static const struct ab_action camera_actions[] = {
+    { "take_picture", take_picture },
+    { "record_toggle", record_toggle },
+};
+
+/* resident: GStreamer registers GTypes in the daemon's GLib that can't be unregistered again */
+const struct ab_module assistant_button_module = {
+    .abi_version = AB_MODULE_ABI_VERSION,
+    .flags = AB_MODULE_RESIDENT,
+    .name = "camera",
+    .init = camera_init,
+    .prewarm = camera_prewarm,
+    .actions = camera_actions,
+    .action_count = sizeof(camera_actions) / sizeof(camera_actions[0]),
+};
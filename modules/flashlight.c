@@ -0,0 +1,141 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <gio/gio.h>
+#include <batman/wlrdisplay.h>
+#include "assistant-button-module.h"
+
+#define DEFAULT_LEVEL 100
+
+// brightness before the last toggle, what undo puts back
+static gint previous_brightness = -1;
+
+static int get_brightness(GDBusConnection *connection, gint32 *brightness) {
+    GError *error = NULL;
+    GVariant *result;
+
+    result = g_dbus_connection_call_sync(
+        connection,
+        "org.droidian.Flashlightd",
+        "/org/droidian/Flashlightd",
+        "org.freedesktop.DBus.Properties",
+        "Get",
+        g_variant_new("(ss)", "org.droidian.Flashlightd", "Brightness"),
+        G_VARIANT_TYPE("(v)"),
+        G_DBUS_CALL_FLAGS_NONE,
+        -1,
+        NULL,
+        &error
+    );
+
+    if (result == NULL) {
+        g_printerr("Failed to get property: %s\n", error->message);
+        g_error_free(error);
+        return -1;
+    }
+
+    GVariant *brightness_variant;
+    g_variant_get(result, "(v)", &brightness_variant);
+    g_variant_get(brightness_variant, "i", brightness);
+    g_variant_unref(brightness_variant);
+    g_variant_unref(result);
+    return 0;
+}
+
+static int set_brightness(GDBusConnection *connection, gint32 brightness) {
+    GError *error = NULL;
+    GVariant *result;
+
+    result = g_dbus_connection_call_sync(
+        connection,
+        "org.droidian.Flashlightd",
+        "/org/droidian/Flashlightd",
+        "org.droidian.Flashlightd",
+        "SetBrightness",
+        g_variant_new("(u)", brightness),
+        NULL,
+        G_DBUS_CALL_FLAGS_NONE,
+        -1,
+        NULL,
+        &error
+    );
+
+    if (result == NULL) {
+        g_printerr("Failed to set brightness: %s\n", error->message);
+        g_error_free(error);
+        return -1;
+    }
+
+    g_variant_unref(result);
+    return 0;
+}
+
+static GDBusConnection *session_bus() {
+    GError *error = NULL;
+    GDBusConnection *connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+
+    if (connection == NULL) {
+        g_printerr("Failed to get session bus: %s\n", error->message);
+        g_error_free(error);
+    }
+    return connection;
+}
+
+/* argument is the brightness it's turned on with, 1 to 100 */
+static int toggle_flashlight(const char *argument) {
+    gint32 brightness = 0;
+    gint32 level = argument ? atoi(argument) : DEFAULT_LEVEL;
+    int screen_status;
+
+    if (level <= 0 || level > 100)
+        level = DEFAULT_LEVEL;
+
+    GDBusConnection *connection = session_bus();
+    if (connection == NULL)
+        return -1;
+
+    if (get_brightness(connection, &brightness) != 0) {
+        g_object_unref(connection);
+        return -1;
+    }
+
+    screen_status = wlrdisplay(0, NULL);
+
+    gint32 new_brightness;
+    if (screen_status == 0) // Screen is on
+        new_brightness = (brightness > 0) ? 0 : level;
+    else // Screen is off, don't allow turning on at all
+        new_brightness = 0;
+
+    int ret = set_brightness(connection, new_brightness);
+    if (ret == 0)
+        g_atomic_int_set(&previous_brightness, brightness);
+
+    g_object_unref(connection);
+    return ret;
+}
+
+static int undo_toggle_flashlight(const char *argument) {
+    gint brightness = g_atomic_int_get(&previous_brightness);
+    if (brightness < 0)
+        return 0;
+
+    GDBusConnection *connection = session_bus();
+    if (connection == NULL)
+        return -1;
+
+    int ret = set_brightness(connection, brightness);
+    g_object_unref(connection);
+    return ret;
+}
+
+static const struct ab_action flashlight_actions[] = {
+    { "toggle", toggle_flashlight, AB_ACTION_SPECULATIVE, undo_toggle_flashlight },
+};
+
+const struct ab_module assistant_button_module = {
+    .abi_version = AB_MODULE_ABI_VERSION,
+    .name = "flashlight",
+    .actions = flashlight_actions,
+    .action_count = sizeof(flashlight_actions) / sizeof(flashlight_actions[0]),
+};
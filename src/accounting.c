@@ -0,0 +1,178 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <time.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "accounting.h"
+#include "flightrec.h"
+#include "stats.h"
+
+#define WINDOW_NS 1000000000LL
+
+static const char *const names[ACCOUNT_COUNT] = {
+    [ACCOUNT_LOOP] = "loop",
+    [ACCOUNT_INPUT] = "input",
+    [ACCOUNT_TIMER] = "timer",
+    [ACCOUNT_DBUS] = "D-Bus",
+    [ACCOUNT_CHILD] = "child exit",
+    [ACCOUNT_OTHER] = "other",
+};
+
+static const enum stat_counter wakeup_stats[ACCOUNT_COUNT] = {
+    [ACCOUNT_LOOP] = STAT_WAKEUPS_OTHER,
+    [ACCOUNT_INPUT] = STAT_WAKEUPS_INPUT,
+    [ACCOUNT_TIMER] = STAT_WAKEUPS_TIMER,
+    [ACCOUNT_DBUS] = STAT_WAKEUPS_DBUS,
+    [ACCOUNT_CHILD] = STAT_WAKEUPS_CHILD,
+    [ACCOUNT_OTHER] = STAT_WAKEUPS_OTHER,
+};
+
+static const enum stat_counter cpu_stats[ACCOUNT_COUNT] = {
+    [ACCOUNT_LOOP] = STAT_CPU_US_LOOP,
+    [ACCOUNT_INPUT] = STAT_CPU_US_INPUT,
+    [ACCOUNT_TIMER] = STAT_CPU_US_TIMER,
+    [ACCOUNT_DBUS] = STAT_CPU_US_DBUS,
+    [ACCOUNT_CHILD] = STAT_CPU_US_CHILD,
+    [ACCOUNT_OTHER] = STAT_CPU_US_OTHER,
+};
+
+static struct {
+    enum account_subsystem current;
+    int pending;       // the last wakeup is waiting for a subsystem to claim it
+    long long mark_ns; // thread CPU time when current was last charged
+    long long cpu_ns[ACCOUNT_COUNT];
+    long long wakeup_cpu_ns; // thread CPU time at the last wakeup
+    long long last_cost_ns;  // of handling the wakeup before, it goes to the flight recorder
+    int timeout;
+
+    // the watchdog looks at one second at a time
+    long long window_start_ns;
+    long long window_cpu_ns;
+    unsigned int window_wakeups;
+    unsigned int window_causes[ACCOUNT_COUNT];
+    int busy;
+} account;
+
+static long long clock_ns(clockid_t clock) {
+    struct timespec spec;
+    clock_gettime(clock, &spec);
+    return spec.tv_sec * 1000000000LL + spec.tv_nsec;
+}
+
+long long account_thread_cpu_us() {
+    return clock_ns(CLOCK_THREAD_CPUTIME_ID) / 1000;
+}
+
+static long long charge() {
+    long long now = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+
+    // whatever ran before the first wakeup was startup, not the loop
+    if (account.mark_ns == 0) {
+        account.mark_ns = now;
+        return now;
+    }
+
+    account.cpu_ns[account.current] += now - account.mark_ns;
+    stats_set(cpu_stats[account.current], account.cpu_ns[account.current] / 1000);
+    account.mark_ns = now;
+    return now;
+}
+
+static void count(enum account_subsystem cause) {
+    account.pending = 0;
+    account.window_wakeups++;
+    account.window_causes[cause]++;
+    stats_add(wakeup_stats[cause], 1);
+
+    // a busy loop would wipe out the history that explains it
+    if (!account.busy)
+        flightrec_record(FR_WAKEUP, cause, account.timeout, account.last_cost_ns / 1000);
+}
+
+static enum account_subsystem dominant_cause() {
+    enum account_subsystem dominant = ACCOUNT_OTHER;
+
+    for (int i = 0; i < ACCOUNT_COUNT; i++) {
+        if (account.window_causes[i] > account.window_causes[dominant])
+            dominant = i;
+    }
+    return dominant;
+}
+
+/* a zero timeout coming back around forever shows up as a flood of wakeups, a slow spin as CPU time */
+static void watchdog(long long now, long long cpu_now) {
+    long long elapsed = now - account.window_start_ns;
+    if (account.window_start_ns != 0 && elapsed < WINDOW_NS)
+        return;
+
+    long long cpu_ns = cpu_now - account.window_cpu_ns;
+    // per second, a window only ends with the wakeup after it
+    unsigned int wakeups = account.window_wakeups * WINDOW_NS / elapsed;
+    int busy = account.window_start_ns != 0 &&
+               (wakeups > ACCOUNT_BUSY_WAKEUPS || cpu_ns * 100 > elapsed * ACCOUNT_BUSY_CPU_PERCENT);
+
+    if (busy) {
+        stats_max(STAT_BUSY_LOOP_WAKEUPS_MAX, wakeups);
+        if (!account.busy) {
+            enum account_subsystem cause = dominant_cause();
+
+            stats_add(STAT_BUSY_LOOPS, 1);
+            flightrec_record(FR_BUSY_LOOP, cause, wakeups, cpu_ns / 1000);
+            fprintf(stderr, "Busy loop: %u wakeups and %lld ms on the CPU per second, mostly %s\n",
+                    wakeups, cpu_ns * 1000 / elapsed, names[cause]);
+        }
+    } else if (account.busy) {
+        fprintf(stderr, "Busy loop over\n");
+    }
+    account.busy = busy;
+
+    account.window_start_ns = now;
+    account.window_cpu_ns = cpu_now;
+    account.window_wakeups = 0;
+    for (int i = 0; i < ACCOUNT_COUNT; i++)
+        account.window_causes[i] = 0;
+}
+
+/* after every wait, cause is ACCOUNT_LOOP when the GLib source dispatched next has to claim it */
+void account_wakeup(enum account_subsystem cause, int timeout) {
+    long long cpu_now = charge();
+
+    if (account.pending)
+        count(ACCOUNT_OTHER);
+    watchdog(clock_ns(CLOCK_MONOTONIC), cpu_now);
+
+    account.timeout = timeout;
+    account.last_cost_ns = account.wakeup_cpu_ns ? cpu_now - account.wakeup_cpu_ns : 0;
+    account.wakeup_cpu_ns = cpu_now;
+    if (cause == ACCOUNT_LOOP)
+        account.pending = 1;
+    else
+        count(cause);
+}
+
+/* once GLib dispatched, whatever nobody claimed woke us for some other source */
+void account_settle() {
+    if (account.pending)
+        count(ACCOUNT_OTHER);
+}
+
+/* returns what to hand to account_leave() */
+enum account_subsystem account_enter(enum account_subsystem subsystem) {
+    enum account_subsystem previous = account.current;
+
+    charge();
+    if (account.pending && subsystem != ACCOUNT_LOOP)
+        count(subsystem);
+    account.current = subsystem;
+    return previous;
+}
+
+void account_leave(enum account_subsystem previous) {
+    charge();
+    account.current = previous;
+}
+
+const char *account_name(enum account_subsystem subsystem) {
+    return subsystem < ACCOUNT_COUNT ? names[subsystem] : "?";
+}
@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#ifndef ACCOUNTING_H
+#define ACCOUNTING_H
+
+/* more wakeups than this in a second, or more than half of it on the CPU, is a busy loop */
+#define ACCOUNT_BUSY_WAKEUPS 200
+#define ACCOUNT_BUSY_CPU_PERCENT 50
+
+/*
+ * Where the main loop's wakeups come from and where its CPU time goes.
+ * Each wakeup is counted once, for the first subsystem that claims it
+ * by entering. CPU time is the main thread's, charged to whichever
+ * subsystem was entered last. Main thread only.
+ */
+enum account_subsystem {
+    ACCOUNT_LOOP,  // polling, and GLib sources nobody claimed, never a wakeup cause
+    ACCOUNT_INPUT, // the device, the input thread or the reader, and the gestures they complete
+    ACCOUNT_TIMER, // gesture and debounce deadlines, GLib timeouts
+    ACCOUNT_DBUS,
+    ACCOUNT_CHILD, // commands and chain steps exiting
+    ACCOUNT_OTHER, // idle callbacks, Wayland and whatever else GLib watches
+    ACCOUNT_COUNT
+};
+
+void account_wakeup(enum account_subsystem cause, int timeout);
+void account_settle();
+enum account_subsystem account_enter(enum account_subsystem subsystem);
+void account_leave(enum account_subsystem previous);
+const char *account_name(enum account_subsystem subsystem);
+/* any thread, its own CPU time */
+long long account_thread_cpu_us();
+
+#endif // ACCOUNTING_H
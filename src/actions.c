@@ -2,194 +2,16 @@
 // Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
 
 #include <gio/gio.h>
-#include <gst/gst.h>
-#include <batman/wlrdisplay.h>
+#include <glib-unix.h>
 #include "actions.h"
 #include "virtkey.h"
+#include "macro.h"
 #include "utils.h"
 
-static GMainLoop *loop;
-
-void handle_flashlight() {
-    GDBusConnection *connection;
-    GError *error = NULL;
-    GVariant *result;
-    gint32 brightness = 0;
-    int screen_status;
-
-    connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
-    if (connection == NULL) {
-        g_printerr("Failed to get session bus: %s\n", error->message);
-        g_error_free(error);
-        return;
-    }
-
-    result = g_dbus_connection_call_sync(
-        connection,
-        "org.droidian.Flashlightd",
-        "/org/droidian/Flashlightd",
-        "org.freedesktop.DBus.Properties",
-        "Get",
-        g_variant_new("(ss)", "org.droidian.Flashlightd", "Brightness"),
-        G_VARIANT_TYPE("(v)"),
-        G_DBUS_CALL_FLAGS_NONE,
-        -1,
-        NULL,
-        &error
-    );
-
-    if (result == NULL) {
-        g_printerr("Failed to get property: %s\n", error->message);
-        g_error_free(error);
-        g_object_unref(connection);
-        return;
-    }
-
-    GVariant *brightness_variant;
-    g_variant_get(result, "(v)", &brightness_variant);
-    g_variant_get(brightness_variant, "i", &brightness);
-    g_variant_unref(brightness_variant);
-    g_variant_unref(result);
-
-    screen_status = wlrdisplay(0, NULL);
-
-    gint32 new_brightness;
-    if (screen_status == 0) // Screen is on
-        new_brightness = (brightness > 0) ? 0 : 100;
-    else // Screen is off, don't allow turning on at all
-        new_brightness = 0;
-
-    result = g_dbus_connection_call_sync(
-        connection,
-        "org.droidian.Flashlightd",
-        "/org/droidian/Flashlightd",
-        "org.droidian.Flashlightd",
-        "SetBrightness",
-        g_variant_new("(u)", new_brightness),
-        NULL,
-        G_DBUS_CALL_FLAGS_NONE,
-        -1,
-        NULL,
-        &error
-    );
-
-    if (result == NULL) {
-        g_printerr("Failed to set brightness: %s\n", error->message);
-        g_error_free(error);
-    } else
-        g_variant_unref(result);
-
-    g_object_unref(connection);
-}
-
 void open_camera() {
     run_command("furios-camera");
 }
 
-static gboolean bus_call(GstBus *bus, GstMessage *msg, gpointer data) {
-    GMainLoop *loop = (GMainLoop *)data;
-
-    switch (GST_MESSAGE_TYPE(msg)) {
-        case GST_MESSAGE_EOS:
-            g_print("End-Of-Stream reached.\n");
-            g_main_loop_quit(loop);
-            break;
-        case GST_MESSAGE_ERROR: {
-            gchar *debug;
-            GError *error;
-
-            gst_message_parse_error(msg, &error, &debug);
-            g_printerr("Error: %s\n", error->message);
-            g_error_free(error);
-            g_free(debug);
-
-            g_main_loop_quit(loop);
-            break;
-        }
-        default:
-            break;
-    }
-
-    return TRUE;
-}
-
-void take_picture() {
-    GstElement *pipeline, *source, *convert, *flip, *enc, *sink;
-    GstBus *bus;
-    GstStateChangeReturn ret;
-    GMainLoop *loop;
-    gchar *filename;
-    time_t now;
-    struct tm *t;
-    gchar datetime[32];
-
-    const char *home_dir = getenv("HOME");
-    if (home_dir == NULL)
-        return;
-
-    gchar *pictures_dir = g_strdup_printf("%s/Pictures", home_dir);
-
-    if (g_mkdir_with_parents(pictures_dir, 0755) == -1) {
-        g_printerr("Failed to create directory %s\n", pictures_dir);
-        g_free(pictures_dir);
-        return;
-    }
-
-    gst_init(NULL, NULL);
-
-    pipeline = gst_pipeline_new("camera-pipeline");
-    source = gst_element_factory_make("droidcamsrc", "source");
-    convert = gst_element_factory_make("videoconvert", "convert");
-    flip = gst_element_factory_make("videoflip", "flip");
-    enc = gst_element_factory_make("jpegenc", "encoder");
-    sink = gst_element_factory_make("filesink", "sink");
-
-    if (!pipeline || !source || !convert || !flip || !enc || !sink) {
-        g_printerr("Not all elements could be created.\n");
-        return;
-    }
-
-    now = time(NULL);
-    t = localtime(&now);
-    strftime(datetime, sizeof(datetime), "photo_%Y%m%d_%H%M%S", t);
-    filename = g_strdup_printf("%s/%s.jpeg", pictures_dir, datetime);
-
-    g_object_set(source, "camera_device", 0, "mode", 2, NULL);
-    g_object_set(sink, "location", filename, NULL);
-    g_object_set(flip, "video-direction", 8, NULL); // 8 corresponds to GST_VIDEO_FLIP_METHOD_AUTO
-    g_object_set(enc, "snapshot", TRUE, NULL); // exit out after the first frame
-
-    gst_bin_add_many(GST_BIN(pipeline), source, convert, flip, enc, sink, NULL);
-    if (!gst_element_link_many(source, convert, flip, enc, sink, NULL)) {
-        g_printerr("Elements could not be linked.\n");
-        gst_object_unref(pipeline);
-        return;
-    }
-
-    ret = gst_element_set_state(pipeline, GST_STATE_PLAYING);
-    if (ret == GST_STATE_CHANGE_FAILURE) {
-        g_printerr("Unable to set the pipeline to the playing state.\n");
-        gst_object_unref(pipeline);
-        return;
-    }
-
-    loop = g_main_loop_new(NULL, FALSE);
-
-    bus = gst_element_get_bus(pipeline);
-    gst_bus_add_watch(bus, bus_call, loop);
-    gst_object_unref(bus);
-
-    g_main_loop_run(loop);
-
-    gst_element_set_state(pipeline, GST_STATE_NULL);
-    g_print("Picture saved to: %s\n", filename);
-    show_notification("Picture saved to", filename);
-
-    gst_object_unref(pipeline);
-    g_main_loop_unref(loop);
-    g_free(filename);
-}
-
 void take_screenshot() {
     GDBusConnection *connection;
     GError *error = NULL;
@@ -257,7 +79,7 @@ void take_screenshot() {
 
     if (success) {
         g_print("Screenshot saved to: %s\n", filename_used);
-        show_notification("Screenshot saved to", filename_used);
+        show_notification(NOTIFY_SCREENSHOT, filename_used);
     } else
         g_print("Failed to take screenshot.\n");
 
@@ -269,94 +91,518 @@ void take_screenshot() {
     g_free(pictures_dir);
 }
 
-void send_key(const char *name) {
-    struct wtype wtype;
-    memset(&wtype, 0, sizeof(wtype));
-
-    wtype.commands = calloc(1, sizeof(wtype.commands[0]));
-    wtype.command_count = 1;
+static struct wtype keyboard;
+
+static void keyboard_disconnect() {
+    if (keyboard.keyboard)
+        zwp_virtual_keyboard_v1_destroy(keyboard.keyboard);
+    if (keyboard.manager)
+        zwp_virtual_keyboard_manager_v1_destroy(keyboard.manager);
+    if (keyboard.seat)
+        wl_seat_destroy(keyboard.seat);
+    if (keyboard.registry)
+        wl_registry_destroy(keyboard.registry);
+    if (keyboard.display)
+        wl_display_disconnect(keyboard.display);
+
+    keyboard.keyboard = NULL;
+    keyboard.manager = NULL;
+    keyboard.seat = NULL;
+    keyboard.registry = NULL;
+    keyboard.display = NULL;
+    keyboard.mod_status = 0;
+    keyboard.keymap_uploaded = 0;
+}
 
-    struct wtype_command *cmd = &wtype.commands[0];
-    cmd->type = WTYPE_COMMAND_TEXT;
-    xkb_keysym_t ks = xkb_keysym_from_name(name, XKB_KEYSYM_CASE_INSENSITIVE);
-    if (ks == XKB_KEY_NoSymbol) {
-        g_print("Unknown key '%s'", name);
-        return;
+static int keyboard_connect() {
+    if (keyboard.display != NULL) {
+        if (wl_display_get_error(keyboard.display) == 0)
+            return 0;
+        // compositor went away or killed us, start over with a fresh connection
+        keyboard_disconnect();
     }
-    cmd->key_codes = malloc(sizeof(cmd->key_codes[0]));
-    cmd->key_codes_len = 1;
-    cmd->key_codes[0] = get_key_code_by_xkb(&wtype, ks);
-    cmd->delay_ms = 0;
 
-    wtype.display = wl_display_connect(NULL);
-    if (wtype.display == NULL) {
+    keyboard.display = wl_display_connect(NULL);
+    if (keyboard.display == NULL) {
         g_print("Wayland connection failed\n");
-        return;
+        return -1;
     }
-    wtype.registry = wl_display_get_registry(wtype.display);
-    wl_registry_add_listener(wtype.registry, &registry_listener, &wtype);
-    wl_display_dispatch(wtype.display);
-    wl_display_roundtrip(wtype.display);
+    keyboard.registry = wl_display_get_registry(keyboard.display);
+    wl_registry_add_listener(keyboard.registry, &registry_listener, &keyboard);
+    wl_display_dispatch(keyboard.display);
+    wl_display_roundtrip(keyboard.display);
 
-    if (wtype.manager == NULL) {
+    if (keyboard.manager == NULL) {
         g_print("Compositor does not support the virtual keyboard protocol\n");
-        return;
+        keyboard_disconnect();
+        return -1;
     }
-    if (wtype.seat == NULL) {
+    if (keyboard.seat == NULL) {
         g_print("No seat found\n");
-        return;
+        keyboard_disconnect();
+        return -1;
     }
 
-    wtype.keyboard = zwp_virtual_keyboard_manager_v1_create_virtual_keyboard(
-        wtype.manager, wtype.seat
+    keyboard.keyboard = zwp_virtual_keyboard_manager_v1_create_virtual_keyboard(
+        keyboard.manager, keyboard.seat
     );
 
-    upload_keymap(&wtype);
-    run_commands(&wtype);
+    return 0;
+}
+
+void keyboard_set_pacing(int batch, unsigned int key_delay_us) {
+    keyboard.batch = batch;
+    keyboard.key_delay_us = key_delay_us;
+}
+
+int keyboard_prepare(const char *const *names, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        xkb_keysym_t ks = xkb_keysym_from_name(names[i], XKB_KEYSYM_CASE_INSENSITIVE);
+        if (ks == XKB_KEY_NoSymbol) {
+            g_print("Unknown key '%s'\n", names[i]);
+            continue;
+        }
+        get_key_code_by_xkb(&keyboard, ks);
+    }
+
+    // nothing new since the last build, keep using the current memfd
+    if (keyboard.keymap_size > 0 && !keyboard.keymap_dirty)
+        return 0;
+
+    if (build_keymap(&keyboard) != 0)
+        return -1;
+
+    keyboard.keymap_dirty = 0;
+    return 0;
+}
+
+/* resolves a key name and adds it to the keymap, returns its keysym or 0 (NoSymbol) if there is no such key */
+uint32_t keyboard_prepare_key(const char *name) {
+    xkb_keysym_t ks = xkb_keysym_from_name(name, XKB_KEYSYM_CASE_INSENSITIVE);
+    if (ks == XKB_KEY_NoSymbol) {
+        g_print("Unknown key '%s'\n", name);
+        return XKB_KEY_NoSymbol;
+    }
+
+    const char *const names[] = { name };
+    return keyboard_prepare(names, 1) == 0 ? ks : XKB_KEY_NoSymbol;
+}
+
+void send_keysym(uint32_t keysym) {
+    char name[64];
+
+    if (keyboard_connect() != 0)
+        return;
 
+    unsigned int key_code = get_key_code_by_xkb(&keyboard, keysym);
+    struct wtype_command cmd = {
+        .type = WTYPE_COMMAND_TEXT,
+        .key_codes = &key_code,
+        .key_codes_len = 1,
+        .delay_ms = 0,
+    };
+
+    keyboard.commands = &cmd;
+    keyboard.command_count = 1;
+
+    upload_keymap(&keyboard);
+    run_commands(&keyboard);
+
+    keyboard.commands = NULL;
+    keyboard.command_count = 0;
+
+    xkb_keysym_get_name(keysym, name, sizeof(name));
     g_print("%s key sent to seat\n", name);
+}
+
+void send_key(const char *name) {
+    xkb_keysym_t ks = xkb_keysym_from_name(name, XKB_KEYSYM_CASE_INSENSITIVE);
+    if (ks == XKB_KEY_NoSymbol) {
+        g_print("Unknown key '%s'\n", name);
+        return;
+    }
 
-    free(wtype.commands);
-    free(wtype.keymap);
-    zwp_virtual_keyboard_v1_destroy(wtype.keyboard);
-    zwp_virtual_keyboard_manager_v1_destroy(wtype.manager);
-    wl_registry_destroy(wtype.registry);
-    wl_display_disconnect(wtype.display);
+    send_keysym(ks);
 }
 
-void manual_autorotate() {
-    GSettings *settings;
-    GSettingsSchema *schema;
-    GSettingsSchemaSource *schema_source;
-    gboolean current_value;
+/* warm up what the first press would otherwise pay for, called once the daemon is ready */
+void actions_prewarm() {
+    if (keyboard_connect() == 0) {
+        upload_keymap(&keyboard);
+        wl_display_flush(keyboard.display);
+    }
+}
 
-    schema_source = g_settings_schema_source_get_default();
-    schema = g_settings_schema_source_lookup(schema_source, "org.gnome.settings-daemon.peripherals.touchscreen", TRUE);
-    if (schema == NULL) {
-        g_print("Schema 'org.gnome.settings-daemon.peripherals.touchscreen' not found\n");
+int load_macro(struct macro *macro, const char *source) {
+    if (macro_compile(&keyboard, macro, source) != 0)
+        return -1;
+
+    // pick up any keysym the macro added so the keymap is ready before the first replay
+    return keyboard_prepare(NULL, 0);
+}
+
+/* the rest of a macro that is waiting out a sleep step, owns a copy of its commands */
+static struct {
+    struct wtype_command *commands;
+    size_t command_count;
+    size_t next; // the sleep step being waited on
+    guint timeout_id;
+} playback;
+
+/* runs commands up to the first sleep step, returns how many were run */
+static size_t run_segment(struct wtype_command *commands, size_t count) {
+    size_t n = 0;
+    while (n < count && commands[n].type != WTYPE_COMMAND_SLEEP)
+        n++;
+    if (n == 0)
+        return 0;
+
+    keyboard.commands = commands;
+    keyboard.command_count = n;
+    run_commands(&keyboard);
+    keyboard.commands = NULL;
+    keyboard.command_count = 0;
+    return n;
+}
+
+static void playback_free() {
+    for (size_t i = 0; i < playback.command_count; i++) {
+        if (playback.commands[i].type == WTYPE_COMMAND_TEXT)
+            free(playback.commands[i].key_codes);
+    }
+    free(playback.commands);
+    playback.commands = NULL;
+    playback.command_count = 0;
+    playback.timeout_id = 0;
+}
+
+static gboolean on_macro_sleep_done(gpointer data) {
+    size_t start = playback.next + 1;
+
+    if (keyboard_connect() != 0) {
+        playback_free();
+        return G_SOURCE_REMOVE;
+    }
+
+    upload_keymap(&keyboard);
+    size_t done = start + run_segment(playback.commands + start, playback.command_count - start);
+    if (done < playback.command_count) {
+        playback.next = done;
+        playback.timeout_id = g_timeout_add(playback.commands[done].sleep_ms, on_macro_sleep_done, NULL);
+        return G_SOURCE_REMOVE;
+    }
+
+    playback_free();
+    return G_SOURCE_REMOVE;
+}
+
+void play_macro(const struct macro *macro) {
+    if (macro->command_count == 0)
+        return;
+
+    if (playback.timeout_id != 0) {
+        g_print("Macro still running, ignoring\n");
         return;
     }
 
+    if (keyboard_connect() != 0)
+        return;
+
+    upload_keymap(&keyboard);
+    size_t done = run_segment(macro->commands, macro->command_count);
+    if (done == macro->command_count)
+        return;
+
+    // the macro may be recompiled while we wait, keep our own copy of what is left
+    playback.command_count = macro->command_count - done;
+    playback.commands = malloc(playback.command_count * sizeof(playback.commands[0]));
+    memcpy(playback.commands, macro->commands + done, playback.command_count * sizeof(playback.commands[0]));
+    for (size_t i = 0; i < playback.command_count; i++) {
+        struct wtype_command *cmd = &playback.commands[i];
+        if (cmd->type != WTYPE_COMMAND_TEXT)
+            continue;
+        unsigned int *key_codes = malloc(cmd->key_codes_len * sizeof(key_codes[0]));
+        memcpy(key_codes, cmd->key_codes, cmd->key_codes_len * sizeof(key_codes[0]));
+        cmd->key_codes = key_codes;
+    }
+
+    playback.next = 0;
+    playback.timeout_id = g_timeout_add(playback.commands[0].sleep_ms, on_macro_sleep_done, NULL);
+}
+
+#define ROTATION_SCHEMA "org.gnome.settings-daemon.peripherals.touchscreen"
+#define SENSOR_PROXY_NAME "net.hadess.SensorProxy"
+#define SENSOR_PROXY_PATH "/net/hadess/SensorProxy"
+#define ROTATION_TIMEOUT_MS 2000 // upper bound for phosh to follow the sensor
+#define ROTATION_SETTLE_MS 500   // grace after a sensor change when outputs can't be watched
+#define MAX_OUTPUTS 4
+
+static struct {
+    GSettings *settings;
+    gboolean schema_missing;
+    gboolean pending;
+    guint timeout_id;
+
+    GDBusConnection *sensor_bus;
+    guint sensor_signal_id;
+    gchar *orientation;
+
+    struct wl_display *display;
+    struct wl_registry *registry;
+    struct wl_output *outputs[MAX_OUTPUTS];
+    int32_t transforms[MAX_OUTPUTS];
+    size_t output_count;
+    guint display_watch;
+} rotation;
+
+static GSettings *rotation_settings() {
+    if (rotation.settings != NULL || rotation.schema_missing)
+        return rotation.settings;
+
+    GSettingsSchemaSource *schema_source = g_settings_schema_source_get_default();
+    GSettingsSchema *schema = g_settings_schema_source_lookup(schema_source, ROTATION_SCHEMA, TRUE);
+    if (schema == NULL) {
+        g_print("Schema '%s' not found\n", ROTATION_SCHEMA);
+        rotation.schema_missing = TRUE;
+        return NULL;
+    }
+
     if (!g_settings_schema_has_key(schema, "orientation-lock")) {
         g_print("Key 'orientation-lock' not found in the schema\n");
         g_settings_schema_unref(schema);
+        rotation.schema_missing = TRUE;
+        return NULL;
+    }
+
+    rotation.settings = g_settings_new_full(schema, NULL, NULL);
+    g_settings_schema_unref(schema);
+    return rotation.settings;
+}
+
+static void rotation_relock(const char *reason) {
+    if (!rotation.pending)
+        return;
+
+    g_settings_set_boolean(rotation.settings, "orientation-lock", TRUE);
+    rotation.pending = FALSE;
+
+    if (rotation.timeout_id != 0) {
+        g_source_remove(rotation.timeout_id);
+        rotation.timeout_id = 0;
+    }
+
+    if (rotation.sensor_bus != NULL)
+        g_dbus_connection_call(rotation.sensor_bus, SENSOR_PROXY_NAME, SENSOR_PROXY_PATH, SENSOR_PROXY_NAME,
+                               "ReleaseAccelerometer", NULL, NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL, NULL);
+
+    g_print("Orientation locked again after %s\n", reason);
+}
+
+static gboolean on_rotation_timeout(gpointer data) {
+    rotation.timeout_id = 0;
+    rotation_relock(data);
+    return G_SOURCE_REMOVE;
+}
+
+static void rotation_rearm(guint timeout_ms, const char *reason) {
+    if (rotation.timeout_id != 0)
+        g_source_remove(rotation.timeout_id);
+    rotation.timeout_id = g_timeout_add(timeout_ms, on_rotation_timeout, (gpointer)reason);
+}
+
+static void output_geometry(void *data, struct wl_output *output, int32_t x, int32_t y,
+                            int32_t physical_width, int32_t physical_height, int32_t subpixel,
+                            const char *make, const char *model, int32_t transform) {
+    int32_t *current = data;
+
+    // the first geometry event is just the state at bind time
+    if (*current != -1 && *current != transform && rotation.pending)
+        rotation_relock("an output transform change");
+
+    *current = transform;
+}
+
+static void output_mode(void *data, struct wl_output *output, uint32_t flags,
+                        int32_t width, int32_t height, int32_t refresh) {
+}
+
+static void output_done(void *data, struct wl_output *output) {
+}
+
+static void output_scale(void *data, struct wl_output *output, int32_t factor) {
+}
+
+static const struct wl_output_listener output_listener = {
+    .geometry = output_geometry,
+    .mode = output_mode,
+    .done = output_done,
+    .scale = output_scale,
+};
+
+static void rotation_global(void *data, struct wl_registry *registry, uint32_t name,
+                            const char *interface, uint32_t version) {
+    if (strcmp(interface, wl_output_interface.name) != 0 || rotation.output_count == MAX_OUTPUTS)
         return;
+
+    size_t i = rotation.output_count++;
+    rotation.transforms[i] = -1;
+    rotation.outputs[i] = wl_registry_bind(registry, name, &wl_output_interface, version < 2 ? version : 2);
+    wl_output_add_listener(rotation.outputs[i], &output_listener, &rotation.transforms[i]);
+}
+
+static void rotation_global_remove(void *data, struct wl_registry *registry, uint32_t name) {
+}
+
+static const struct wl_registry_listener rotation_registry_listener = {
+    .global = rotation_global,
+    .global_remove = rotation_global_remove,
+};
+
+static void rotation_unwatch_outputs() {
+    for (size_t i = 0; i < rotation.output_count; i++)
+        wl_output_destroy(rotation.outputs[i]);
+    rotation.output_count = 0;
+
+    if (rotation.display_watch != 0)
+        g_source_remove(rotation.display_watch);
+    if (rotation.registry != NULL)
+        wl_registry_destroy(rotation.registry);
+    if (rotation.display != NULL)
+        wl_display_disconnect(rotation.display);
+
+    rotation.display_watch = 0;
+    rotation.registry = NULL;
+    rotation.display = NULL;
+}
+
+static gboolean on_display_event(gint fd, GIOCondition condition, gpointer data) {
+    if ((condition & (G_IO_HUP | G_IO_ERR)) || wl_display_dispatch(rotation.display) < 0) {
+        g_print("Lost the Wayland connection used to watch outputs\n");
+        rotation.display_watch = 0;
+        rotation_unwatch_outputs();
+        return G_SOURCE_REMOVE;
     }
 
-    settings = g_settings_new("org.gnome.settings-daemon.peripherals.touchscreen");
+    wl_display_flush(rotation.display);
+    return G_SOURCE_CONTINUE;
+}
+
+/* kept connected between presses, the transform events come in through the main loop */
+static void rotation_watch_outputs() {
+    if (rotation.display != NULL)
+        return;
 
-    current_value = g_settings_get_boolean(settings, "orientation-lock");
-    if (!current_value) {
+    rotation.display = wl_display_connect(NULL);
+    if (rotation.display == NULL) {
+        g_print("Wayland connection failed, output transforms won't be watched\n");
+        return;
+    }
+
+    rotation.registry = wl_display_get_registry(rotation.display);
+    wl_registry_add_listener(rotation.registry, &rotation_registry_listener, NULL);
+    // first roundtrip binds the outputs, the second one collects their current geometry
+    wl_display_roundtrip(rotation.display);
+    wl_display_roundtrip(rotation.display);
+
+    rotation.display_watch = g_unix_fd_add(wl_display_get_fd(rotation.display),
+                                           G_IO_IN | G_IO_HUP | G_IO_ERR, on_display_event, NULL);
+}
+
+static void rotation_set_orientation(const gchar *orientation) {
+    if (g_strcmp0(rotation.orientation, orientation) == 0)
+        return;
+
+    gboolean changed = rotation.orientation != NULL;
+    g_free(rotation.orientation);
+    rotation.orientation = g_strdup(orientation);
+
+    if (!changed || !rotation.pending)
+        return;
+
+    // without outputs to watch, give phosh a moment to follow the sensor and lock again
+    if (rotation.output_count == 0)
+        rotation_rearm(ROTATION_SETTLE_MS, "an accelerometer orientation change");
+}
+
+static void on_sensor_properties_changed(GDBusConnection *connection, const gchar *sender,
+                                         const gchar *object_path, const gchar *interface_name,
+                                         const gchar *signal_name, GVariant *parameters, gpointer data) {
+    GVariant *changed;
+    const gchar *orientation;
+
+    g_variant_get(parameters, "(s@a{sv}as)", NULL, &changed, NULL);
+    if (g_variant_lookup(changed, "AccelerometerOrientation", "&s", &orientation))
+        rotation_set_orientation(orientation);
+    g_variant_unref(changed);
+}
+
+static void on_orientation_ready(GObject *source, GAsyncResult *res, gpointer data) {
+    GError *error = NULL;
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (result == NULL) {
+        g_printerr("Failed to get the accelerometer orientation: %s\n", error->message);
+        g_error_free(error);
+        return;
+    }
+
+    GVariant *value;
+    g_variant_get(result, "(v)", &value);
+    rotation_set_orientation(g_variant_get_string(value, NULL));
+    g_variant_unref(value);
+    g_variant_unref(result);
+}
+
+static void rotation_watch_sensor() {
+    GError *error = NULL;
+
+    if (rotation.sensor_bus == NULL) {
+        // a mock sensor proxy can be put on the session bus for testing
+        const char *bus = getenv("ASSISTANT_BUTTON_SENSOR_BUS");
+        GBusType bus_type = g_strcmp0(bus, "session") == 0 ? G_BUS_TYPE_SESSION : G_BUS_TYPE_SYSTEM;
+
+        rotation.sensor_bus = g_bus_get_sync(bus_type, NULL, &error);
+        if (rotation.sensor_bus == NULL) {
+            g_printerr("Failed to get the bus for %s: %s\n", SENSOR_PROXY_NAME, error->message);
+            g_error_free(error);
+            return;
+        }
+
+        rotation.sensor_signal_id = g_dbus_connection_signal_subscribe(
+            rotation.sensor_bus, SENSOR_PROXY_NAME, "org.freedesktop.DBus.Properties",
+            "PropertiesChanged", SENSOR_PROXY_PATH, SENSOR_PROXY_NAME,
+            G_DBUS_SIGNAL_FLAGS_NONE, on_sensor_properties_changed, NULL, NULL
+        );
+    }
+
+    // the proxy only reports orientation changes while somebody holds a claim
+    g_dbus_connection_call(rotation.sensor_bus, SENSOR_PROXY_NAME, SENSOR_PROXY_PATH, SENSOR_PROXY_NAME,
+                           "ClaimAccelerometer", NULL, NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL, NULL);
+    g_dbus_connection_call(rotation.sensor_bus, SENSOR_PROXY_NAME, SENSOR_PROXY_PATH,
+                           "org.freedesktop.DBus.Properties", "Get",
+                           g_variant_new("(ss)", SENSOR_PROXY_NAME, "AccelerometerOrientation"),
+                           G_VARIANT_TYPE("(v)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, on_orientation_ready, NULL);
+}
+
+void manual_autorotate() {
+    GSettings *settings = rotation_settings();
+    if (settings == NULL)
+        return;
+
+    if (rotation.pending) {
+        g_print("Rotation already in progress. No action taken.\n");
+        return;
+    }
+
+    if (!g_settings_get_boolean(settings, "orientation-lock")) {
         g_print("Orientation lock is already enabled. No action taken.\n");
-        g_object_unref(settings);
-        g_settings_schema_unref(schema);
         return;
     }
 
-    g_settings_set_boolean(settings, "orientation-lock", FALSE);
-    usleep(2000000); // two second should be enough for phosh to rotate
-    g_settings_set_boolean(settings, "orientation-lock", TRUE);
+    rotation_watch_outputs();
+    rotation_watch_sensor();
 
-    g_object_unref(settings);
-    g_settings_schema_unref(schema);
+    // unlock and let the main loop tell us when phosh rotated, instead of sleeping through it
+    rotation.pending = TRUE;
+    g_settings_set_boolean(settings, "orientation-lock", FALSE);
+    rotation_rearm(ROTATION_TIMEOUT_MS, "the rotation timeout");
 }
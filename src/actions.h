@@ -4,11 +4,41 @@
 #ifndef ACTIONS_H
 #define ACTIONS_H
 
-void handle_flashlight();
+#include <stddef.h>
+#include <stdint.h>
+
+enum PredefinedAction {
+    NO_ACTION = 0,
+    FLASHLIGHT = 1,
+    OPEN_CAMERA = 2,
+    TAKE_PICTURE = 3,
+    TAKE_SCREENSHOT = 4,
+    SEND_TAB = 5,
+    MANUAL_AUTOROTATE = 6,
+    SEND_XF86BACK = 7,
+    SEND_ESCAPE = 8,
+    ACTION_COUNT
+};
+
+/* action ids reported in ActionPerformed for bindings that are not predefined */
+#define CUSTOM_COMMAND_ACTION ACTION_COUNT
+#define MACRO_ACTION (ACTION_COUNT + 1)
+#define MODULE_ACTION (ACTION_COUNT + 2)
+#define CHAIN_ACTION (ACTION_COUNT + 3)
+#define SEND_KEY_ACTION (ACTION_COUNT + 4)
+
+struct macro;
+
 void open_camera();
-void take_picture();
 void take_screenshot();
+void keyboard_set_pacing(int batch, unsigned int key_delay_us);
+int keyboard_prepare(const char *const *names, size_t count);
+uint32_t keyboard_prepare_key(const char *name);
+void send_keysym(uint32_t keysym);
 void send_key(const char *name);
+int load_macro(struct macro *macro, const char *source);
+void play_macro(const struct macro *macro);
 void manual_autorotate();
+void actions_prewarm();
 
 #endif // ACTIONS_H
@@ -0,0 +1,186 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include "adaptive.h"
+#include "stats.h"
+
+#define ADAPTIVE_STATE_VERSION 1
+
+static void histogram_add(struct timing_histogram *histogram, long ms) {
+    if (ms < 0)
+        return;
+
+    long bucket = ms / ADAPTIVE_BUCKET_MS;
+    histogram->buckets[bucket < ADAPTIVE_BUCKETS ? bucket : ADAPTIVE_BUCKETS - 1]++;
+
+    if (++histogram->total < ADAPTIVE_DECAY_SAMPLES)
+        return;
+
+    histogram->total = 0;
+    for (int i = 0; i < ADAPTIVE_BUCKETS; i++) {
+        histogram->buckets[i] /= 2;
+        histogram->total += histogram->buckets[i];
+    }
+}
+
+/* upper edge of the bucket the percentile falls into, -1 without enough samples */
+static int histogram_percentile(const struct timing_histogram *histogram, unsigned int percentile) {
+    if (histogram->total < ADAPTIVE_MIN_SAMPLES)
+        return -1;
+
+    uint64_t wanted = ((uint64_t)histogram->total * percentile + 99) / 100;
+    uint64_t seen = 0;
+    for (int i = 0; i < ADAPTIVE_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= wanted)
+            return (i + 1) * ADAPTIVE_BUCKET_MS;
+    }
+    return ADAPTIVE_BUCKETS * ADAPTIVE_BUCKET_MS;
+}
+
+static int learned_limit(const struct timing_histogram *histogram, unsigned int percentile, int min, int max) {
+    int value = histogram_percentile(histogram, percentile);
+    if (value < 0)
+        return max;
+
+    value *= ADAPTIVE_MARGIN;
+    return value < min ? min : value > max ? max : value;
+}
+
+static int read_histogram(FILE *file, const char *name, struct timing_histogram *histogram) {
+    char label[32];
+
+    if (fscanf(file, "%31s %u", label, &histogram->total) != 2 || strcmp(label, name) != 0)
+        return -1;
+    for (int i = 0; i < ADAPTIVE_BUCKETS; i++) {
+        if (fscanf(file, "%u", &histogram->buckets[i]) != 1)
+            return -1;
+    }
+    return 0;
+}
+
+static void write_histogram(FILE *file, const char *name, const struct timing_histogram *histogram) {
+    fprintf(file, "%s %u", name, histogram->total);
+    for (int i = 0; i < ADAPTIVE_BUCKETS; i++)
+        fprintf(file, " %u", histogram->buckets[i]);
+    fputc('\n', file);
+}
+
+static void adaptive_load(struct adaptive *adaptive) {
+    FILE *file = fopen(adaptive->path, "r");
+    int version;
+
+    if (file == NULL)
+        return;
+
+    if (fscanf(file, "version %d", &version) != 1 || version != ADAPTIVE_STATE_VERSION ||
+        read_histogram(file, "durations", &adaptive->durations) != 0 ||
+        read_histogram(file, "intervals", &adaptive->intervals) != 0) {
+        fprintf(stderr, "Ignoring unreadable press timing state %s\n", adaptive->path);
+        memset(&adaptive->durations, 0, sizeof(adaptive->durations));
+        memset(&adaptive->intervals, 0, sizeof(adaptive->intervals));
+    }
+    fclose(file);
+}
+
+static gboolean on_adaptive_save(gpointer data) {
+    struct adaptive *adaptive = data;
+    char tmp_path[PATH_MAX + 8];
+
+    adaptive->save_id = 0;
+
+    gchar *dir = g_path_get_dirname(adaptive->path);
+    g_mkdir_with_parents(dir, 0700);
+    g_free(dir);
+
+    // write and rename, a crash halfway must not lose what was learned so far
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", adaptive->path);
+    FILE *file = fopen(tmp_path, "w");
+    if (file == NULL) {
+        perror("Failed to save the press timing state");
+        return G_SOURCE_REMOVE;
+    }
+
+    fprintf(file, "version %d\n", ADAPTIVE_STATE_VERSION);
+    write_histogram(file, "durations", &adaptive->durations);
+    write_histogram(file, "intervals", &adaptive->intervals);
+
+    if (fclose(file) != 0 || rename(tmp_path, adaptive->path) != 0) {
+        perror("Failed to save the press timing state");
+        unlink(tmp_path);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static void adaptive_apply(struct adaptive *adaptive, struct gesture *gesture) {
+    gesture->short_press_max = learned_limit(&adaptive->durations, adaptive->percentile,
+                                             adaptive->short_press_min, adaptive->short_press_limit);
+    gesture->double_press_max = learned_limit(&adaptive->intervals, adaptive->percentile,
+                                              adaptive->double_press_min, adaptive->double_press_limit);
+    stats_set(STAT_SHORT_PRESS_MAX_MS, gesture->short_press_max);
+    stats_set(STAT_DOUBLE_PRESS_MAX_MS, gesture->double_press_max);
+}
+
+/* the gesture's configured thresholds become the upper bounds, the learned ones replace them */
+void adaptive_init(struct adaptive *adaptive, struct gesture *gesture) {
+    adaptive->short_press_limit = gesture->short_press_max;
+    adaptive->double_press_limit = gesture->double_press_max;
+
+    if (adaptive->enabled) {
+        const char *state_dir = getenv("XDG_STATE_HOME");
+        const char *home_dir = getenv("HOME");
+
+        if (state_dir)
+            snprintf(adaptive->path, sizeof(adaptive->path), "%s/assistant-button/timing", state_dir);
+        else if (home_dir)
+            snprintf(adaptive->path, sizeof(adaptive->path), "%s/.local/state/assistant-button/timing", home_dir);
+        else
+            adaptive->enabled = 0;
+    }
+
+    if (adaptive->enabled) {
+        adaptive_load(adaptive);
+        adaptive_apply(adaptive, gesture);
+    } else {
+        stats_set(STAT_SHORT_PRESS_MAX_MS, gesture->short_press_max);
+        stats_set(STAT_DOUBLE_PRESS_MAX_MS, gesture->double_press_max);
+    }
+}
+
+/* a press soon after a short press was most likely a double press the window was too tight for */
+void adaptive_press(struct adaptive *adaptive, long long now) {
+    if (!adaptive->enabled || adaptive->last_short_time == 0)
+        return;
+
+    long interval = now - adaptive->last_short_time;
+    adaptive->last_short_time = 0;
+    if (interval < adaptive->double_press_limit)
+        histogram_add(&adaptive->intervals, interval);
+}
+
+void adaptive_gesture(struct adaptive *adaptive, struct gesture *gesture, int event) {
+    if (!adaptive->enabled)
+        return;
+
+    switch (event) {
+        case SHORT_PRESS:
+            histogram_add(&adaptive->durations, gesture->last_duration);
+            adaptive->last_short_time = gesture->first_press_time;
+            break;
+        case DOUBLE_PRESS:
+            histogram_add(&adaptive->durations, gesture->last_duration);
+            histogram_add(&adaptive->intervals, gesture->last_interval);
+            break;
+        default:
+            return;
+    }
+
+    adaptive_apply(adaptive, gesture);
+    if (adaptive->save_id == 0)
+        adaptive->save_id = g_timeout_add_seconds(ADAPTIVE_SAVE_DELAY_S, on_adaptive_save, adaptive);
+}
@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include <limits.h>
+#include <stdint.h>
+#include "gesture.h"
+
+#define ADAPTIVE_BUCKET_MS 10
+#define ADAPTIVE_BUCKETS 100     // covers 0 to 1 s
+#define ADAPTIVE_MIN_SAMPLES 20  // nothing is learned before this many presses
+#define ADAPTIVE_DECAY_SAMPLES 400 // counts are halved at this total, so old habits fade out
+#define ADAPTIVE_MARGIN 1.25     // headroom on top of the percentile
+#define ADAPTIVE_SAVE_DELAY_S 30
+
+/* press timing histogram, ADAPTIVE_BUCKET_MS wide buckets */
+struct timing_histogram {
+    uint32_t buckets[ADAPTIVE_BUCKETS];
+    uint32_t total;
+};
+
+/*
+ * Learns how long the user holds a short press and how quickly the second
+ * press of a double press follows the first, and shrinks short_press_max
+ * and double_press_max to a percentile of that with some margin. The
+ * configured values stay the upper bounds.
+ */
+struct adaptive {
+    int enabled;
+    unsigned int percentile;
+    int short_press_min;
+    int short_press_limit;
+    int double_press_min;
+    int double_press_limit;
+    struct timing_histogram durations;
+    struct timing_histogram intervals;
+    long long last_short_time;
+    unsigned int save_id;
+    char path[PATH_MAX];
+};
+
+void adaptive_init(struct adaptive *adaptive, struct gesture *gesture);
+void adaptive_press(struct adaptive *adaptive, long long now);
+void adaptive_gesture(struct adaptive *adaptive, struct gesture *gesture, int event);
+
+#endif // ADAPTIVE_H
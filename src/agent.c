@@ -0,0 +1,156 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <gio/gio.h>
+#include "agent.h"
+
+#define LOGIND_NAME "org.freedesktop.login1"
+#define LOGIND_SESSION_INTERFACE "org.freedesktop.login1.Session"
+
+static struct {
+    GDBusConnection *bus;
+    gchar *session_path;
+    // until logind says otherwise, a system without it has nobody else to share the button with
+    gboolean active;
+    void (*changed)(void *data);
+    void *data;
+} session = { .active = TRUE };
+
+/* returns a non blocking fd streaming reader_messages, -1 while the reader isn't there */
+int agent_connect(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Reader socket path too long: %s\n", path);
+        return -1;
+    }
+    memcpy(addr.sun_path, path, strlen(path));
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int send_message(int fd, int kind, int code) {
+    struct reader_message message = { .kind = kind, .code = code };
+
+    return send(fd, &message, sizeof(message), MSG_DONTWAIT | MSG_NOSIGNAL) == sizeof(message) ? 0 : -1;
+}
+
+int agent_send_bound(int fd, int bound) {
+    return send_message(fd, READER_BOUND, bound);
+}
+
+/* after every gesture, run or not, the reader keeps the phone awake until then */
+int agent_send_done(int fd) {
+    return send_message(fd, READER_DONE, 0);
+}
+
+static void set_active(gboolean active) {
+    if (session.active == active)
+        return;
+    session.active = active;
+    if (session.changed)
+        session.changed(session.data);
+}
+
+static void on_session_properties_changed(GDBusConnection *connection, const gchar *sender,
+                                          const gchar *object_path, const gchar *interface_name,
+                                          const gchar *signal_name, GVariant *parameters, gpointer data) {
+    GVariant *changed;
+    gboolean active;
+
+    g_variant_get(parameters, "(s@a{sv}as)", NULL, &changed, NULL);
+    if (g_variant_lookup(changed, "Active", "b", &active)) {
+        set_active(active);
+        g_print("Session %s\n", active ? "active, running gestures" : "in the background, ignoring gestures");
+    }
+    g_variant_unref(changed);
+}
+
+static void on_session_active_ready(GObject *source, GAsyncResult *res, gpointer data) {
+    GError *error = NULL;
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (result == NULL) {
+        g_printerr("Failed to get the session state: %s\n", error->message);
+        g_error_free(error);
+        return;
+    }
+
+    GVariant *value;
+    g_variant_get(result, "(v)", &value);
+    set_active(g_variant_get_boolean(value));
+    g_variant_unref(value);
+    g_variant_unref(result);
+}
+
+/*
+ * Every session's agent hears every gesture, only the one in the
+ * foreground acts on them. A user service has no session of its own,
+ * logind's "auto" session is the user's display session then. Its real
+ * object path is what the change signals come from.
+ */
+void agent_watch_session(void (*changed)(void *data), void *data) {
+    GError *error = NULL;
+
+    session.changed = changed;
+    session.data = data;
+
+    session.bus = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &error);
+    if (session.bus == NULL) {
+        g_printerr("Failed to get the system bus, gestures are run whichever session is active: %s\n", error->message);
+        g_error_free(error);
+        return;
+    }
+
+    GVariant *result = g_dbus_connection_call_sync(session.bus, LOGIND_NAME, "/org/freedesktop/login1/session/auto",
+                                                   "org.freedesktop.DBus.Properties", "Get",
+                                                   g_variant_new("(ss)", LOGIND_SESSION_INTERFACE, "Id"),
+                                                   G_VARIANT_TYPE("(v)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+    if (result == NULL) {
+        g_printerr("No logind session, gestures are run whichever session is active: %s\n", error->message);
+        g_error_free(error);
+        return;
+    }
+
+    GVariant *id;
+    g_variant_get(result, "(v)", &id);
+    g_variant_unref(result);
+
+    result = g_dbus_connection_call_sync(session.bus, LOGIND_NAME, "/org/freedesktop/login1",
+                                         "org.freedesktop.login1.Manager", "GetSession",
+                                         g_variant_new("(s)", g_variant_get_string(id, NULL)),
+                                         G_VARIANT_TYPE("(o)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+    g_variant_unref(id);
+    if (result == NULL) {
+        g_printerr("Failed to look up the logind session: %s\n", error->message);
+        g_error_free(error);
+        return;
+    }
+
+    g_variant_get(result, "(o)", &session.session_path);
+    g_variant_unref(result);
+
+    g_dbus_connection_signal_subscribe(session.bus, LOGIND_NAME, "org.freedesktop.DBus.Properties",
+                                       "PropertiesChanged", session.session_path, LOGIND_SESSION_INTERFACE,
+                                       G_DBUS_SIGNAL_FLAGS_NONE, on_session_properties_changed, NULL, NULL);
+    g_dbus_connection_call(session.bus, LOGIND_NAME, session.session_path,
+                           "org.freedesktop.DBus.Properties", "Get",
+                           g_variant_new("(ss)", LOGIND_SESSION_INTERFACE, "Active"),
+                           G_VARIANT_TYPE("(v)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, on_session_active_ready, NULL);
+}
+
+int agent_session_active() {
+    return session.active;
+}
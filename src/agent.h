@@ -0,0 +1,18 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#ifndef AGENT_H
+#define AGENT_H
+
+#include "reader.h"
+
+#define AGENT_RETRY_S 2
+
+/* the daemon's end of split mode, it gets its gestures from assistant-button-reader */
+int agent_connect(const char *path);
+int agent_send_bound(int fd, int bound);
+int agent_send_done(int fd);
+void agent_watch_session(void (*changed)(void *data), void *data);
+int agent_session_active();
+
+#endif // AGENT_H
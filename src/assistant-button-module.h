@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#ifndef ASSISTANT_BUTTON_MODULE_H
+#define ASSISTANT_BUTTON_MODULE_H
+
+#include <stddef.h>
+
+/*
+ * Action modules are shared objects under MODULE_DIR, loaded on first use
+ * and unloaded again after sitting idle. Each one exports a
+ * `const struct ab_module assistant_button_module`.
+ */
+
+#define AB_MODULE_ABI_VERSION 2
+#define AB_MODULE_SYMBOL "assistant_button_module"
+
+/* never dlclose()d once loaded, for modules whose libraries can't be unloaded */
+#define AB_MODULE_RESIDENT 1
+
+/* ab_action flags: fine to run on release, before a double press could still claim the press.
+ * Without an undo() a wrong guess is simply left standing. */
+#define AB_ACTION_SPECULATIVE 1
+
+/* notification kinds understood by ab_host.notify */
+#define AB_NOTIFY_PICTURE 0
+#define AB_NOTIFY_SCREENSHOT 1
+#define AB_NOTIFY_VIDEO 2
+
+/* what the daemon offers to modules, valid from init() to teardown() */
+struct ab_host {
+    void (*notify)(int kind, const char *body);
+    void (*run_command)(const char *command);
+};
+
+struct ab_action {
+    const char *name;
+    /* argument is NULL when the binding didn't give one, returns 0 on success.
+     * Chains call it from executor threads, possibly concurrently. */
+    int (*execute)(const char *argument);
+    unsigned int flags;
+    /* optional, reverts the last execute() when a speculative run turned out to be a double press */
+    int (*undo)(const char *argument);
+};
+
+struct ab_module {
+    unsigned int abi_version;
+    unsigned int flags;
+    const char *name;
+    /* all optional, teardown() must drop every main loop source the module added */
+    int (*init)(const struct ab_host *host);
+    void (*prewarm)(void);
+    void (*teardown)(void);
+    const struct ab_action *actions;
+    size_t action_count;
+};
+
+#endif // ASSISTANT_BUTTON_MODULE_H
@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#ifndef ASSISTANT_BUTTON_STATUS_H
+#define ASSISTANT_BUTTON_STATUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The daemon keeps its bindings, last gesture and counters in a shared
+ * memory page at $XDG_RUNTIME_DIR/AB_STATUS_FILE, read-only for everyone
+ * else. It is one writer under a seqlock: seq is odd while an update is in
+ * progress, and a copy taken between two equal even reads of it is
+ * consistent. The file outlives daemon restarts, so a mapping stays valid.
+ */
+
+#define AB_STATUS_FILE "assistant-button-status"
+#define AB_STATUS_MAGIC "ABSTATUS"
+#define AB_STATUS_VERSION 1
+#define AB_STATUS_MAX_COUNTERS 48
+#define AB_STATUS_NAME_SIZE 32
+#define AB_STATUS_VALUE_SIZE 112
+
+/* gesture indexes, match the daemon's ButtonEvent */
+#define AB_STATUS_SHORT_PRESS 1
+#define AB_STATUS_LONG_PRESS 2
+#define AB_STATUS_DOUBLE_PRESS 3
+
+struct ab_status_binding {
+    char kind[16];                    // binding, command, chain, macro, module, predefined or empty
+    char value[AB_STATUS_VALUE_SIZE]; // the action, command, module binding or predefined action name
+};
+
+struct ab_status_page {
+    char magic[8];
+    uint32_t version;
+    uint32_t size;   // of the struct the writer knows, newer ones only grow
+    uint32_t seq;
+    uint32_t pid;    // of the daemon that wrote it last
+    uint64_t updated_ns; // CLOCK_MONOTONIC
+
+    int32_t last_event;  // AB_STATUS_*_PRESS, 0 before the first gesture
+    int32_t last_action; // as reported in ActionPerformed
+    uint64_t last_event_ns;          // CLOCK_MONOTONIC
+    uint64_t last_event_realtime_ns; // CLOCK_REALTIME
+
+    struct ab_status_binding bindings[AB_STATUS_DOUBLE_PRESS + 1]; // [0] is unused
+
+    uint32_t counter_count;
+    uint32_t reserved;
+    uint64_t counters[AB_STATUS_MAX_COUNTERS];
+    char counter_names[AB_STATUS_MAX_COUNTERS][AB_STATUS_NAME_SIZE];
+};
+
+/* reader library, libassistant-button-status */
+struct ab_status;
+
+/* maps the page, path NULL for the default one, returns NULL with errno set */
+struct ab_status *ab_status_open(const char *path);
+/* copies a consistent snapshot, returns 0, or -1 with errno EAGAIN when the writer kept it busy */
+int ab_status_read(struct ab_status *status, struct ab_status_page *snapshot);
+/* looks a counter up by its GetStats name, returns 0 when found */
+int ab_status_counter(const struct ab_status_page *snapshot, const char *name, uint64_t *value);
+void ab_status_close(struct ab_status *status);
+
+#endif // ASSISTANT_BUTTON_STATUS_H
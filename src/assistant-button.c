@@ -3,122 +3,315 @@
 
 #include <time.h>
 #include <poll.h>
+#include <signal.h>
 #include <errno.h>
 #include <stdio.h>
-#include <fcntl.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
-#include <limits.h>
-#include <sys/stat.h>
-#include <linux/input.h>
-#include <dbus/dbus.h>
+#include <glib-unix.h>
 #include "actions.h"
+#include "accounting.h"
+#include "adaptive.h"
+#include "agent.h"
+#include "bindings.h"
+#include "context.h"
+#include "dbus.h"
+#include "flightrec.h"
+#include "input.h"
+#include "loop.h"
+#include "modules.h"
+#include "rtinput.h"
+#include "stats.h"
+#include "statuspage.h"
 #include "utils.h"
+#include "wakelock.h"
+
+#define DEFAULT_KEY_DELAY_US 0
+#define DEFAULT_ADAPTIVE_PERCENTILE 95
+#define DEFAULT_ADAPTIVE_SHORT_PRESS_MIN 250  // ms
+#define DEFAULT_ADAPTIVE_DOUBLE_PRESS_MIN 120 // ms
+
+/* every key a predefined action can send, baked into the virtual keyboard keymap at startup */
+static const char *const predefined_keys[] = {
+    "Tab",
+    "XF86Back",
+    "Escape",
+};
+
+/* predefined actions that live in a loadable module, loaded the first time they're needed */
+static const struct {
+    const char *module;
+    const char *action;
+} module_actions[ACTION_COUNT] = {
+    [FLASHLIGHT] = { "flashlight", "toggle" },
+    [TAKE_PICTURE] = { "camera", "take_picture" },
+};
+
+/* as shown on the status page */
+static const char *const predefined_names[ACTION_COUNT] = {
+    [FLASHLIGHT] = "flashlight",
+    [OPEN_CAMERA] = "open_camera",
+    [TAKE_PICTURE] = "take_picture",
+    [TAKE_SCREENSHOT] = "take_screenshot",
+    [SEND_TAB] = "send_tab",
+    [MANUAL_AUTOROTATE] = "manual_autorotate",
+    [SEND_XF86BACK] = "send_xf86back",
+    [SEND_ESCAPE] = "send_escape",
+};
 
-#define DEFAULT_SHORT_PRESS_MAX 500  // ms
-#define DEFAULT_DEVICE "/dev/input/event1"
-#define CONFIG_FILE "/etc/assistant-button.conf"
-#define DEFAULT_DOUBLE_PRESS_MAX 200  // ms
-#define ASSISTANT_KEY 112
-#define DBUS_INTERFACE "io.FuriOS.AssistantButton"
-
-enum PredefinedAction {
-    NO_ACTION = 0,
-    FLASHLIGHT = 1,
-    OPEN_CAMERA = 2,
-    TAKE_PICTURE = 3,
-    TAKE_SCREENSHOT = 4,
-    SEND_TAB = 5,
-    MANUAL_AUTOROTATE = 6,
-    SEND_XF86BACK = 7,
-    SEND_ESCAPE = 8,
-    ACTION_COUNT
+/* predefined actions touching state owned by the main loop, chain steps hand these back to it */
+static const unsigned char main_thread_actions[ACTION_COUNT] = {
+    [SEND_TAB] = 1,
+    [MANUAL_AUTOROTATE] = 1,
+    [SEND_XF86BACK] = 1,
+    [SEND_ESCAPE] = 1,
 };
 
-enum ButtonEvent {
-    SHORT_PRESS = 1,
-    LONG_PRESS = 2,
-    DOUBLE_PRESS = 3
+/* predefined actions that may run before a double press could still claim the press,
+ * the module backed ones declare it themselves */
+static const unsigned char predefined_speculation[ACTION_COUNT] = {
+    [SEND_TAB] = SPECULATE_ABSORB,
+};
+
+static const enum stat_counter gesture_stats[] = {
+    [SHORT_PRESS] = STAT_SHORT_PRESSES,
+    [LONG_PRESS] = STAT_LONG_PRESSES,
+    [DOUBLE_PRESS] = STAT_DOUBLE_PRESSES,
+};
+
+static const char *const event_names[] = {
+    [SHORT_PRESS] = "short_press",
+    [LONG_PRESS] = "long_press",
+    [DOUBLE_PRESS] = "double_press",
 };
 
 struct state {
     int fd;
-    struct input_event ev;
     struct pollfd pfd;
-    long long press_time;
-    int press_count;
-    int has_long_press_occurred;
-    int short_press_max;
-    int double_press_max;
-    char device[256];
-    int short_press_count;
-    long first_press_duration;
+    struct input_config config;
+    struct input input;
+    struct adaptive adaptive;
+    int key_batch;
+    unsigned int key_delay_us;
     DBusConnection *conn;
+    long long start_time;
+    int prewarm_stage;
+    int speculative;
+    int realtime;
+    int realtime_priority;
+    char loop_backend[16];
+    // what the pending short press already ran, SPECULATE_NEVER if nothing
+    enum speculation speculated;
+    struct module_call speculated_call;
+    int speculated_action;   // reported once the double press window confirmed it
+    int context_bindings;
+    int split;               // gestures come from assistant-button-reader, fd is its socket then
+    int sent_bound;          // what the reader was last told, -1 if nothing yet
 };
 
+/* heavy setup deferred past readiness, in the order it runs */
+enum PrewarmStage {
+    PREWARM_DBUS,
+    PREWARM_BINDINGS,
+    PREWARM_CONTEXT,
+    PREWARM_ACTIONS,
+    PREWARM_DONE
+};
+
+/* CLOCK_BOOTTIME keeps counting through suspend, a press can't get shorter by the phone sleeping */
 long long current_time_ms() {
     struct timespec spec;
-    clock_gettime(CLOCK_MONOTONIC, &spec);
+    clock_gettime(CLOCK_BOOTTIME, &spec);
     return spec.tv_sec * 1000LL + spec.tv_nsec / 1e6;
 }
 
-void read_config(struct state *state) {
-    FILE *file = fopen(CONFIG_FILE, "r");
-    if (file == NULL) {
-        perror("Failed to open the config file");
+long long current_time_us() {
+    struct timespec spec;
+    clock_gettime(CLOCK_BOOTTIME, &spec);
+    return spec.tv_sec * 1000000LL + spec.tv_nsec / 1000;
+}
+
+/* the daemon's own settings, input_read_config() takes care of the ones the reader shares */
+void read_config_line(const char *line, void *data) {
+    struct state *state = data;
+    char mode[16];
+
+    if (sscanf(line, "KEY_DELAY_US=%u", &state->key_delay_us) == 1)
         return;
+    if (sscanf(line, "ADAPTIVE_TIMING=%d", &state->adaptive.enabled) == 1)
+        return;
+    if (sscanf(line, "ADAPTIVE_PERCENTILE=%u", &state->adaptive.percentile) == 1)
+        return;
+    if (sscanf(line, "ADAPTIVE_SHORT_PRESS_MIN=%d", &state->adaptive.short_press_min) == 1)
+        return;
+    if (sscanf(line, "ADAPTIVE_DOUBLE_PRESS_MIN=%d", &state->adaptive.double_press_min) == 1)
+        return;
+    if (sscanf(line, "SPECULATIVE_SHORT_PRESS=%d", &state->speculative) == 1)
+        return;
+    if (sscanf(line, "REALTIME_INPUT=%d", &state->realtime) == 1)
+        return;
+    if (sscanf(line, "REALTIME_PRIORITY=%d", &state->realtime_priority) == 1)
+        return;
+    if (sscanf(line, "LOOP_BACKEND=%15s", state->loop_backend) == 1)
+        return;
+    if (sscanf(line, "CONTEXT_BINDINGS=%d", &state->context_bindings) == 1)
+        return;
+    if (sscanf(line, "SPLIT_MODE=%d", &state->split) == 1)
+        return;
+    if (sscanf(line, "KEY_INJECTION=%15s", mode) == 1) {
+        // sync is the old wtype behaviour: a roundtrip after every key event
+        if (strcmp(mode, "batch") == 0)
+            state->key_batch = 1;
+        else if (strcmp(mode, "sync") == 0)
+            state->key_batch = 0;
+        else
+            fprintf(stderr, "Unknown KEY_INJECTION mode: %s\n", mode);
     }
-    char line[256];
-    while (fgets(line, sizeof(line), file)) {
-        if (sscanf(line, "SHORT_PRESS_MAX=%d", &state->short_press_max) == 1)
-            continue;
-        if (sscanf(line, "DOUBLE_PRESS_MAX=%d", &state->double_press_max) == 1)
-            continue;
-        if (sscanf(line, "DEVICE=%s", state->device) == 1)
-            continue;
-    }
+}
+
+/* ms since exec(), so the dynamic linker pulling in GStreamer and friends is counted too */
+long long process_age_ms() {
+    char buffer[1024];
+    unsigned long long start_ticks;
+    struct timespec spec;
+
+    FILE *file = fopen("/proc/self/stat", "r");
+    if (file == NULL)
+        return -1;
+    size_t len = fread(buffer, 1, sizeof(buffer) - 1, file);
     fclose(file);
+    buffer[len] = '\0';
+
+    // comm can contain spaces, the fields we want come after its closing paren
+    char *fields = strrchr(buffer, ')');
+    if (fields == NULL || sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu",
+                                 &start_ticks) != 1)
+        return -1;
+
+    clock_gettime(CLOCK_BOOTTIME, &spec);
+    return spec.tv_sec * 1000LL + spec.tv_nsec / 1000000 - start_ticks * 1000 / sysconf(_SC_CLK_TCK);
 }
 
-void init_dbus(struct state *state) {
-    DBusError err;
-    dbus_error_init(&err);
+/* what perform_action() would run */
+void publish_binding(enum ButtonEvent event) {
+    const struct binding *binding = get_binding(event);
 
-    state->conn = dbus_bus_get(DBUS_BUS_SESSION, &err);
-    if (dbus_error_is_set(&err)) {
-        fprintf(stderr, "D-Bus Connection Error: %s\n", err.message);
-        dbus_error_free(&err);
-    }
-    if (state->conn == NULL) {
-        fprintf(stderr, "Failed to connect to D-Bus session bus\n");
-        exit(1);
+    if (binding == NULL)
+        status_page_set_binding(event, NULL, NULL);
+    else if (binding->kind == BINDING_PREDEFINED && binding->text == NULL)
+        status_page_set_binding(event, binding->source, predefined_names[binding->action]);
+    else
+        status_page_set_binding(event, binding->source, binding->text);
+}
+
+/* rewrites the status page, event is the gesture that just ran or GESTURE_NONE for the bindings alone */
+void publish_status(int event, int action) {
+    status_page_begin();
+    if (event != GESTURE_NONE)
+        status_page_set_gesture(event, action);
+    for (int i = SHORT_PRESS; i <= DOUBLE_PRESS; i++)
+        publish_binding(i);
+    status_page_end();
+}
+
+/* whoever classifies presses off the main loop gets told which gestures it has to wait for */
+void publish_bound(struct state *state) {
+    if (state->realtime) {
+        rtinput_publish(bound_gestures(), state->input.gesture.short_press_max, state->input.gesture.double_press_max);
+        return;
     }
 
-    int ret = dbus_bus_request_name(state->conn, DBUS_INTERFACE, DBUS_NAME_FLAG_REPLACE_EXISTING, &err);
-    if (dbus_error_is_set(&err)) {
-        fprintf(stderr, "D-Bus Name Error: %s\n", err.message);
-        dbus_error_free(&err);
+    // a session in the background runs nothing, its bindings mustn't slow down the one in front
+    if (state->split && state->fd >= 0) {
+        int bound = agent_session_active() ? bound_gestures() : 0;
+        if (bound != state->sent_bound && agent_send_bound(state->fd, bound) == 0)
+            state->sent_bound = bound;
     }
+}
+
+/* split mode, a session coming to the front or going away changes what the reader has to wait for */
+void on_session_changed(void *data) {
+    publish_bound(data);
+}
+
+/* a file under the config directory changed, the bindings were compiled again */
+void on_bindings_changed(void *data) {
+    publish_bound(data);
+    publish_status(GESTURE_NONE, NO_ACTION);
+}
 
-    /* how likely is it for this to not be primary owner? does it even need a check */
-    if (ret != DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER) {
-        fprintf(stderr, "Not primary owner of the D-Bus name\n");
-        exit(1);
+/* the bindings each gesture resolves to change with the context, not with the press */
+void on_context_changed(const struct context *context, void *data) {
+    struct state *state = data;
+
+    bindings_set_context(context);
+    publish_bound(state);
+    publish_status(GESTURE_NONE, NO_ACTION);
+}
+
+/* runs one stage per main loop iteration, so a press arriving meanwhile is never stuck behind all of them */
+gboolean on_prewarm(gpointer data) {
+    struct state *state = data;
+
+    switch (state->prewarm_stage++) {
+        case PREWARM_DBUS:
+            state->conn = init_dbus();
+            break;
+        case PREWARM_BINDINGS:
+            keyboard_prepare(predefined_keys, sizeof(predefined_keys) / sizeof(predefined_keys[0]));
+            if (status_page_init() == 0)
+                publish_status(GESTURE_NONE, NO_ACTION);
+            break;
+        case PREWARM_CONTEXT:
+            if (state->context_bindings)
+                context_init(on_context_changed, state);
+            break;
+        case PREWARM_ACTIONS:
+            actions_prewarm();
+            // only modules a binding points at, the rest never get loaded
+            for (int event = SHORT_PRESS; event <= DOUBLE_PRESS; event++) {
+                const struct binding *binding = get_binding(event);
+                if (binding && binding->kind == BINDING_MODULE)
+                    module_prewarm(binding->call.name);
+                else if (binding && binding->kind == BINDING_PREDEFINED && module_actions[binding->action].module)
+                    module_prewarm(module_actions[binding->action].module);
+            }
+            break;
     }
+
+    if (state->prewarm_stage < PREWARM_DONE)
+        return G_SOURCE_CONTINUE;
+
+    fprintf(stderr, "Prewarmed in %.1f ms\n", (current_time_us() - state->start_time) / 1000.0);
+    return G_SOURCE_REMOVE;
 }
 
-void handle_predefined_action(enum PredefinedAction action) {
+void cleanup(struct state *state) {
+    wakelock_release(0);
+    loop_forget(state->pfd.fd);
+    close(state->fd);
+    if (state->conn)
+        dbus_connection_unref(state->conn);
+}
+
+gboolean on_dump_signal(gpointer data) {
+    const char *path = flightrec_default_path();
+
+    if (flightrec_dump(path) == 0)
+        fprintf(stderr, "Flight recorder dumped to %s\n", path);
+    return G_SOURCE_CONTINUE;
+}
+
+int handle_predefined_action(enum PredefinedAction action) {
+    if (module_actions[action].module)
+        return module_execute(module_actions[action].module, module_actions[action].action, NULL);
+
     switch (action) {
-        case FLASHLIGHT:
-            handle_flashlight();
-            break;
         case OPEN_CAMERA:
             open_camera();
             break;
-        case TAKE_PICTURE:
-            take_picture();
-            break;
         case TAKE_SCREENSHOT:
             take_screenshot();
             break;
@@ -136,313 +329,453 @@ void handle_predefined_action(enum PredefinedAction action) {
             break;
         default:
             fprintf(stderr, "Unknown predefined action: %d\n", action);
+            return -1;
     }
+    return 0;
 }
 
-int read_config_int(const char *filename) {
-    const char *home_dir = getenv("HOME");
-    if (home_dir == NULL) {
-        fprintf(stderr, "Error: HOME environment variable not set\n");
-        return -1;
-    }
-
-    char file_path[PATH_MAX];
-    snprintf(file_path, sizeof(file_path), "%s/.config/assistant-button/%s", home_dir, filename);
-
-    FILE *file = fopen(file_path, "r");
-    if (file == NULL)
-        return -1;
-
-    char buffer[32];
-    if (fgets(buffer, sizeof(buffer), file) == NULL) {
-        fclose(file);
-        return -1;
-    }
-
-    fclose(file);
-
-    char *endptr;
-    long value = strtol(buffer, &endptr, 10);
+int run_predefined_on_main(void *data) {
+    return handle_predefined_action((enum PredefinedAction)GPOINTER_TO_INT(data));
+}
 
-    if (endptr == buffer || *endptr != '\n') {
-        fprintf(stderr, "Error: Invalid integer in file %s\n", file_path);
-        return -1;
-    }
+/* runs on the action executor for every chain step that isn't a shell command */
+int run_chain_step(const struct chain_step *step) {
+    if (step->kind == CHAIN_STEP_MODULE)
+        return module_run_binding(step->argument);
 
-    if (value < INT_MIN || value > INT_MAX) {
-        fprintf(stderr, "Error: Integer out of range in file %s\n", file_path);
+    if (step->predefined >= ACTION_COUNT) {
+        fprintf(stderr, "Unknown predefined action: %d\n", step->predefined);
         return -1;
     }
 
-    return (int)value;
+    if (main_thread_actions[step->predefined])
+        return loop_invoke_sync(run_predefined_on_main, GINT_TO_POINTER(step->predefined));
+    return handle_predefined_action((enum PredefinedAction)step->predefined);
 }
 
-char* parse_custom_action(const char *filename) {
-    const char *home_dir = getenv("HOME");
-    if (home_dir == NULL)
-        return NULL;
-
-    char file_path[512];
-    snprintf(file_path, sizeof(file_path), "%s/.config/assistant-button/%s", home_dir, filename);
-
-    struct stat st;
-    if (stat(file_path, &st) == 0 && S_ISREG(st.st_mode)) {
-        int fd = open(file_path, O_RDONLY);
-        if (fd != -1) {
-            static char buffer[256];
-            ssize_t bytes_read = read(fd, buffer, sizeof(buffer) - 1);
-            close(fd);
-
-            if (bytes_read > 0) {
-                buffer[bytes_read] = '\0';
-                if (strlen(buffer) > 0)
-                    return buffer;
-            }
-        }
+/* everything a binding needs was resolved when it was compiled */
+int run_binding(const struct binding *binding, enum ButtonEvent event) {
+    switch (binding->kind) {
+        case BINDING_KEY:
+            send_keysym(binding->keysym);
+            return 0;
+        case BINDING_PREDEFINED:
+            return handle_predefined_action((enum PredefinedAction)binding->action);
+        case BINDING_MODULE:
+            return module_execute(binding->call.name, binding->call.action,
+                                  *binding->call.argument ? binding->call.argument : NULL);
+        case BINDING_COMMAND:
+            if (binding->argv)
+                run_argv(binding->argv);
+            else
+                run_command(binding->command);
+            return 0;
+        case BINDING_CHAIN:
+            return chain_start(binding->chain, event_names[event], run_chain_step);
+        case BINDING_MACRO:
+            play_macro(binding->macro);
+            return 0;
+        case BINDING_NONE:
+            break;
     }
-    return NULL;
+    return -1;
 }
 
-int has_short_press_action() {
-    return parse_custom_action("short_press") != NULL || read_config_int("short_press_predefined") > 0;
+/* returns the id to report in ActionPerformed for whatever ran, NO_ACTION if nothing is bound */
+int run_action(enum ButtonEvent event) {
+    const struct binding *binding = get_binding(event);
+    if (binding == NULL)
+        return NO_ACTION;
+
+    // a chain that didn't start has nothing to report
+    if (run_binding(binding, event) != 0 && binding->kind == BINDING_CHAIN)
+        return NO_ACTION;
+    return binding->action;
 }
 
-int has_long_press_action() {
-    return parse_custom_action("long_press") != NULL || read_config_int("long_press_predefined") > 0;
+int perform_action(struct state *state, enum ButtonEvent event) {
+    int action = run_action(event);
+    if (action != NO_ACTION)
+        emit_dbus_signal(state->conn, action, event);
+    return action;
 }
 
-int has_double_press_action() {
-    return parse_custom_action("double_press") != NULL || read_config_int("double_press_predefined") > 0;
+/* whether the short press binding may run before the double press window closed */
+enum speculation short_press_speculation(struct module_call *call) {
+    const struct binding *binding = get_binding(SHORT_PRESS);
+    if (binding == NULL)
+        return SPECULATE_NEVER;
+
+    switch (binding->kind) {
+        case BINDING_KEY:
+            return binding->action < ACTION_COUNT ? predefined_speculation[binding->action] : SPECULATE_NEVER;
+        case BINDING_PREDEFINED:
+            if (module_actions[binding->action].module == NULL)
+                return predefined_speculation[binding->action];
+            g_strlcpy(call->name, module_actions[binding->action].module, sizeof(call->name));
+            g_strlcpy(call->action, module_actions[binding->action].action, sizeof(call->action));
+            call->argument[0] = '\0';
+            return module_speculation(call);
+        case BINDING_MODULE:
+            *call = binding->call;
+            return module_speculation(call);
+        default:
+            // commands, chains and macros can do anything, so they always wait
+            return SPECULATE_NEVER;
+    }
 }
 
-void emit_dbus_signal(struct state *state, int action, int event_type) {
-    DBusMessage *msg;
-    DBusMessageIter args;
+/* the short press already ran when it turned out to be the first half of a double press */
+void rollback_speculation(struct state *state) {
+    long long start = current_time_us();
+    int ret = 0;
 
-    msg = dbus_message_new_signal("/io/FuriOS/AssistantButton",
-                                  DBUS_INTERFACE,
-                                  "ActionPerformed");
-    if (msg == NULL) {
-        fprintf(stderr, "Failed to create D-Bus message\n");
-        return;
+    if (state->speculated == SPECULATE_UNDO) {
+        ret = module_undo(&state->speculated_call);
+        stats_add(STAT_SPECULATIVE_UNDONE, 1);
+    } else {
+        stats_add(STAT_SPECULATIVE_ABSORBED, 1);
     }
+    flightrec_record(FR_ROLLBACK, state->speculated, ret, current_time_us() - start);
+    state->speculated = SPECULATE_NEVER;
+}
 
-    dbus_message_iter_init_append(msg, &args);
-    if (!dbus_message_iter_append_basic(&args, DBUS_TYPE_INT32, &action) ||
-        !dbus_message_iter_append_basic(&args, DBUS_TYPE_INT32, &event_type)) {
-        fprintf(stderr, "Failed to append arguments to D-Bus message\n");
-        dbus_message_unref(msg);
+void run_gesture(struct state *state, int event) {
+    if (event == GESTURE_NONE)
         return;
-    }
 
-    if (!dbus_connection_send(state->conn, msg, NULL))
-        fprintf(stderr, "Failed to send D-Bus message\n");
+    long long start = current_time_us();
+    long long lag = start > state->input.origin_us ? start - state->input.origin_us : 0;
+
+    stats_add(gesture_stats[event], 1);
+    stats_add(STAT_GESTURE_LAG_US_TOTAL, lag);
+    stats_max(STAT_GESTURE_LAG_US_MAX, lag);
+    adaptive_gesture(&state->adaptive, &state->input.gesture, event);
+    flightrec_record(FR_GESTURE, event, start / 1000 - state->input.gesture.press_time, 0);
+
+    if (state->speculated != SPECULATE_NEVER) {
+        if (event == SHORT_PRESS) {
+            // guessed right, it ran on release already and only now counts as performed
+            state->speculated = SPECULATE_NEVER;
+            emit_dbus_signal(state->conn, state->speculated_action, SHORT_PRESS);
+            publish_status(SHORT_PRESS, state->speculated_action);
+            return;
+        }
+        rollback_speculation(state);
+    }
 
-    dbus_message_unref(msg);
+    int action = perform_action(state, event);
+    flightrec_record(FR_ACTION, event, action, current_time_us() - start);
+    publish_status(event, action);
 }
 
-int short_press(struct state *state) {
-    char *command = parse_custom_action("short_press");
-    if (command) {
-        run_command(command);
-        emit_dbus_signal(state, ACTION_COUNT, SHORT_PRESS);
-        return 1;
-    }
+/*
+ * Runs the short press on its release instead of when the double press
+ * window closes. ActionPerformed and the status page wait for the window,
+ * a double press rolls it back without anyone having been told.
+ */
+void speculate_short_press(struct state *state) {
+    enum speculation speculation = short_press_speculation(&state->speculated_call);
+    if (speculation == SPECULATE_NEVER)
+        return;
 
-    int action_index = read_config_int("short_press_predefined");
-    if (action_index > 0 && action_index < ACTION_COUNT) {
-        handle_predefined_action((enum PredefinedAction)action_index);
-        emit_dbus_signal(state, action_index, SHORT_PRESS);
-        return 1;
-    }
+    long long start = current_time_us();
+    int action = run_action(SHORT_PRESS);
+    if (action == NO_ACTION)
+        return;
 
-    return 0;
+    state->speculated = speculation;
+    state->speculated_action = action;
+    stats_add(STAT_SPECULATIVE_RUNS, 1);
+    flightrec_record(FR_ACTION, SHORT_PRESS, action, current_time_us() - start);
 }
 
-int long_press(struct state *state) {
-    char *command = parse_custom_action("long_press");
-    if (command) {
-        run_command(command);
-        emit_dbus_signal(state, ACTION_COUNT, LONG_PRESS);
-        return 1;
-    }
+/* what the input stage made of the edges read on the main loop */
+void on_input(void *data, enum input_kind kind, int event) {
+    struct state *state = data;
 
-    int action_index = read_config_int("long_press_predefined");
-    if (action_index > 0 && action_index < ACTION_COUNT) {
-        handle_predefined_action((enum PredefinedAction)action_index);
-        emit_dbus_signal(state, action_index, LONG_PRESS);
-        return 1;
+    switch (kind) {
+        case INPUT_PRESS:
+            adaptive_press(&state->adaptive, state->input.gesture.press_time);
+            break;
+        case INPUT_SPECULATE:
+            if (state->speculative && state->speculated == SPECULATE_NEVER)
+                speculate_short_press(state);
+            break;
+        case INPUT_GESTURE:
+            run_gesture(state, event);
+            break;
     }
+}
 
-    return 0;
+int input_bound(void *data) {
+    return bound_gestures();
 }
 
-int double_press(struct state *state) {
-    char *command = parse_custom_action("double_press");
-    if (command) {
-        run_command(command);
-        emit_dbus_signal(state, ACTION_COUNT, DOUBLE_PRESS);
-        return 1;
-    }
+static const struct input_ops input_ops = {
+    .read = loop_read,
+    .bound = input_bound,
+    .emit = on_input,
+};
 
-    int action_index = read_config_int("double_press_predefined");
-    if (action_index > 0 && action_index < ACTION_COUNT) {
-        handle_predefined_action((enum PredefinedAction)action_index);
-        emit_dbus_signal(state, action_index, DOUBLE_PRESS);
-        return 1;
-    }
+int handle_events(struct state *state) {
+    if (input_read(&state->input) == 0)
+        return 0;
 
-    return 0;
+    flightrec_record(FR_ERROR, errno, 0, 0);
+    perror("Failed to read the event");
+    return -1;
 }
 
-#define MAX(a, b) ((a) > (b) ? (a) : (b))
+/* the main loop side of REALTIME_INPUT, runs whatever the input thread classified */
+int handle_rtinput(struct state *state) {
+    struct rtinput_item item;
+    uint64_t count;
 
-int calculate_timeout(struct state *state) {
-    if (state->press_count == 0)
+    if (loop_read(state->pfd.fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        perror("Failed to read the input eventfd");
         return -1;
+    }
 
-    long long current_time = current_time_ms();
-    long time_since_press = current_time - state->press_time;
-
-    if (has_long_press_action() && !state->has_long_press_occurred)
-        return MAX(0, state->short_press_max - time_since_press);
-    if (has_double_press_action() && state->short_press_count == 1)
-        return MAX(0, state->double_press_max - time_since_press);
+    while (rtinput_pop(&item)) {
+        switch (item.kind) {
+            case RTINPUT_PRESS:
+                adaptive_press(&state->adaptive, item.press_time);
+                break;
+            case RTINPUT_SPECULATE:
+                if (state->speculated == SPECULATE_NEVER)
+                    speculate_short_press(state);
+                break;
+            case RTINPUT_GESTURE:
+                // what adaptive and the flight recorder read off the gesture, as the input thread saw it
+                state->input.gesture.press_time = item.press_time;
+                state->input.gesture.last_duration = item.last_duration;
+                state->input.gesture.last_interval = item.last_interval;
+                state->input.origin_us = item.origin_us;
+                run_gesture(state, item.event);
+                break;
+            case RTINPUT_IDLE:
+                wakelock_release(item.code);
+                break;
+            case RTINPUT_ERROR:
+                fprintf(stderr, "Input thread failed: %s\n", strerror(item.code));
+                return -1;
+        }
 
+        // the thread classifies the next edges with whatever the bindings and thresholds are now
+        publish_bound(state);
+    }
     return 0;
 }
 
-void reset_state(struct state *state) {
-    state->short_press_count = 0;
-    state->press_count = 0;
-    state->has_long_press_occurred = 0;
+gboolean on_reader_retry(gpointer data) {
+    struct state *state = data;
+
+    state->fd = agent_connect(state->config.reader_socket);
+    if (state->fd < 0)
+        return G_SOURCE_CONTINUE;
+
+    fprintf(stderr, "Connected to the reader on %s\n", state->config.reader_socket);
+    state->pfd.fd = state->fd;
+    state->sent_bound = -1;
+    publish_bound(state);
+    return G_SOURCE_REMOVE;
 }
 
-int handle_events(struct state *state) {
-    while (1) {
-        int ret = poll(&state->pfd, 1, 0);
-        if (ret > 0) {
-            if (read(state->fd, &state->ev, sizeof(struct input_event)) == -1) {
-                perror("Failed to read the event");
-                return -1;
-            }
+/* a reader restart isn't ours to fail over, keep trying until it's back */
+void reader_lost(struct state *state) {
+    if (state->fd >= 0) {
+        fprintf(stderr, "Lost the reader, reconnecting\n");
+        loop_forget(state->fd);
+        close(state->fd);
+    }
+    state->fd = -1;
+    state->pfd.fd = -1;
+    g_timeout_add_seconds(AGENT_RETRY_S, on_reader_retry, state);
+}
 
-            if (state->ev.type == EV_KEY && state->ev.code == ASSISTANT_KEY) {
-                if (state->ev.value == 1) {
-                    state->press_time = current_time_ms();
-                    state->press_count++;
-                    state->has_long_press_occurred = 0;
-                } else if (state->ev.value == 0) {
-                    if (!state->has_long_press_occurred) {
-                        long duration = current_time_ms() - state->press_time;
-                        if (duration < state->short_press_max) {
-                            // Short press: if we don't have a double press action, execute the short press action immediately
-                            if (!has_double_press_action()) {
-                                short_press(state);
-                                reset_state(state);
-                            } else {
-                                state->short_press_count++;
-                                if (state->short_press_count > 1) {
-                                    double_press(state);
-                                    reset_state(state);
-                                }
-                            }
-                        }
-                    }
+/* the main loop side of split mode, runs whatever the reader classified */
+void handle_reader(struct state *state) {
+    struct reader_message message;
+    ssize_t len;
+
+    while ((len = loop_read(state->fd, &message, sizeof(message))) == sizeof(message)) {
+        // the reader's limits are the ones that count, these only show them
+        state->input.gesture.short_press_max = message.short_press_max;
+        state->input.gesture.double_press_max = message.double_press_max;
+
+        switch (message.kind) {
+            case READER_HELLO:
+                if (message.code != READER_PROTOCOL_VERSION) {
+                    fprintf(stderr, "The reader speaks protocol %d, not %d\n", message.code, READER_PROTOCOL_VERSION);
+                    reader_lost(state);
+                    return;
                 }
-            }
-        } else if (ret == 0) {
-            return 0; // No more events
-        } else {
-            if (errno != EINTR) {
-                perror("Poll failed");
-                return -1;
-            }
+                break;
+            case READER_SPECULATE:
+                if (state->speculative && state->speculated == SPECULATE_NEVER && agent_session_active())
+                    speculate_short_press(state);
+                break;
+            case READER_GESTURE:
+                if (!agent_session_active())
+                    break;
+                state->input.gesture.press_time = message.press_time;
+                state->input.gesture.last_duration = message.last_duration;
+                state->input.gesture.last_interval = message.last_interval;
+                state->input.origin_us = message.origin_us;
+                run_gesture(state, message.event);
+                break;
+        }
+
+        // the reader holds its wakelock until then, background sessions answer too
+        if (message.kind == READER_GESTURE && agent_send_done(state->fd) != 0) {
+            reader_lost(state);
+            return;
         }
     }
-}
 
-void wait_for_next_event(struct state *state) {
-    int timeout = -1;
-    if ((has_double_press_action() || has_long_press_action()) && state->press_count > 0) {
-        timeout = state->short_press_max;
+    if (len == 0 || (len < 0 && errno != EAGAIN && errno != EINTR)) {
+        reader_lost(state);
+        return;
     }
-    poll(&state->pfd, 1, timeout);
+    publish_bound(state);
 }
 
 int main(int argc, char *argv[]) {
     struct state state = {
         .fd = -1,
-        .press_time = 0,
-        .press_count = 0,
-        .has_long_press_occurred = 0,
-        .short_press_max = DEFAULT_SHORT_PRESS_MAX,
-        .double_press_max = DEFAULT_DOUBLE_PRESS_MAX,
-        .short_press_count = 0,
-        .first_press_duration = 0,
-        .conn = NULL
+        .key_batch = 1,
+        .realtime_priority = RTINPUT_DEFAULT_PRIORITY,
+        .context_bindings = 1,
+        .sent_bound = -1,
+        .key_delay_us = DEFAULT_KEY_DELAY_US,
+        .adaptive = {
+            .percentile = DEFAULT_ADAPTIVE_PERCENTILE,
+            .short_press_min = DEFAULT_ADAPTIVE_SHORT_PRESS_MIN,
+            .double_press_min = DEFAULT_ADAPTIVE_DOUBLE_PRESS_MIN,
+        },
+        .conn = NULL,
+        .start_time = current_time_us(),
+        .prewarm_stage = PREWARM_DBUS
     };
 
-    strcpy(state.device, DEFAULT_DEVICE);
-
-    read_config(&state);
+    input_read_config(&state.config, read_config_line, &state);
 
     if (argc > 1)
-        state.short_press_max = atoi(argv[1]);
+        state.config.short_press_max = atoi(argv[1]);
 
     if (argc > 2)
-        state.double_press_max = atoi(argv[2]);
+        state.config.double_press_max = atoi(argv[2]);
 
     if (argc > 3) {
-        strncpy(state.device, argv[3], sizeof(state.device) - 1);
-        state.device[sizeof(state.device) - 1] = '\0';
+        strncpy(state.config.device, argv[3], sizeof(state.config.device) - 1);
+        state.config.device[sizeof(state.config.device) - 1] = '\0';
     }
 
-    state.fd = open(state.device, O_RDONLY | O_NONBLOCK);
-    if (state.fd == -1) {
-        perror("Failed to open the device");
-        return EXIT_FAILURE;
+    // the reader owns the device, the timing and the wakelock, all that's left here is running actions
+    if (state.split) {
+        state.realtime = 0;
+        state.config.wakelock = 0;
+        state.adaptive.enabled = 0;
+    }
+
+    // argv and the config give the upper bounds, the learned thresholds can only be tighter
+    input_init(&state.input, &state.config, &input_ops, &state);
+    adaptive_init(&state.adaptive, &state.input.gesture);
+    stats_set_device(state.split ? state.config.reader_socket : state.config.device);
+
+    if (state.split) {
+        state.fd = agent_connect(state.config.reader_socket);
+    } else {
+        if (input_open(&state.input, state.config.device) != 0)
+            return EXIT_FAILURE;
+        state.fd = state.input.fd;
     }
 
     state.pfd.fd = state.fd;
     state.pfd.events = POLLIN;
 
-    init_dbus(&state);
+    if (loop_init(state.loop_backend[0] ? state.loop_backend : NULL) != 0) {
+        cleanup(&state);
+        return EXIT_FAILURE;
+    }
 
-    while (1) {
-        int timeout = calculate_timeout(&state);
-        int ret = poll(&state.pfd, 1, timeout);
+    g_unix_signal_add(SIGUSR1, on_dump_signal, NULL);
+    // before anything asks what's bound
+    bindings_init(on_bindings_changed, &state);
+
+    if (state.split) {
+        agent_watch_session(on_session_changed, &state);
+        if (state.fd < 0) {
+            fprintf(stderr, "No reader on %s yet, waiting for it\n", state.config.reader_socket);
+            reader_lost(&state);
+        }
+    }
+
+    // before the input thread starts, which takes it too
+    if (state.config.wakelock)
+        wakelock_init();
+
+    if (state.realtime) {
+        int fd = rtinput_start(&state.input, bound_gestures(), state.speculative, state.realtime_priority);
+        if (fd >= 0)
+            state.pfd.fd = fd;
+        else
+            state.realtime = 0;
+        stats_set(STAT_REALTIME_INPUT, state.realtime);
+    }
+    keyboard_set_pacing(state.key_batch, state.key_delay_us);
+
+    // presses can be classified from here on, everything else is set up lazily or prewarmed below
+    char status[96];
+    char message[128];
+    snprintf(status, sizeof(status), "Ready in %.1f ms, %lld ms since exec",
+             (current_time_us() - state.start_time) / 1000.0, process_age_ms());
+    snprintf(message, sizeof(message), "READY=1\nSTATUS=%s", status);
+    notify_systemd(message);
+    fprintf(stderr, "%s\n", status);
+
+    g_idle_add(on_prewarm, &state);
 
-        if (ret > 0) {
-            if (handle_events(&state) != 0) {
-                close(state.fd);
-                dbus_connection_unref(state.conn);
+    while (1) {
+        int timeout = input_timeout(&state.input, current_time_us());
+        // no fd while split mode waits for the reader to come back
+        int ret = loop_poll(&state.pfd, state.pfd.fd >= 0, timeout);
+        // GLib's sources were dispatched and accounted for already, this is our own share
+        enum account_subsystem previous = account_enter(ret > 0 ? ACCOUNT_INPUT : ret == 0 ? ACCOUNT_TIMER : ACCOUNT_LOOP);
+
+        // with REALTIME_INPUT the device belongs to the input thread, nothing is pending here
+        if (ret > 0 && state.split) {
+            handle_reader(&state);
+        } else if (ret > 0) {
+            if ((state.realtime ? handle_rtinput(&state) : handle_events(&state)) != 0) {
+                cleanup(&state);
                 return EXIT_FAILURE;
             }
+            // counters only, a gesture that completed has published everything already
+            status_page_begin();
+            status_page_end();
         } else if (ret == 0) {
-            // Timeout occurred, process any pending double/long press actions
-            long long current_time = current_time_ms();
-            long duration = current_time - state.press_time;
-
-            if (state.short_press_count == 1 && duration >= state.double_press_max) {
-                short_press(&state);
-                reset_state(&state);
-            } else if (duration >= state.short_press_max && !state.has_long_press_occurred && state.press_count > 0) {
-                long_press(&state);
-                reset_state(&state);
-                state.has_long_press_occurred = 1;
-            }
+            // Timeout occurred (or a GLib source woke us up), process any pending double/long press actions
+            input_expire(&state.input, current_time_us());
         } else {
             if (errno != EINTR) {
+                flightrec_record(FR_ERROR, errno, 0, 0);
                 perror("Poll failed");
-                close(state.fd);
-                dbus_connection_unref(state.conn);
+                cleanup(&state);
                 return EXIT_FAILURE;
             }
         }
+
+        // with REALTIME_INPUT the input thread says when through RTINPUT_IDLE
+        if (!state.realtime) {
+            unsigned int epoch = input_idle(&state.input);
+            if (epoch)
+                wakelock_release(epoch);
+        }
+        account_leave(previous);
     }
 
-    close(state.fd);
-    dbus_connection_unref(state.conn);
+    cleanup(&state);
     return 0;
 }
@@ -0,0 +1,640 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <ctype.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <gio/gio.h>
+#include "actions.h"
+#include "bindings.h"
+#include "chain.h"
+#include "context.h"
+
+#define MAX_BINDING_SIZE 65536
+#define MAX_CONTEXT_DIR (CONTEXT_APP_ID_SIZE + 8)
+#define MAX_COMMAND_ARGS 64
+// a command using any of these needs the shell to mean what it says
+#define SHELL_CHARS "|&;<>()$`\\\"'*?[]#~=%{}\n"
+
+/* per gesture config files under ~/.config/assistant-button */
+static const struct {
+    const char *command;
+    const char *predefined;
+    const char *macro;
+    const char *module;
+    const char *chain;
+} binding_files[] = {
+    [SHORT_PRESS] = { "short_press", "short_press_predefined", "short_press_macro", "short_press_module", "short_press_chain" },
+    [LONG_PRESS] = { "long_press", "long_press_predefined", "long_press_macro", "long_press_module", "long_press_chain" },
+    [DOUBLE_PRESS] = { "double_press", "double_press_predefined", "double_press_macro", "double_press_module", "double_press_chain" },
+};
+
+/* the action types of the bindings file, module ones take a number between min and max as argument */
+static const struct {
+    const char *type;
+    enum binding_kind kind;
+    int action;
+    const char *module;
+    const char *module_action;
+    int min, max;
+} binding_types[] = {
+    { "send_key", BINDING_KEY, SEND_KEY_ACTION },
+    { "flashlight", BINDING_MODULE, FLASHLIGHT, "flashlight", "toggle", 1, 100 },
+    { "camera", BINDING_MODULE, TAKE_PICTURE, "camera", "take_picture", 0, INT_MAX },
+    { "record", BINDING_MODULE, MODULE_ACTION, "camera", "record_toggle", 0, INT_MAX },
+    { "open_camera", BINDING_PREDEFINED, OPEN_CAMERA },
+    { "screenshot", BINDING_PREDEFINED, TAKE_SCREENSHOT },
+    { "autorotate", BINDING_PREDEFINED, MANUAL_AUTOROTATE },
+    { "module", BINDING_MODULE, MODULE_ACTION },
+    { "command", BINDING_COMMAND, CUSTOM_COMMAND_ACTION },
+};
+
+/* keys that used to be predefined actions of their own, they keep reporting those ids */
+static const struct {
+    const char *name;
+    int action;
+} key_actions[] = {
+    { "Tab", SEND_TAB },
+    { "XF86Back", SEND_XF86BACK },
+    { "Escape", SEND_ESCAPE },
+};
+
+static struct binding compiled[DOUBLE_PRESS + 1]; // lines of the bindings file
+static struct binding legacy[DOUBLE_PRESS + 1];   // the one-value files, chains and macros
+static struct macro macros[DOUBLE_PRESS + 1];
+static struct chain chains[DOUBLE_PRESS + 1];
+// what each gesture runs, the only thing a press looks at
+static const struct binding *resolved[DOUBLE_PRESS + 1];
+static int bound;
+// the subdirectory each gesture binds from in the current context, empty for the global bindings
+static char context_dirs[DOUBLE_PRESS + 1][MAX_CONTEXT_DIR];
+
+static struct {
+    void (*changed)(void *data);
+    void *data;
+    struct context context;
+    GFileMonitor *monitors[3]; // the config directory, screen_off and locked
+    GFileMonitor *app_monitor;
+    char app_dir[MAX_CONTEXT_DIR];
+} watch;
+
+/* a gesture's binding file as seen from its context directory, shares one buffer between calls */
+static const char *context_file(enum ButtonEvent event, const char *filename) {
+    static char path[MAX_CONTEXT_DIR + 32];
+
+    if (context_dirs[event][0] == '\0')
+        return filename;
+    snprintf(path, sizeof(path), "%s/%s", context_dirs[event], filename);
+    return path;
+}
+
+int read_config_int(const char *filename) {
+    const char *home_dir = getenv("HOME");
+    if (home_dir == NULL) {
+        fprintf(stderr, "Error: HOME environment variable not set\n");
+        return -1;
+    }
+
+    char file_path[PATH_MAX];
+    snprintf(file_path, sizeof(file_path), "%s/.config/assistant-button/%s", home_dir, filename);
+
+    FILE *file = fopen(file_path, "r");
+    if (file == NULL)
+        return -1;
+
+    char buffer[32];
+    if (fgets(buffer, sizeof(buffer), file) == NULL) {
+        fclose(file);
+        return -1;
+    }
+
+    fclose(file);
+
+    char *endptr;
+    long value = strtol(buffer, &endptr, 10);
+
+    if (endptr == buffer || *endptr != '\n') {
+        fprintf(stderr, "Error: Invalid integer in file %s\n", file_path);
+        return -1;
+    }
+
+    if (value < INT_MIN || value > INT_MAX) {
+        fprintf(stderr, "Error: Integer out of range in file %s\n", file_path);
+        return -1;
+    }
+
+    return (int)value;
+}
+
+char* parse_custom_action(const char *filename) {
+    const char *home_dir = getenv("HOME");
+    if (home_dir == NULL)
+        return NULL;
+
+    char file_path[512];
+    snprintf(file_path, sizeof(file_path), "%s/.config/assistant-button/%s", home_dir, filename);
+
+    struct stat st;
+    if (stat(file_path, &st) == 0 && S_ISREG(st.st_mode)) {
+        int fd = open(file_path, O_RDONLY);
+        if (fd != -1) {
+            static char buffer[256];
+            ssize_t bytes_read = read(fd, buffer, sizeof(buffer) - 1);
+            close(fd);
+
+            if (bytes_read > 0) {
+                buffer[bytes_read] = '\0';
+                if (strlen(buffer) > 0)
+                    return buffer;
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Checks a compiled binding file against its mtime. Returns 1 with the new
+ * source in *source when it has to be recompiled, 0 when the cached one is
+ * still good and -1 when the file is gone.
+ */
+static int binding_source(const char *filename, struct timespec *mtime, char **source) {
+    const char *home_dir = getenv("HOME");
+    if (home_dir == NULL)
+        return -1;
+
+    char file_path[PATH_MAX];
+    snprintf(file_path, sizeof(file_path), "%s/.config/assistant-button/%s", home_dir, filename);
+
+    struct stat st;
+    if (stat(file_path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        memset(mtime, 0, sizeof(*mtime));
+        return -1;
+    }
+
+    if (st.st_mtim.tv_sec == mtime->tv_sec && st.st_mtim.tv_nsec == mtime->tv_nsec)
+        return 0;
+    *mtime = st.st_mtim;
+
+    FILE *file = fopen(file_path, "r");
+    if (file == NULL)
+        return -1;
+
+    *source = malloc(MAX_BINDING_SIZE);
+    size_t len = fread(*source, 1, MAX_BINDING_SIZE - 1, file);
+    (*source)[len] = '\0';
+    fclose(file);
+    return 1;
+}
+
+static char *strip(char *s) {
+    while (isspace((unsigned char)*s))
+        s++;
+
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1]))
+        *--end = '\0';
+    return s;
+}
+
+/* splits a stripped "gesture = action" line in place, returns the gesture or -1 if it names none */
+static int split_line(char *line, char **action) {
+    char *equals = strchr(line, '=');
+    if (equals == NULL)
+        return -1;
+
+    *equals = '\0';
+    *action = strip(equals + 1);
+    strip(line);
+    for (int event = SHORT_PRESS; event <= DOUBLE_PRESS; event++) {
+        if (strcmp(line, binding_files[event].command) == 0)
+            return event;
+    }
+    return -1;
+}
+
+static void binding_free(struct binding *binding) {
+    // the words of argv all live in one copy of the command, starting at argv[0]
+    if (binding->argv)
+        free(binding->argv[0]);
+    free(binding->argv);
+    free(binding->command);
+    free(binding->text);
+
+    struct timespec mtime = binding->mtime;
+    memset(binding, 0, sizeof(*binding));
+    binding->mtime = mtime;
+}
+
+/* a command without anything for the shell to expand is run straight off its words */
+static char **split_command(const char *command) {
+    if (strpbrk(command, SHELL_CHARS) != NULL)
+        return NULL;
+
+    char **argv = calloc(MAX_COMMAND_ARGS + 1, sizeof(*argv));
+    char *words = strdup(command);
+    char *saveptr;
+    size_t count = 0;
+
+    for (char *word = strtok_r(words, " \t", &saveptr); word; word = strtok_r(NULL, " \t", &saveptr)) {
+        if (count == MAX_COMMAND_ARGS) {
+            free(words);
+            free(argv);
+            return NULL;
+        }
+        argv[count++] = word;
+    }
+    return argv;
+}
+
+static int parse_number(const char *text, int min, int max) {
+    char *end;
+    long value = strtol(text, &end, 10);
+
+    if (end == text || *end != '\0' || value < min || value > max)
+        return -1;
+    return 0;
+}
+
+/* resolves "type[:parameter]" into binding, the keysym goes into the keymap right away */
+static int parse_action(struct binding *binding, const char *text) {
+    const char *colon = strchr(text, ':');
+    size_t len = colon ? (size_t)(colon - text) : strlen(text);
+    const char *param = colon ? colon + 1 : "";
+    size_t i;
+
+    while (isspace((unsigned char)*param))
+        param++;
+
+    for (i = 0; i < sizeof(binding_types) / sizeof(binding_types[0]); i++) {
+        if (strlen(binding_types[i].type) == len && strncmp(binding_types[i].type, text, len) == 0)
+            break;
+    }
+    if (i == sizeof(binding_types) / sizeof(binding_types[0])) {
+        fprintf(stderr, "Error: Unknown action in binding: %s\n", text);
+        return -1;
+    }
+
+    binding->kind = binding_types[i].kind;
+    binding->action = binding_types[i].action;
+    switch (binding->kind) {
+        case BINDING_KEY:
+            binding->keysym = *param ? keyboard_prepare_key(param) : 0;
+            if (binding->keysym == 0)
+                goto invalid;
+            for (size_t k = 0; k < sizeof(key_actions) / sizeof(key_actions[0]); k++) {
+                if (strcasecmp(param, key_actions[k].name) == 0)
+                    binding->action = key_actions[k].action;
+            }
+            break;
+        case BINDING_PREDEFINED:
+            if (*param)
+                goto invalid;
+            break;
+        case BINDING_MODULE:
+            if (binding_types[i].module == NULL) {
+                if (module_parse_binding(param, &binding->call) != 0)
+                    goto invalid;
+                break;
+            }
+            if (*param && parse_number(param, binding_types[i].min, binding_types[i].max) != 0)
+                goto invalid;
+            snprintf(binding->call.name, sizeof(binding->call.name), "%s", binding_types[i].module);
+            snprintf(binding->call.action, sizeof(binding->call.action), "%s", binding_types[i].module_action);
+            snprintf(binding->call.argument, sizeof(binding->call.argument), "%s", param);
+            break;
+        case BINDING_COMMAND:
+            if (*param == '\0')
+                goto invalid;
+            binding->command = strdup(param);
+            binding->argv = split_command(param);
+            break;
+        case BINDING_NONE:
+            break;
+    }
+
+    binding->text = strdup(text);
+    return 0;
+
+invalid:
+    fprintf(stderr, "Error: Invalid binding: %s\n", text);
+    binding_free(binding);
+    return -1;
+}
+
+/* compiles the line binding event out of source, the first one wins */
+static int compile_binding(struct binding *binding, enum ButtonEvent event, char *source) {
+    char *saveptr;
+    int found = 0;
+    int ret = 0;
+
+    for (char *line = strtok_r(source, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+        char *action;
+
+        line = strip(line);
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+
+        int line_event = split_line(line, &action);
+        if (line_event == -1) {
+            // every gesture compiles the whole file, one of them complaining is enough
+            if (event == SHORT_PRESS)
+                fprintf(stderr, "Error: Invalid line in %s: %s\n", BINDINGS_FILE, line);
+            continue;
+        }
+        if (line_event == event && !found) {
+            found = 1;
+            ret = parse_action(binding, action);
+        }
+    }
+    return ret;
+}
+
+/* the event's line of the bindings file, parsed again only when the file changed since the last load */
+static const struct binding *refresh_binding(enum ButtonEvent event) {
+    struct binding *binding = &compiled[event];
+    char *source;
+
+    switch (binding_source(context_file(event, BINDINGS_FILE), &binding->mtime, &source)) {
+        case -1:
+            binding_free(binding);
+            return NULL;
+        case 1:
+            binding_free(binding);
+            compile_binding(binding, event, source);
+            free(source);
+            break;
+    }
+
+    binding->source = "binding";
+    return binding->kind != BINDING_NONE ? binding : NULL;
+}
+
+/* the compiled macro for an event, recompiled only when its file changed since the last load */
+static struct macro *refresh_macro(enum ButtonEvent event) {
+    struct macro *macro = &macros[event];
+    char *source;
+
+    switch (binding_source(context_file(event, binding_files[event].macro), &macro->mtime, &source)) {
+        case -1:
+            macro_free(macro);
+            return NULL;
+        case 1:
+            macro_free(macro);
+            if (load_macro(macro, source) != 0)
+                fprintf(stderr, "Error: Failed to compile macro %s\n", binding_files[event].macro);
+            free(source);
+            break;
+    }
+
+    return macro->command_count > 0 ? macro : NULL;
+}
+
+/* same as refresh_macro() for action chains */
+static struct chain *refresh_chain(enum ButtonEvent event) {
+    struct chain *chain = &chains[event];
+    char *source;
+
+    switch (binding_source(context_file(event, binding_files[event].chain), &chain->mtime, &source)) {
+        case -1:
+            chain_free(chain);
+            return NULL;
+        case 1:
+            chain_free(chain);
+            if (chain_compile(chain, source) != 0)
+                fprintf(stderr, "Error: Failed to compile chain %s\n", binding_files[event].chain);
+            free(source);
+            break;
+    }
+
+    return chain->step_count > 0 ? chain : NULL;
+}
+
+/* the one-value files, in the order they always took precedence in */
+static const struct binding *compile_legacy(enum ButtonEvent event) {
+    struct binding *binding = &legacy[event];
+    char *text;
+
+    binding_free(binding);
+
+    text = parse_custom_action(context_file(event, binding_files[event].command));
+    if (text && *(text = strip(text))) {
+        binding->kind = BINDING_COMMAND;
+        binding->action = CUSTOM_COMMAND_ACTION;
+        binding->source = "command";
+        binding->command = strdup(text);
+        binding->argv = split_command(text);
+        binding->text = strdup(text);
+        return binding;
+    }
+
+    if ((binding->chain = refresh_chain(event))) {
+        binding->kind = BINDING_CHAIN;
+        binding->action = CHAIN_ACTION;
+        binding->source = "chain";
+        return binding;
+    }
+
+    if ((binding->macro = refresh_macro(event))) {
+        binding->kind = BINDING_MACRO;
+        binding->action = MACRO_ACTION;
+        binding->source = "macro";
+        return binding;
+    }
+
+    // "module:action [argument]"
+    text = parse_custom_action(context_file(event, binding_files[event].module));
+    if (text && module_parse_binding(text, &binding->call) == 0) {
+        binding->kind = BINDING_MODULE;
+        binding->action = MODULE_ACTION;
+        binding->source = "module";
+        binding->text = strdup(strip(text));
+        return binding;
+    }
+
+    int action = read_config_int(context_file(event, binding_files[event].predefined));
+    if (action > 0 && action < ACTION_COUNT) {
+        binding->kind = BINDING_PREDEFINED;
+        binding->action = action;
+        binding->source = "predefined";
+        return binding;
+    }
+
+    return NULL;
+}
+
+/* compiles every gesture's binding, the bindings file first, and what the classifier has to wait for */
+static void reload() {
+    for (int event = SHORT_PRESS; event <= DOUBLE_PRESS; event++) {
+        resolved[event] = refresh_binding(event);
+        if (resolved[event] == NULL)
+            resolved[event] = compile_legacy(event);
+    }
+
+    bound = 0;
+    if (resolved[LONG_PRESS])
+        bound |= GESTURE_BOUND_LONG;
+    if (resolved[DOUBLE_PRESS])
+        bound |= GESTURE_BOUND_DOUBLE;
+}
+
+/* NULL if nothing is bound, a table lookup */
+const struct binding *get_binding(enum ButtonEvent event) {
+    return resolved[event];
+}
+
+int has_action(enum ButtonEvent event) {
+    return resolved[event] != NULL;
+}
+
+/* GESTURE_BOUND_* flags for the gestures the classifier has to wait for */
+int bound_gestures() {
+    return bound;
+}
+
+/* whether dir has any binding file for the gesture, a context only takes over the gestures it binds */
+static int dir_binds(const char *dir, enum ButtonEvent event) {
+    const char *home_dir = getenv("HOME");
+    const char *files[] = {
+        binding_files[event].command, binding_files[event].predefined, binding_files[event].macro,
+        binding_files[event].module, binding_files[event].chain,
+    };
+    char file_path[PATH_MAX];
+    struct stat st;
+
+    if (home_dir == NULL)
+        return 0;
+
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        snprintf(file_path, sizeof(file_path), "%s/.config/assistant-button/%s/%s", home_dir, dir, files[i]);
+        if (stat(file_path, &st) == 0 && S_ISREG(st.st_mode))
+            return 1;
+    }
+
+    // the bindings file only counts for the gestures it has a line for
+    struct timespec mtime = { 0 };
+    char *source;
+    int binds = 0;
+
+    snprintf(file_path, sizeof(file_path), "%s/%s", dir, BINDINGS_FILE);
+    if (binding_source(file_path, &mtime, &source) != 1)
+        return 0;
+
+    char *saveptr;
+    for (char *line = strtok_r(source, "\n", &saveptr); line && !binds; line = strtok_r(NULL, "\n", &saveptr)) {
+        char *action;
+        line = strip(line);
+        binds = line[0] != '#' && split_line(line, &action) == (int)event;
+    }
+    free(source);
+    return binds;
+}
+
+/*
+ * Points every gesture at the most specific context directory binding it:
+ * screen_off, then locked, then app/<app id> of the focused app, falling
+ * back to the global bindings.
+ */
+static void select_context(const char *app_dir) {
+    const struct context *context = &watch.context;
+    const char *dirs[3];
+    int count = 0;
+
+    if (context->screen_off)
+        dirs[count++] = "screen_off";
+    // the lock screen covers whatever app was focused before
+    if (context->locked)
+        dirs[count++] = "locked";
+    else if (app_dir[0] != '\0')
+        dirs[count++] = app_dir;
+
+    for (int event = SHORT_PRESS; event <= DOUBLE_PRESS; event++) {
+        const char *dir = "";
+        for (int i = 0; i < count && dir[0] == '\0'; i++) {
+            if (dir_binds(dirs[i], event))
+                dir = dirs[i];
+        }
+
+        if (strcmp(context_dirs[event], dir) == 0)
+            continue;
+        snprintf(context_dirs[event], sizeof(context_dirs[event]), "%s", dir);
+        // another file now, the cached binding, macro and chain have to be compiled from it even if the mtimes agree
+        memset(&compiled[event].mtime, 0, sizeof(compiled[event].mtime));
+        memset(&macros[event].mtime, 0, sizeof(macros[event].mtime));
+        memset(&chains[event].mtime, 0, sizeof(chains[event].mtime));
+    }
+}
+
+static void on_config_changed(GFileMonitor *monitor, GFile *file, GFile *other,
+                              GFileMonitorEvent event_type, gpointer data) {
+    // a file appearing in a context directory can make it the one a gesture binds from
+    select_context(watch.app_dir);
+    reload();
+    if (watch.changed)
+        watch.changed(watch.data);
+}
+
+/* dir is relative to the config directory, it doesn't have to exist yet */
+static GFileMonitor *watch_dir(const char *dir) {
+    const char *home_dir = getenv("HOME");
+    GError *error = NULL;
+    char path[PATH_MAX];
+
+    if (home_dir == NULL)
+        return NULL;
+
+    snprintf(path, sizeof(path), "%s/.config/assistant-button/%s", home_dir, dir);
+    GFile *file = g_file_new_for_path(path);
+    GFileMonitor *monitor = g_file_monitor_directory(file, G_FILE_MONITOR_WATCH_MOVES, NULL, &error);
+    g_object_unref(file);
+
+    if (monitor == NULL) {
+        fprintf(stderr, "Failed to watch %s, changes to it need a restart: %s\n", path, error->message);
+        g_error_free(error);
+        return NULL;
+    }
+
+    g_signal_connect(monitor, "changed", G_CALLBACK(on_config_changed), NULL);
+    return monitor;
+}
+
+/* compiles the global bindings and keeps them current, changed runs on the main loop after every reload */
+void bindings_init(void (*changed)(void *data), void *data) {
+    static const char *const dirs[] = { "", "screen_off", "locked" };
+
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++)
+        watch.monitors[i] = watch_dir(dirs[i]);
+    reload();
+
+    watch.changed = changed;
+    watch.data = data;
+}
+
+/* runs whenever the context changes, so a press only looks up the table */
+void bindings_set_context(const struct context *context) {
+    char app_dir[MAX_CONTEXT_DIR] = "";
+
+    watch.context = *context;
+    if (context->app_id[0] != '\0' && context->app_id[0] != '.' && strchr(context->app_id, '/') == NULL)
+        snprintf(app_dir, sizeof(app_dir), "app/%s", context->app_id);
+
+    // only the focused app's directory is watched, the others are looked at when their app comes up
+    if (strcmp(app_dir, watch.app_dir) != 0) {
+        if (watch.app_monitor) {
+            g_file_monitor_cancel(watch.app_monitor);
+            g_object_unref(watch.app_monitor);
+            watch.app_monitor = NULL;
+        }
+        snprintf(watch.app_dir, sizeof(watch.app_dir), "%s", app_dir);
+        if (app_dir[0] != '\0')
+            watch.app_monitor = watch_dir(app_dir);
+    }
+
+    select_context(app_dir);
+    reload();
+}
@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#ifndef BINDINGS_H
+#define BINDINGS_H
+
+#include <stdint.h>
+#include "chain.h"
+#include "context.h"
+#include "gesture.h"
+#include "macro.h"
+#include "modules.h"
+
+/*
+ * ~/.config/assistant-button/bindings binds every gesture in one place,
+ * one typed action per line:
+ *
+ *   short_press = flashlight:60
+ *   long_press = send_key:XF86Back
+ *   double_press = camera:1
+ *
+ * An action is send_key:<keysym>, flashlight[:<level>], camera[:<device>],
+ * record[:<device>], open_camera, screenshot, autorotate,
+ * module:<module:action [argument]> or command:<command line>. A gesture it doesn't bind falls back to the
+ * one-value files. Empty lines and lines starting with # are ignored.
+ *
+ * Everything is compiled into one table whenever a file under the config
+ * directory or the context changes, a press only looks its gesture up.
+ */
+
+#define BINDINGS_FILE "bindings"
+
+enum binding_kind {
+    BINDING_NONE,
+    BINDING_KEY,
+    BINDING_PREDEFINED,
+    BINDING_MODULE,
+    BINDING_COMMAND,
+    BINDING_CHAIN,
+    BINDING_MACRO,
+};
+
+/* what one gesture runs, resolved as far as it can be before the press */
+struct binding {
+    enum binding_kind kind;
+    int action;              // the id reported in ActionPerformed
+    uint32_t keysym;         // BINDING_KEY, already in the keymap
+    struct module_call call; // BINDING_MODULE
+    char *command;           // BINDING_COMMAND
+    char **argv;             // BINDING_COMMAND, NULL if it needs a shell
+    struct chain *chain;     // BINDING_CHAIN
+    struct macro *macro;     // BINDING_MACRO
+    const char *source;      // the kind of file it came from, for the status page
+    char *text;              // the action as written, NULL for chains and macros
+    struct timespec mtime;
+};
+
+int read_config_int(const char *filename);
+char* parse_custom_action(const char *filename);
+
+void bindings_init(void (*changed)(void *data), void *data);
+const struct binding *get_binding(enum ButtonEvent event);
+int has_action(enum ButtonEvent event);
+int bound_gestures();
+void bindings_set_context(const struct context *context);
+
+#endif // BINDINGS_H
@@ -0,0 +1,397 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <ctype.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <glib.h>
+#include "accounting.h"
+#include "chain.h"
+#include "flightrec.h"
+
+enum step_status {
+    STEP_PENDING,
+    STEP_RUNNING,
+    STEP_OK,
+    STEP_FAILED,
+    STEP_TIMEOUT,
+    STEP_SKIPPED,
+};
+
+static const char *const status_names[] = {
+    [STEP_PENDING] = "pending",
+    [STEP_RUNNING] = "running",
+    [STEP_OK] = "ok",
+    [STEP_FAILED] = "failed",
+    [STEP_TIMEOUT] = "timed out",
+    [STEP_SKIPPED] = "skipped",
+};
+
+struct chain_run;
+
+struct step_run {
+    struct chain_run *run;
+    struct chain_step step; // our own copy, the chain may be recompiled while it runs
+    enum step_status status;
+    gint64 start;
+    gint64 end;
+    guint timeout_id;
+    GPid pid;           // also the process group of the command and whatever it started
+    int result;
+    int stuck;          // timed out while running in-process, still holding an executor thread
+};
+
+struct chain_run {
+    char *name;
+    chain_step_fn run_step;
+    struct step_run *steps;
+    size_t step_count;
+    unsigned int stage;
+    unsigned int stage_count;
+    size_t pending;     // steps of the current stage still running
+    size_t outstanding; // child watches and executor jobs yet to come back, the run lives until the last one
+    int aborted;
+    int finished;
+    gint64 start;
+};
+
+static GThreadPool *executor;
+static unsigned int stuck_steps; // timed out in-process steps that haven't returned yet
+
+/* splits off the next whitespace separated token, leaving the rest of the text intact */
+static char *next_token(char **text) {
+    char *token = *text;
+    char *end = token + strcspn(token, " \t");
+
+    if (*end) {
+        *end++ = '\0';
+        while (isspace((unsigned char)*end))
+            end++;
+    }
+    *text = end;
+    return token;
+}
+
+static int compile_step(struct chain *chain, char *text, unsigned int stage) {
+    if (chain->step_count == MAX_CHAIN_STEPS) {
+        fprintf(stderr, "Too many steps, at most %d are allowed\n", MAX_CHAIN_STEPS);
+        return -1;
+    }
+
+    struct chain_step *step = &chain->steps[chain->step_count];
+    memset(step, 0, sizeof(*step));
+    step->stage = stage;
+    step->timeout_ms = CHAIN_DEFAULT_TIMEOUT_MS;
+
+    text = g_strstrip(text);
+    char *word = next_token(&text);
+
+    while (1) {
+        char *end;
+        if (strncmp(word, "timeout=", 8) == 0) {
+            step->timeout_ms = strtoul(word + 8, &end, 10);
+            if (end == word + 8 || *end) {
+                fprintf(stderr, "Invalid timeout '%s'\n", word);
+                return -1;
+            }
+        } else if (strcmp(word, "on_fail=abort") == 0) {
+            step->continue_on_failure = 0;
+        } else if (strcmp(word, "on_fail=continue") == 0) {
+            step->continue_on_failure = 1;
+        } else {
+            break;
+        }
+        word = next_token(&text);
+    }
+
+    if (*text == '\0') {
+        fprintf(stderr, "Step '%s' is missing its argument\n", word);
+        return -1;
+    }
+
+    if (strcmp(word, "command") == 0) {
+        step->kind = CHAIN_STEP_COMMAND;
+    } else if (strcmp(word, "module") == 0) {
+        step->kind = CHAIN_STEP_MODULE;
+        if (strchr(text, ':') == NULL) {
+            fprintf(stderr, "Module step '%s' is not module:action\n", text);
+            return -1;
+        }
+    } else if (strcmp(word, "predefined") == 0) {
+        char *end;
+        step->kind = CHAIN_STEP_PREDEFINED;
+        step->predefined = strtol(text, &end, 10);
+        if (end == text || *end || step->predefined <= 0) {
+            fprintf(stderr, "Invalid predefined action '%s'\n", text);
+            return -1;
+        }
+        chain->step_count++;
+        return 0;
+    } else {
+        fprintf(stderr, "Unknown step '%s'\n", word);
+        return -1;
+    }
+
+    step->argument = strdup(text);
+    chain->step_count++;
+    return 0;
+}
+
+int chain_compile(struct chain *chain, const char *source) {
+    char *copy = strdup(source);
+    char *cursor = copy;
+    char *line;
+    unsigned int stage = 0;
+    int line_number = 0;
+    int ret = 0;
+
+    chain->steps = calloc(MAX_CHAIN_STEPS, sizeof(chain->steps[0]));
+    chain->step_count = 0;
+
+    while (ret == 0 && (line = strsep(&cursor, "\n")) != NULL) {
+        line_number++;
+        line = g_strstrip(line);
+        if (*line == '\0' || *line == '#')
+            continue;
+
+        // " & " and not "&&", so shell commands keep their own operators
+        char *step = line;
+        char *separator;
+        while (ret == 0 && (separator = strstr(step, " & ")) != NULL) {
+            *separator = '\0';
+            ret = compile_step(chain, step, stage);
+            step = separator + 3;
+        }
+        if (ret == 0)
+            ret = compile_step(chain, step, stage);
+        if (ret != 0)
+            fprintf(stderr, "Error on line %d of the chain\n", line_number);
+        stage++;
+    }
+
+    free(copy);
+    if (ret != 0)
+        chain_free(chain);
+    return ret;
+}
+
+void chain_free(struct chain *chain) {
+    for (size_t i = 0; i < chain->step_count; i++)
+        free(chain->steps[i].argument);
+    free(chain->steps);
+    chain->steps = NULL;
+    chain->step_count = 0;
+}
+
+static void run_free_if_done(struct chain_run *run) {
+    if (!run->finished || run->outstanding > 0)
+        return;
+
+    for (size_t i = 0; i < run->step_count; i++)
+        g_free(run->steps[i].step.argument);
+    g_free(run->steps);
+    g_free(run->name);
+    g_free(run);
+}
+
+static void run_report(struct chain_run *run) {
+    fprintf(stderr, "Chain %s %s in %.1f ms\n", run->name, run->aborted ? "aborted" : "finished",
+            (g_get_monotonic_time() - run->start) / 1000.0);
+
+    for (size_t i = 0; i < run->step_count; i++) {
+        struct step_run *sr = &run->steps[i];
+        gint64 duration = sr->end > sr->start ? sr->end - sr->start : 0;
+
+        if (sr->step.kind == CHAIN_STEP_PREDEFINED)
+            fprintf(stderr, "  stage %u predefined %d: %s after %.1f ms\n",
+                    sr->step.stage + 1, sr->step.predefined, status_names[sr->status], duration / 1000.0);
+        else
+            fprintf(stderr, "  stage %u %s %s: %s after %.1f ms\n",
+                    sr->step.stage + 1, sr->step.kind == CHAIN_STEP_COMMAND ? "command" : "module",
+                    sr->step.argument, status_names[sr->status], duration / 1000.0);
+        flightrec_record(FR_CHAIN_STEP, i, sr->status, duration);
+    }
+}
+
+static void start_stage(struct chain_run *run);
+
+static void step_finished(struct step_run *sr, enum step_status status) {
+    struct chain_run *run = sr->run;
+
+    sr->status = status;
+    sr->end = g_get_monotonic_time();
+    if (sr->timeout_id) {
+        g_source_remove(sr->timeout_id);
+        sr->timeout_id = 0;
+    }
+
+    if (status != STEP_OK && !sr->step.continue_on_failure)
+        run->aborted = 1;
+
+    if (--run->pending > 0)
+        return;
+
+    if (!run->aborted && ++run->stage < run->stage_count) {
+        start_stage(run);
+        return;
+    }
+
+    for (size_t i = 0; i < run->step_count; i++) {
+        if (run->steps[i].status == STEP_PENDING)
+            run->steps[i].status = STEP_SKIPPED;
+    }
+    run->finished = 1;
+    run_report(run);
+    run_free_if_done(run);
+}
+
+static gboolean on_step_timeout(gpointer data) {
+    struct step_run *sr = data;
+
+    sr->timeout_id = 0;
+    // the child watch still reaps it, an in-process step's late result is dropped
+    if (sr->pid > 0) {
+        kill(-sr->pid, SIGTERM);
+    } else if (sr->step.kind != CHAIN_STEP_COMMAND) {
+        sr->stuck = 1;
+        stuck_steps++;
+    }
+    step_finished(sr, STEP_TIMEOUT);
+    return G_SOURCE_REMOVE;
+}
+
+static void on_command_exit(GPid pid, gint status, gpointer data) {
+    struct step_run *sr = data;
+    struct chain_run *run = sr->run;
+    enum account_subsystem previous = account_enter(ACCOUNT_CHILD);
+
+    g_spawn_close_pid(pid);
+    sr->pid = 0;
+    run->outstanding--;
+
+    if (sr->status == STEP_RUNNING)
+        step_finished(sr, WIFEXITED(status) && WEXITSTATUS(status) == 0 ? STEP_OK : STEP_FAILED);
+    else
+        run_free_if_done(run);
+    account_leave(previous);
+}
+
+static gboolean on_step_returned(gpointer data) {
+    struct step_run *sr = data;
+    struct chain_run *run = sr->run;
+
+    run->outstanding--;
+    if (sr->stuck) {
+        sr->stuck = 0;
+        stuck_steps--;
+    }
+    if (sr->status == STEP_RUNNING)
+        step_finished(sr, sr->result == 0 ? STEP_OK : STEP_FAILED);
+    else
+        run_free_if_done(run);
+    return G_SOURCE_REMOVE;
+}
+
+/* executor thread, the result goes back to the main loop which owns the run */
+static void execute_step(gpointer data, gpointer user_data) {
+    struct step_run *sr = data;
+
+    sr->result = sr->run->run_step(&sr->step);
+    g_main_context_invoke(NULL, on_step_returned, sr);
+}
+
+/* in the child, a group of its own so a timeout reaches pipelines and background jobs too */
+static void own_process_group(gpointer data) {
+    setpgid(0, 0);
+}
+
+static int spawn_command(struct step_run *sr) {
+    gchar *argv[] = { "/bin/sh", "-c", sr->step.argument, NULL };
+    GError *error = NULL;
+
+    if (!g_spawn_async(NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD, own_process_group, NULL, &sr->pid, &error)) {
+        fprintf(stderr, "Failed to run '%s': %s\n", sr->step.argument, error->message);
+        g_error_free(error);
+        return -1;
+    }
+    // and from here too, the group has to exist before a timeout can signal it
+    setpgid(sr->pid, sr->pid);
+
+    sr->run->outstanding++;
+    g_child_watch_add(sr->pid, on_command_exit, sr);
+    return 0;
+}
+
+static void start_stage(struct chain_run *run) {
+    // a step failing to start finishes synchronously, keep the run alive until we're done here
+    run->outstanding++;
+
+    unsigned int stage = run->stage;
+    for (size_t i = 0; i < run->step_count; i++) {
+        if (run->steps[i].step.stage != stage)
+            continue;
+        run->steps[i].status = STEP_RUNNING;
+        run->steps[i].start = g_get_monotonic_time();
+        run->pending++;
+    }
+
+    for (size_t i = 0; i < run->step_count; i++) {
+        struct step_run *sr = &run->steps[i];
+        if (sr->step.stage != stage || sr->status != STEP_RUNNING)
+            continue;
+
+        if (sr->step.timeout_ms)
+            sr->timeout_id = g_timeout_add(sr->step.timeout_ms, on_step_timeout, sr);
+
+        if (sr->step.kind == CHAIN_STEP_COMMAND) {
+            if (spawn_command(sr) != 0)
+                step_finished(sr, STEP_FAILED);
+        } else if (stuck_steps >= CHAIN_EXECUTOR_THREADS) {
+            // it would only queue up behind steps that may never return
+            fprintf(stderr, "Every action executor is stuck on a timed out step\n");
+            step_finished(sr, STEP_FAILED);
+        } else {
+            run->outstanding++;
+            g_thread_pool_push(executor, sr, NULL);
+        }
+    }
+
+    run->outstanding--;
+    run_free_if_done(run);
+}
+
+/* runs a chain in the background, its steps are copied so the chain can be freed right away */
+int chain_start(const struct chain *chain, const char *name, chain_step_fn run_step) {
+    if (chain->step_count == 0)
+        return -1;
+
+    if (executor == NULL) {
+        GError *error = NULL;
+        executor = g_thread_pool_new(execute_step, NULL, CHAIN_EXECUTOR_THREADS, FALSE, &error);
+        if (executor == NULL) {
+            fprintf(stderr, "Failed to start the action executor: %s\n", error->message);
+            g_error_free(error);
+            return -1;
+        }
+    }
+
+    struct chain_run *run = g_new0(struct chain_run, 1);
+    run->name = g_strdup(name);
+    run->run_step = run_step;
+    run->start = g_get_monotonic_time();
+    run->step_count = chain->step_count;
+    run->steps = g_new0(struct step_run, chain->step_count);
+    for (size_t i = 0; i < chain->step_count; i++) {
+        run->steps[i].run = run;
+        run->steps[i].step = chain->steps[i];
+        run->steps[i].step.argument = g_strdup(chain->steps[i].argument);
+    }
+    run->stage_count = chain->steps[chain->step_count - 1].stage + 1;
+
+    start_stage(run);
+    return 0;
+}
@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#ifndef CHAIN_H
+#define CHAIN_H
+
+#include <time.h>
+
+/*
+ * A chain is a small action graph, one stage per line. Stages run one
+ * after another, the steps of a stage are separated by " & " and run in
+ * parallel:
+ *
+ *   module flashlight:toggle & command furios-camera
+ *   timeout=3000 on_fail=continue command notify-send "Camera ready"
+ *
+ * A step is `command <shell command>`, `predefined <action id>` or
+ * `module <module:action [argument]>`, optionally prefixed with
+ * timeout=<ms> (0 for none) and on_fail=abort|continue. A failed or
+ * timed out step with on_fail=abort skips every later stage.
+ *
+ * Empty lines and lines starting with # are ignored.
+ */
+
+#define CHAIN_DEFAULT_TIMEOUT_MS 10000
+/* an in-process step can't be stopped, a timed out one keeps its executor thread until it returns.
+ * Once all of them are held like that, new predefined and module steps fail instead of queueing. */
+#define CHAIN_EXECUTOR_THREADS 4
+#define MAX_CHAIN_STEPS 32
+
+enum chain_step_kind {
+    CHAIN_STEP_COMMAND,
+    CHAIN_STEP_PREDEFINED,
+    CHAIN_STEP_MODULE,
+};
+
+struct chain_step {
+    enum chain_step_kind kind;
+    unsigned int stage;
+    unsigned int timeout_ms;
+    int continue_on_failure;
+    int predefined;
+    char *argument; // the command line or the module binding
+};
+
+struct chain {
+    struct chain_step *steps;
+    size_t step_count;
+    struct timespec mtime;
+};
+
+/* runs predefined and module steps, called on an executor thread, returns 0 on success */
+typedef int (*chain_step_fn)(const struct chain_step *step);
+
+int chain_compile(struct chain *chain, const char *source);
+void chain_free(struct chain *chain);
+int chain_start(const struct chain *chain, const char *name, chain_step_fn run_step);
+
+#endif // CHAIN_H
@@ -0,0 +1,308 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <stdio.h>
+#include <string.h>
+#include <gio/gio.h>
+#include <glib-unix.h>
+#include <wayland-client.h>
+#include "context.h"
+#include "flightrec.h"
+#include "wlr-foreign-toplevel-management-unstable-v1-client-protocol.h"
+
+#define DISPLAY_CONFIG_NAME "org.gnome.Mutter.DisplayConfig"
+#define DISPLAY_CONFIG_PATH "/org/gnome/Mutter/DisplayConfig"
+#define SCREENSAVER_NAME "org.gnome.ScreenSaver"
+#define SCREENSAVER_PATH "/org/gnome/ScreenSaver"
+#define TOPLEVEL_VERSION 3
+
+struct toplevel {
+    struct zwlr_foreign_toplevel_handle_v1 *handle;
+    gchar *app_id;
+    int activated; // as of the last state event, applied on done
+};
+
+static struct {
+    struct context current;
+    void (*changed)(const struct context *context, void *data);
+    void *data;
+
+    GDBusConnection *bus;
+
+    struct wl_display *display;
+    struct wl_registry *registry;
+    struct zwlr_foreign_toplevel_manager_v1 *manager;
+    struct toplevel *focused;
+    guint display_watch;
+} tracker;
+
+const struct context *context_get() {
+    return &tracker.current;
+}
+
+static void notify() {
+    const struct context *current = &tracker.current;
+
+    flightrec_record(FR_CONTEXT, current->screen_off | current->locked << 1 | (current->app_id[0] != '\0') << 2, 0, 0);
+    if (tracker.changed)
+        tracker.changed(current, tracker.data);
+}
+
+static void set_screen_off(int screen_off) {
+    if (tracker.current.screen_off == screen_off)
+        return;
+    tracker.current.screen_off = screen_off;
+    notify();
+}
+
+static void set_locked(int locked) {
+    if (tracker.current.locked == locked)
+        return;
+    tracker.current.locked = locked;
+    notify();
+}
+
+static void set_app_id(const char *app_id) {
+    if (strcmp(tracker.current.app_id, app_id ? app_id : "") == 0)
+        return;
+    g_strlcpy(tracker.current.app_id, app_id ? app_id : "", sizeof(tracker.current.app_id));
+    notify();
+}
+
+/* PowerSaveMode is 0 while the outputs are on, 1 to 3 for the ways of being off, -1 when unknown */
+static void set_power_save_mode(GVariant *value) {
+    if (value && g_variant_is_of_type(value, G_VARIANT_TYPE_INT32))
+        set_screen_off(g_variant_get_int32(value) > 0);
+}
+
+static void on_display_config_changed(GDBusConnection *connection, const gchar *sender,
+                                      const gchar *object_path, const gchar *interface_name,
+                                      const gchar *signal_name, GVariant *parameters, gpointer data) {
+    GVariant *changed;
+
+    g_variant_get(parameters, "(s@a{sv}as)", NULL, &changed, NULL);
+    GVariant *mode = g_variant_lookup_value(changed, "PowerSaveMode", G_VARIANT_TYPE_INT32);
+    if (mode) {
+        set_power_save_mode(mode);
+        g_variant_unref(mode);
+    }
+    g_variant_unref(changed);
+}
+
+static void on_power_save_mode_ready(GObject *source, GAsyncResult *res, gpointer data) {
+    GError *error = NULL;
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (result == NULL) {
+        g_printerr("Failed to get the screen state: %s\n", error->message);
+        g_error_free(error);
+        return;
+    }
+
+    GVariant *value;
+    g_variant_get(result, "(v)", &value);
+    set_power_save_mode(value);
+    g_variant_unref(value);
+    g_variant_unref(result);
+}
+
+static void on_screensaver_active_changed(GDBusConnection *connection, const gchar *sender,
+                                          const gchar *object_path, const gchar *interface_name,
+                                          const gchar *signal_name, GVariant *parameters, gpointer data) {
+    gboolean active;
+
+    g_variant_get(parameters, "(b)", &active);
+    set_locked(active);
+}
+
+static void on_screensaver_active_ready(GObject *source, GAsyncResult *res, gpointer data) {
+    GError *error = NULL;
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (result == NULL) {
+        g_printerr("Failed to get the lock state: %s\n", error->message);
+        g_error_free(error);
+        return;
+    }
+
+    gboolean active;
+    g_variant_get(result, "(b)", &active);
+    set_locked(active);
+    g_variant_unref(result);
+}
+
+static void watch_session() {
+    GError *error = NULL;
+
+    tracker.bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+    if (tracker.bus == NULL) {
+        g_printerr("Failed to get the session bus, screen and lock contexts won't be tracked: %s\n", error->message);
+        g_error_free(error);
+        return;
+    }
+
+    g_dbus_connection_signal_subscribe(tracker.bus, DISPLAY_CONFIG_NAME, "org.freedesktop.DBus.Properties",
+                                       "PropertiesChanged", DISPLAY_CONFIG_PATH, DISPLAY_CONFIG_NAME,
+                                       G_DBUS_SIGNAL_FLAGS_NONE, on_display_config_changed, NULL, NULL);
+    g_dbus_connection_call(tracker.bus, DISPLAY_CONFIG_NAME, DISPLAY_CONFIG_PATH,
+                           "org.freedesktop.DBus.Properties", "Get",
+                           g_variant_new("(ss)", DISPLAY_CONFIG_NAME, "PowerSaveMode"),
+                           G_VARIANT_TYPE("(v)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, on_power_save_mode_ready, NULL);
+
+    g_dbus_connection_signal_subscribe(tracker.bus, SCREENSAVER_NAME, SCREENSAVER_NAME, "ActiveChanged",
+                                       SCREENSAVER_PATH, NULL, G_DBUS_SIGNAL_FLAGS_NONE,
+                                       on_screensaver_active_changed, NULL, NULL);
+    g_dbus_connection_call(tracker.bus, SCREENSAVER_NAME, SCREENSAVER_PATH, SCREENSAVER_NAME, "GetActive",
+                           NULL, G_VARIANT_TYPE("(b)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                           on_screensaver_active_ready, NULL);
+}
+
+static void toplevel_title(void *data, struct zwlr_foreign_toplevel_handle_v1 *handle, const char *title) {
+}
+
+static void toplevel_app_id(void *data, struct zwlr_foreign_toplevel_handle_v1 *handle, const char *app_id) {
+    struct toplevel *toplevel = data;
+
+    g_free(toplevel->app_id);
+    toplevel->app_id = g_strdup(app_id);
+}
+
+static void toplevel_output_enter(void *data, struct zwlr_foreign_toplevel_handle_v1 *handle, struct wl_output *output) {
+}
+
+static void toplevel_output_leave(void *data, struct zwlr_foreign_toplevel_handle_v1 *handle, struct wl_output *output) {
+}
+
+static void toplevel_state(void *data, struct zwlr_foreign_toplevel_handle_v1 *handle, struct wl_array *state) {
+    struct toplevel *toplevel = data;
+    uint32_t *entry;
+
+    toplevel->activated = 0;
+    wl_array_for_each(entry, state) {
+        if (*entry == ZWLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_ACTIVATED)
+            toplevel->activated = 1;
+    }
+}
+
+/* the compositor sends done after every batch of changes, so the app id and state agree here */
+static void toplevel_done(void *data, struct zwlr_foreign_toplevel_handle_v1 *handle) {
+    struct toplevel *toplevel = data;
+
+    if (toplevel->activated) {
+        tracker.focused = toplevel;
+        set_app_id(toplevel->app_id);
+    } else if (tracker.focused == toplevel) {
+        tracker.focused = NULL;
+        set_app_id(NULL);
+    }
+}
+
+static void toplevel_closed(void *data, struct zwlr_foreign_toplevel_handle_v1 *handle) {
+    struct toplevel *toplevel = data;
+
+    if (tracker.focused == toplevel) {
+        tracker.focused = NULL;
+        set_app_id(NULL);
+    }
+
+    zwlr_foreign_toplevel_handle_v1_destroy(handle);
+    g_free(toplevel->app_id);
+    g_free(toplevel);
+}
+
+static void toplevel_parent(void *data, struct zwlr_foreign_toplevel_handle_v1 *handle,
+                            struct zwlr_foreign_toplevel_handle_v1 *parent) {
+}
+
+static const struct zwlr_foreign_toplevel_handle_v1_listener toplevel_listener = {
+    .title = toplevel_title,
+    .app_id = toplevel_app_id,
+    .output_enter = toplevel_output_enter,
+    .output_leave = toplevel_output_leave,
+    .state = toplevel_state,
+    .done = toplevel_done,
+    .closed = toplevel_closed,
+    .parent = toplevel_parent,
+};
+
+static void manager_toplevel(void *data, struct zwlr_foreign_toplevel_manager_v1 *manager,
+                             struct zwlr_foreign_toplevel_handle_v1 *handle) {
+    struct toplevel *toplevel = g_new0(struct toplevel, 1);
+
+    toplevel->handle = handle;
+    zwlr_foreign_toplevel_handle_v1_add_listener(handle, &toplevel_listener, toplevel);
+}
+
+static void manager_finished(void *data, struct zwlr_foreign_toplevel_manager_v1 *manager) {
+    zwlr_foreign_toplevel_manager_v1_destroy(manager);
+    tracker.manager = NULL;
+}
+
+static const struct zwlr_foreign_toplevel_manager_v1_listener manager_listener = {
+    .toplevel = manager_toplevel,
+    .finished = manager_finished,
+};
+
+static void registry_global(void *data, struct wl_registry *registry, uint32_t name,
+                            const char *interface, uint32_t version) {
+    if (strcmp(interface, zwlr_foreign_toplevel_manager_v1_interface.name) != 0 || tracker.manager)
+        return;
+
+    tracker.manager = wl_registry_bind(registry, name, &zwlr_foreign_toplevel_manager_v1_interface,
+                                       version < TOPLEVEL_VERSION ? version : TOPLEVEL_VERSION);
+    zwlr_foreign_toplevel_manager_v1_add_listener(tracker.manager, &manager_listener, NULL);
+}
+
+static void registry_global_remove(void *data, struct wl_registry *registry, uint32_t name) {
+}
+
+static const struct wl_registry_listener registry_listener = {
+    .global = registry_global,
+    .global_remove = registry_global_remove,
+};
+
+static gboolean on_display_event(gint fd, GIOCondition condition, gpointer data) {
+    if ((condition & (G_IO_HUP | G_IO_ERR)) || wl_display_dispatch(tracker.display) < 0) {
+        // the handles die with the connection, so does whatever was focused
+        g_print("Lost the Wayland connection used to watch the focused app\n");
+        tracker.display_watch = 0;
+        tracker.focused = NULL;
+        set_app_id(NULL);
+        return G_SOURCE_REMOVE;
+    }
+
+    wl_display_flush(tracker.display);
+    return G_SOURCE_CONTINUE;
+}
+
+static void watch_toplevels() {
+    tracker.display = wl_display_connect(NULL);
+    if (tracker.display == NULL) {
+        g_print("Wayland connection failed, the focused app won't be tracked\n");
+        return;
+    }
+
+    tracker.registry = wl_display_get_registry(tracker.display);
+    wl_registry_add_listener(tracker.registry, &registry_listener, NULL);
+    // first roundtrip binds the manager, the second one collects the toplevels that are already there
+    wl_display_roundtrip(tracker.display);
+    if (tracker.manager == NULL) {
+        g_print("The compositor has no foreign toplevel manager, the focused app won't be tracked\n");
+        wl_registry_destroy(tracker.registry);
+        wl_display_disconnect(tracker.display);
+        tracker.registry = NULL;
+        tracker.display = NULL;
+        return;
+    }
+    wl_display_roundtrip(tracker.display);
+
+    tracker.display_watch = g_unix_fd_add(wl_display_get_fd(tracker.display),
+                                          G_IO_IN | G_IO_HUP | G_IO_ERR, on_display_event, NULL);
+}
+
+/* changed runs on the main loop whenever any part of the context changes */
+void context_init(void (*changed)(const struct context *context, void *data), void *data) {
+    tracker.changed = changed;
+    tracker.data = data;
+
+    watch_session();
+    watch_toplevels();
+}
@@ -0,0 +1,24 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#define CONTEXT_APP_ID_SIZE 128
+
+/*
+ * What the phone is doing right now, as far as bindings care. Kept up to
+ * date from signals and compositor events rather than asked for on a press:
+ * the screen from Mutter's DisplayConfig PowerSaveMode, the lock from the
+ * ScreenSaver interface and the focused app from wlr-foreign-toplevel.
+ */
+struct context {
+    int screen_off;
+    int locked;
+    char app_id[CONTEXT_APP_ID_SIZE]; // empty when nothing is focused
+};
+
+void context_init(void (*changed)(const struct context *context, void *data), void *data);
+const struct context *context_get();
+
+#endif // CONTEXT_H
@@ -0,0 +1,177 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib-unix.h>
+#include "accounting.h"
+#include "dbus.h"
+#include "flightrec.h"
+#include "loop.h"
+#include "stats.h"
+
+static void append_stat(DBusMessageIter *dict, const char *name, int type, const char *signature, const void *value) {
+    DBusMessageIter entry, variant;
+
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &name);
+    dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, signature, &variant);
+    dbus_message_iter_append_basic(&variant, type, value);
+    dbus_message_iter_close_container(&entry, &variant);
+    dbus_message_iter_close_container(dict, &entry);
+}
+
+/* GetStats() -> a{sv}, every counter as a uint64 plus the input device and loop backend */
+static DBusMessage *get_stats(DBusMessage *msg) {
+    DBusMessage *reply = dbus_message_new_method_return(msg);
+    DBusMessageIter args, dict;
+    const char *device = stats_device();
+    const char *backend = loop_backend_name();
+
+    if (reply == NULL)
+        return NULL;
+
+    dbus_message_iter_init_append(reply, &args);
+    dbus_message_iter_open_container(&args, DBUS_TYPE_ARRAY, "{sv}", &dict);
+    append_stat(&dict, "device", DBUS_TYPE_STRING, "s", &device);
+    append_stat(&dict, "loop_backend", DBUS_TYPE_STRING, "s", &backend);
+    for (int i = 0; i < STAT_COUNT; i++) {
+        dbus_uint64_t value = stats_get(i);
+        append_stat(&dict, stats_name(i), DBUS_TYPE_UINT64, "t", &value);
+    }
+    dbus_message_iter_close_container(&args, &dict);
+    return reply;
+}
+
+static DBusHandlerResult handle_dbus_message(DBusConnection *conn, DBusMessage *msg, void *data) {
+    if (dbus_message_is_method_call(msg, DBUS_INTERFACE, "GetStats")) {
+        DBusMessage *reply = get_stats(msg);
+        if (reply) {
+            dbus_connection_send(conn, reply, NULL);
+            dbus_message_unref(reply);
+        }
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+
+    if (!dbus_message_is_method_call(msg, DBUS_INTERFACE, "DumpFlightRecorder"))
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+    DBusMessage *reply;
+    DBusError err;
+    const char *path;
+    dbus_error_init(&err);
+
+    if (!dbus_message_get_args(msg, &err, DBUS_TYPE_STRING, &path, DBUS_TYPE_INVALID)) {
+        reply = dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, err.message);
+        dbus_error_free(&err);
+    } else if (*path != '\0') {
+        // the caller doesn't get to pick a file to overwrite with our privileges, the reply says where it went
+        reply = dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "Only an empty path is accepted");
+    } else {
+        // the same location SIGUSR1 dumps to
+        path = flightrec_default_path();
+
+        if (flightrec_dump(path) == 0) {
+            reply = dbus_message_new_method_return(msg);
+            dbus_message_append_args(reply, DBUS_TYPE_STRING, &path, DBUS_TYPE_INVALID);
+        } else {
+            reply = dbus_message_new_error(msg, DBUS_ERROR_FAILED, "Failed to write the flight recorder dump");
+        }
+    }
+
+    if (reply) {
+        dbus_connection_send(conn, reply, NULL);
+        dbus_message_unref(reply);
+    }
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static gboolean on_dbus_readable(gint fd, GIOCondition condition, gpointer data) {
+    DBusConnection *conn = data;
+    enum account_subsystem previous = account_enter(ACCOUNT_DBUS);
+
+    dbus_connection_read_write(conn, 0);
+    while (dbus_connection_dispatch(conn) == DBUS_DISPATCH_DATA_REMAINS)
+        ;
+    account_leave(previous);
+    return G_SOURCE_CONTINUE;
+}
+
+DBusConnection *init_dbus() {
+    DBusConnection *conn;
+    DBusError err;
+    dbus_error_init(&err);
+
+    conn = dbus_bus_get(DBUS_BUS_SESSION, &err);
+    if (dbus_error_is_set(&err)) {
+        fprintf(stderr, "D-Bus Connection Error: %s\n", err.message);
+        dbus_error_free(&err);
+    }
+    if (conn == NULL) {
+        fprintf(stderr, "Failed to connect to D-Bus session bus\n");
+        exit(1);
+    }
+
+    int ret = dbus_bus_request_name(conn, DBUS_INTERFACE, DBUS_NAME_FLAG_REPLACE_EXISTING, &err);
+    if (dbus_error_is_set(&err)) {
+        fprintf(stderr, "D-Bus Name Error: %s\n", err.message);
+        dbus_error_free(&err);
+    }
+
+    /* how likely is it for this to not be primary owner? does it even need a check */
+    if (ret != DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER) {
+        fprintf(stderr, "Not primary owner of the D-Bus name\n");
+        exit(1);
+    }
+
+    static const DBusObjectPathVTable vtable = {
+        .message_function = handle_dbus_message,
+    };
+    dbus_connection_register_object_path(conn, DBUS_PATH, &vtable, NULL);
+
+    // method calls are read and dispatched from the main loop
+    int fd;
+    if (dbus_connection_get_unix_fd(conn, &fd))
+        g_unix_fd_add(fd, G_IO_IN, on_dbus_readable, conn);
+
+    return conn;
+}
+
+/* the ActionPerformed signal, the caller owns the returned message */
+DBusMessage *new_action_signal(int action, int event_type) {
+    DBusMessage *msg;
+    DBusMessageIter args;
+
+    msg = dbus_message_new_signal(DBUS_PATH,
+                                  DBUS_INTERFACE,
+                                  "ActionPerformed");
+    if (msg == NULL) {
+        fprintf(stderr, "Failed to create D-Bus message\n");
+        return NULL;
+    }
+
+    dbus_message_iter_init_append(msg, &args);
+    if (!dbus_message_iter_append_basic(&args, DBUS_TYPE_INT32, &action) ||
+        !dbus_message_iter_append_basic(&args, DBUS_TYPE_INT32, &event_type)) {
+        fprintf(stderr, "Failed to append arguments to D-Bus message\n");
+        dbus_message_unref(msg);
+        return NULL;
+    }
+
+    return msg;
+}
+
+void emit_dbus_signal(DBusConnection *conn, int action, int event_type) {
+    // not connected yet while startup is still prewarming
+    if (conn == NULL)
+        return;
+
+    DBusMessage *msg = new_action_signal(action, event_type);
+    if (msg == NULL)
+        return;
+
+    if (!dbus_connection_send(conn, msg, NULL))
+        fprintf(stderr, "Failed to send D-Bus message\n");
+
+    dbus_message_unref(msg);
+}
@@ -0,0 +1,16 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#ifndef DBUS_H
+#define DBUS_H
+
+#include <dbus/dbus.h>
+
+#define DBUS_INTERFACE "io.FuriOS.AssistantButton"
+#define DBUS_PATH "/io/FuriOS/AssistantButton"
+
+DBusConnection *init_dbus();
+DBusMessage *new_action_signal(int action, int event_type);
+void emit_dbus_signal(DBusConnection *conn, int action, int event_type);
+
+#endif // DBUS_H
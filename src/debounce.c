@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <stdio.h>
+#include <string.h>
+#include "debounce.h"
+#include "stats.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+void debounce_init(struct debounce *debounce, unsigned int base_ms, unsigned int max_ms, int adaptive) {
+    memset(debounce, 0, sizeof(*debounce));
+    debounce->base_us = base_ms * 1000LL;
+    debounce->max_us = MAX(max_ms * 1000LL, debounce->base_us);
+    debounce->adaptive = adaptive;
+    debounce->window_us = debounce->base_us;
+    stats_set(STAT_DEBOUNCE_WINDOW_US, debounce->window_us);
+}
+
+static void accept_edge(struct debounce *debounce, int value, long long now) {
+    // shrink an adaptive window back once the button behaved for a while
+    if (value == 1 && debounce->adaptive) {
+        if (debounce->bounced) {
+            debounce->clean_presses = 0;
+        } else if (++debounce->clean_presses >= DEBOUNCE_CLEAN_PRESSES && debounce->window_us > debounce->base_us) {
+            debounce->window_us = MAX(debounce->base_us, debounce->window_us - DEBOUNCE_SHRINK_US);
+            debounce->clean_presses = 0;
+            stats_set(STAT_DEBOUNCE_WINDOW_US, debounce->window_us);
+        }
+        debounce->bounced = 0;
+    }
+
+    debounce->accepted_value = value;
+    debounce->accepted_time = now;
+    debounce->raw_value = value;
+    debounce->raw_time = now;
+}
+
+/* returns 1 when the edge should be handled, 0 when it was filtered out */
+int debounce_edge(struct debounce *debounce, int value, long long now) {
+    // autorepeat and a disabled filter pass straight through
+    if ((value != 0 && value != 1) || debounce->base_us == 0)
+        return 1;
+
+    long long since = now - debounce->accepted_time;
+    if (value != debounce->accepted_value && since >= debounce->window_us) {
+        accept_edge(debounce, value, now);
+        return 1;
+    }
+
+    debounce->raw_value = value;
+    debounce->raw_time = now;
+    debounce->bounced = 1;
+    stats_add(STAT_FILTERED_EDGES, 1);
+
+    // still bouncing near the end of the window, the contacts need a wider one
+    if (debounce->adaptive && since >= debounce->window_us * DEBOUNCE_CHATTER_RATIO &&
+        debounce->window_us < debounce->max_us) {
+        debounce->window_us = MIN(debounce->max_us, MAX(since * 2, debounce->window_us + DEBOUNCE_SHRINK_US));
+        stats_add(STAT_CHATTER_EPISODES, 1);
+        stats_set(STAT_DEBOUNCE_WINDOW_US, debounce->window_us);
+        fprintf(stderr, "Button chatter detected, debounce window widened to %.1f ms\n", debounce->window_us / 1000.0);
+    }
+    return 0;
+}
+
+/* ms until a filtered edge has to be replayed, -1 when there is none */
+int debounce_timeout(const struct debounce *debounce, long long now) {
+    if (debounce->base_us == 0 || debounce->raw_value == debounce->accepted_value)
+        return -1;
+
+    long long left = debounce->accepted_time + debounce->window_us - now;
+    return left > 0 ? (left + 999) / 1000 : 0;
+}
+
+/* the key state to replay once the window passed with the key left changed, -1 if nothing is due */
+int debounce_expire(struct debounce *debounce, long long now) {
+    if (debounce->base_us == 0 || debounce->raw_value == debounce->accepted_value ||
+        now - debounce->accepted_time < debounce->window_us)
+        return -1;
+
+    // the key settled on its last edge, that is when it changed
+    stats_add(STAT_LATE_EDGES, 1);
+    accept_edge(debounce, debounce->raw_value, debounce->raw_time);
+    return debounce->accepted_value;
+}
@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#ifndef DEBOUNCE_H
+#define DEBOUNCE_H
+
+/* a bounce lasting this close to the window counts as chatter and widens it */
+#define DEBOUNCE_CHATTER_RATIO 0.75
+/* presses without a single bounce before an adaptive window shrinks back by one step */
+#define DEBOUNCE_CLEAN_PRESSES 50
+#define DEBOUNCE_SHRINK_US 1000
+
+/*
+ * Drops key edges that follow the last accepted edge closer than the
+ * debounce window. A dropped edge that leaves the key in a different state
+ * than the last accepted one is replayed once the window has passed, so a
+ * very short tap is never lost. Times are in microseconds.
+ */
+struct debounce {
+    long long base_us;   // configured window, 0 disables the filter
+    long long max_us;    // how far the adaptive mode may widen it
+    int adaptive;
+    long long window_us;
+    long long accepted_time;
+    int accepted_value;
+    int raw_value;
+    long long raw_time;  // of the last edge, filtered or not
+    int bounced;         // an edge was dropped since the last accepted press
+    unsigned int clean_presses;
+};
+
+void debounce_init(struct debounce *debounce, unsigned int base_ms, unsigned int max_ms, int adaptive);
+int debounce_edge(struct debounce *debounce, int value, long long now);
+int debounce_timeout(const struct debounce *debounce, long long now);
+int debounce_expire(struct debounce *debounce, long long now);
+
+#endif // DEBOUNCE_H
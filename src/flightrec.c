@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include "flightrec.h"
+
+static struct flightrec_record ring[FLIGHTREC_SIZE];
+static atomic_uint_fast64_t head;
+
+static uint64_t now_ns(clockid_t clock) {
+    struct timespec spec;
+    clock_gettime(clock, &spec);
+    return spec.tv_sec * 1000000000ULL + spec.tv_nsec;
+}
+
+/*
+ * Any thread may record. A writer claims a sequence number, marks the slot
+ * busy by zeroing its seq, fills it in and publishes the seq last, so a dump
+ * can tell a complete record from one that is being overwritten.
+ */
+void flightrec_record(enum flightrec_type type, uint16_t code, int64_t a, int64_t b) {
+    uint64_t seq = atomic_fetch_add_explicit(&head, 1, memory_order_relaxed) + 1;
+    struct flightrec_record *slot = &ring[seq & (FLIGHTREC_SIZE - 1)];
+    _Atomic uint64_t *slot_seq = (_Atomic uint64_t *)&slot->seq;
+
+    atomic_store_explicit(slot_seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    // keeps counting through suspend, so records from before one still get the right wall time
+    slot->timestamp_ns = now_ns(CLOCK_BOOTTIME);
+    slot->type = type;
+    slot->code = code;
+    slot->a = a;
+    slot->b = b;
+
+    atomic_store_explicit(slot_seq, seq, memory_order_release);
+}
+
+static int read_slot(uint64_t seq, struct flightrec_record *out) {
+    struct flightrec_record *slot = &ring[seq & (FLIGHTREC_SIZE - 1)];
+    _Atomic uint64_t *slot_seq = (_Atomic uint64_t *)&slot->seq;
+
+    if (atomic_load_explicit(slot_seq, memory_order_acquire) != seq)
+        return 0;
+
+    memcpy(out, slot, sizeof(*out));
+    atomic_thread_fence(memory_order_acquire);
+
+    // a writer lapped us while copying, drop the torn record
+    return atomic_load_explicit(slot_seq, memory_order_relaxed) == seq;
+}
+
+int flightrec_dump(const char *path) {
+    uint64_t last = atomic_load_explicit(&head, memory_order_acquire);
+    uint64_t first = last > FLIGHTREC_SIZE ? last - FLIGHTREC_SIZE + 1 : 1;
+    struct flightrec_record *records = malloc(FLIGHTREC_SIZE * sizeof(records[0]));
+    uint32_t count = 0;
+
+    if (records == NULL)
+        return -1;
+
+    for (uint64_t seq = first; seq <= last; seq++) {
+        if (read_slot(seq, &records[count]))
+            count++;
+    }
+
+    struct flightrec_header header = {
+        .version = FLIGHTREC_VERSION,
+        .record_size = sizeof(struct flightrec_record),
+        .count = count,
+        .boottime_ns = now_ns(CLOCK_BOOTTIME),
+        .realtime_ns = now_ns(CLOCK_REALTIME),
+    };
+    memcpy(header.magic, FLIGHTREC_MAGIC, sizeof(header.magic));
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        perror("Failed to open the flight recorder dump");
+        free(records);
+        return -1;
+    }
+
+    int ret = 0;
+    if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+        (count > 0 && fwrite(records, sizeof(records[0]), count, file) != count)) {
+        perror("Failed to write the flight recorder dump");
+        ret = -1;
+    }
+
+    if (fclose(file) != 0)
+        ret = -1;
+    free(records);
+
+    flightrec_record(FR_DUMP, 0, count, 0);
+    return ret;
+}
+
+/*
+ * The session's runtime dir, or the service's RuntimeDirectory for the
+ * reader, which has no session. Named by pid and a counter too, two dumps
+ * within the same second or from the reader and an agent don't collide.
+ */
+const char *flightrec_default_path() {
+    static char path[PATH_MAX];
+    static unsigned int counter;
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+
+    if (dir == NULL)
+        dir = getenv("RUNTIME_DIRECTORY");
+    if (dir == NULL)
+        dir = access(FLIGHTREC_RUNTIME_DIR, W_OK) == 0 ? FLIGHTREC_RUNTIME_DIR : "/tmp";
+
+    snprintf(path, sizeof(path), "%s/assistant-button-flightrec-%llu-%d-%u.bin",
+             dir, (unsigned long long)time(NULL), (int)getpid(), counter++);
+    return path;
+}
@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#ifndef FLIGHTREC_H
+#define FLIGHTREC_H
+
+#include <stdint.h>
+
+#define FLIGHTREC_MAGIC "ABFLTREC"
+#define FLIGHTREC_VERSION 2 // 1 stamped records with CLOCK_MONOTONIC
+#define FLIGHTREC_SIZE 4096 // records, must be a power of two
+#define FLIGHTREC_RUNTIME_DIR "/run/assistant-button" // the reader's RuntimeDirectory
+
+enum flightrec_type {
+    FR_INPUT = 1,   // code = evdev code, a = evdev value, b = evdev type
+    FR_GESTURE = 2, // code = ButtonEvent, a = press duration in ms
+    FR_TIMEOUT = 3, // a = poll timeout in ms
+    FR_ACTION = 4,  // code = ButtonEvent, a = action id, b = run time in us
+    FR_ERROR = 5,   // code = errno
+    FR_DUMP = 6,    // a = records in the dump
+    FR_CHAIN_STEP = 7, // code = step index, a = step status, b = run time in us
+    FR_ROLLBACK = 8,   // code = speculation, a = undo status, b = run time in us
+    FR_CONTEXT = 9,    // code = 1 screen off | 2 locked | 4 an app focused
+    FR_WAKEUP = 10,    // code = account_subsystem, a = poll timeout in ms, b = CPU time of the wakeup before in us
+    FR_BUSY_LOOP = 11, // code = account_subsystem woken for most, a = wakeups per second, b = CPU time in us
+};
+
+struct flightrec_record {
+    uint64_t seq;          // 0 while the slot is being written
+    uint64_t timestamp_ns; // CLOCK_BOOTTIME, like the origin and gesture times recorded
+    uint16_t type;
+    uint16_t code;
+    uint32_t reserved;
+    int64_t a;
+    int64_t b;
+};
+
+/* dump file header, followed by count records from oldest to newest */
+struct flightrec_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t boottime_ns;  // both clocks read at dump time, to put wall times on records
+    uint64_t realtime_ns;
+};
+
+void flightrec_record(enum flightrec_type type, uint16_t code, int64_t a, int64_t b);
+int flightrec_dump(const char *path);
+const char *flightrec_default_path();
+
+#endif // FLIGHTREC_H
@@ -0,0 +1,85 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include "gesture.h"
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+void gesture_reset(struct gesture *gesture) {
+    gesture->short_press_count = 0;
+    gesture->press_count = 0;
+    gesture->has_long_press_occurred = 0;
+}
+
+/* feed a key edge (1 down, 0 up), returns the gesture it completes or GESTURE_NONE */
+int gesture_key(struct gesture *gesture, int value, long long now, int bound) {
+    if (value == 1) {
+        if (gesture->short_press_count == 0)
+            gesture->first_press_time = now;
+        else
+            gesture->last_interval = now - gesture->first_press_time;
+        gesture->last_duration = -1;
+        gesture->press_time = now;
+        gesture->press_count++;
+        gesture->has_long_press_occurred = 0;
+        return GESTURE_NONE;
+    }
+
+    if (value != 0 || gesture->has_long_press_occurred)
+        return GESTURE_NONE;
+
+    long duration = now - gesture->press_time;
+    if (duration >= gesture->short_press_max)
+        return GESTURE_NONE;
+    gesture->last_duration = duration;
+
+    // Short press: if we don't have a double press action, execute the short press action immediately
+    if (!(bound & GESTURE_BOUND_DOUBLE)) {
+        gesture_reset(gesture);
+        return SHORT_PRESS;
+    }
+
+    gesture->short_press_count++;
+    if (gesture->short_press_count > 1) {
+        gesture_reset(gesture);
+        return DOUBLE_PRESS;
+    }
+
+    return GESTURE_NONE;
+}
+
+/*
+ * ms until gesture_expire() has to run, -1 when nothing is pending. It has
+ * to be a deadline gesture_expire() acts on, a 0 it answers with
+ * GESTURE_NONE sends the loop straight back around. A key held without a
+ * long press binding still expires into one, that's what ends the press.
+ */
+int gesture_timeout(const struct gesture *gesture, long long now, int bound) {
+    if (gesture->press_count == 0 || gesture->has_long_press_occurred)
+        return -1;
+
+    long time_since_press = now - gesture->press_time;
+
+    if (!(bound & GESTURE_BOUND_LONG) && (bound & GESTURE_BOUND_DOUBLE) && gesture->short_press_count == 1)
+        return MAX(0, gesture->double_press_max - time_since_press);
+
+    return MAX(0, gesture->short_press_max - time_since_press);
+}
+
+/* resolve whatever is pending once its window ran out, returns the gesture or GESTURE_NONE */
+int gesture_expire(struct gesture *gesture, long long now) {
+    long duration = now - gesture->press_time;
+
+    if (gesture->short_press_count == 1 && duration >= gesture->double_press_max) {
+        gesture_reset(gesture);
+        return SHORT_PRESS;
+    }
+
+    if (duration >= gesture->short_press_max && !gesture->has_long_press_occurred && gesture->press_count > 0) {
+        gesture_reset(gesture);
+        gesture->has_long_press_occurred = 1;
+        return LONG_PRESS;
+    }
+
+    return GESTURE_NONE;
+}
@@ -0,0 +1,36 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#ifndef GESTURE_H
+#define GESTURE_H
+
+enum ButtonEvent {
+    SHORT_PRESS = 1,
+    LONG_PRESS = 2,
+    DOUBLE_PRESS = 3
+};
+
+#define GESTURE_NONE 0
+
+/* gestures with a binding, they decide whether a press has to wait for a long or double press */
+#define GESTURE_BOUND_LONG 1
+#define GESTURE_BOUND_DOUBLE 2
+
+struct gesture {
+    long long press_time;
+    int press_count;
+    int has_long_press_occurred;
+    int short_press_count;
+    int short_press_max;
+    int double_press_max;
+    long long first_press_time;
+    long last_duration;  // of the last press released as a short one, -1 otherwise
+    long last_interval;  // between the two presses of the last double press attempt
+};
+
+int gesture_key(struct gesture *gesture, int value, long long now, int bound);
+int gesture_timeout(const struct gesture *gesture, long long now, int bound);
+int gesture_expire(struct gesture *gesture, long long now);
+void gesture_reset(struct gesture *gesture);
+
+#endif // GESTURE_H
@@ -0,0 +1,190 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "flightrec.h"
+#include "input.h"
+#include "reader.h"
+#include "stats.h"
+#include "wakelock.h"
+
+static long long now_us() {
+    struct timespec spec;
+    clock_gettime(CLOCK_BOOTTIME, &spec);
+    return spec.tv_sec * 1000000LL + spec.tv_nsec / 1000;
+}
+
+const char *input_config_file() {
+    // lets the harness run the daemon without touching the system config
+    const char *path = getenv("ASSISTANT_BUTTON_CONFIG");
+    return path ? path : CONFIG_FILE;
+}
+
+/* fills in the defaults, then whatever the config file says, other() gets every line that isn't ours */
+void input_read_config(struct input_config *config, void (*other)(const char *line, void *data), void *data) {
+    *config = (struct input_config){
+        .short_press_max = DEFAULT_SHORT_PRESS_MAX,
+        .double_press_max = DEFAULT_DOUBLE_PRESS_MAX,
+        .debounce_ms = DEFAULT_DEBOUNCE_MS,
+        .debounce_max_ms = DEFAULT_DEBOUNCE_MAX_MS,
+        .wakelock = 1,
+    };
+    strcpy(config->device, DEFAULT_DEVICE);
+    strcpy(config->reader_socket, READER_DEFAULT_SOCKET);
+
+    FILE *file = fopen(input_config_file(), "r");
+    if (file == NULL) {
+        perror("Failed to open the config file");
+        return;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "SHORT_PRESS_MAX=%d", &config->short_press_max) == 1)
+            continue;
+        if (sscanf(line, "DOUBLE_PRESS_MAX=%d", &config->double_press_max) == 1)
+            continue;
+        if (sscanf(line, "DEVICE=%255s", config->device) == 1)
+            continue;
+        if (sscanf(line, "DEBOUNCE_MS=%u", &config->debounce_ms) == 1)
+            continue;
+        if (sscanf(line, "DEBOUNCE_MAX_MS=%u", &config->debounce_max_ms) == 1)
+            continue;
+        if (sscanf(line, "DEBOUNCE_ADAPTIVE=%d", &config->debounce_adaptive) == 1)
+            continue;
+        if (sscanf(line, "WAKELOCK=%d", &config->wakelock) == 1)
+            continue;
+        if (sscanf(line, "READER_SOCKET=%107s", config->reader_socket) == 1)
+            continue;
+        if (other)
+            other(line, data);
+    }
+    fclose(file);
+}
+
+void input_init(struct input *input, const struct input_config *config, const struct input_ops *ops, void *data) {
+    memset(input, 0, sizeof(*input));
+    input->fd = -1;
+    input->timeout = -1;
+    input->gesture.short_press_max = config->short_press_max;
+    input->gesture.double_press_max = config->double_press_max;
+    debounce_init(&input->debounce, config->debounce_ms, config->debounce_max_ms, config->debounce_adaptive);
+    input->ops = ops;
+    input->data = data;
+}
+
+int input_open(struct input *input, const char *device) {
+    input->fd = open(device, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (input->fd == -1) {
+        perror("Failed to open the device");
+        return -1;
+    }
+
+    // stamps on the clock our deadlines use, edges are timed by them and a suspend between
+    // key-down and a timeout can't shorten the press, without them edges are timed by the read
+    int clock = CLOCK_BOOTTIME;
+    input->event_timestamps = ioctl(input->fd, EVIOCSCLOCKID, &clock) == 0;
+    return 0;
+}
+
+/* ms until input_expire() has to run, -1 when nothing is pending */
+int input_timeout(struct input *input, long long now) {
+    int timeout = gesture_timeout(&input->gesture, now / 1000, input->ops->bound(input->data));
+    int replay = debounce_timeout(&input->debounce, now);
+    if (replay >= 0 && (timeout < 0 || replay < timeout))
+        timeout = replay;
+
+    input->timeout = timeout;
+    input->deadline_us = now + timeout * 1000LL;
+    return timeout;
+}
+
+/* time is when the edge happened, not when it was read */
+static void classify(struct input *input, int value, long long time) {
+    // only a release can complete a gesture, so only then the bindings are looked at
+    int bound = value == 0 ? input->ops->bound(input->data) : 0;
+
+    int event = gesture_key(&input->gesture, value, time / 1000, bound);
+    // after gesture_key(), so gesture.press_time is this press
+    if (value == 1)
+        input->ops->emit(input->data, INPUT_PRESS, 0);
+    if (event != GESTURE_NONE)
+        input->ops->emit(input->data, INPUT_GESTURE, event);
+    else if (value == 0 && input->gesture.short_press_count == 1)
+        input->ops->emit(input->data, INPUT_SPECULATE, 0);
+}
+
+static void handle_event(struct input *input, const struct input_event *ev) {
+    if (ev->type != EV_SYN)
+        flightrec_record(FR_INPUT, ev->code, ev->value, ev->type);
+    if (ev->type != EV_KEY || ev->code != ASSISTANT_KEY)
+        return;
+
+    // edges read in one batch, after a busy loop or a resume, still get their own times
+    long long now = now_us();
+    long long time = now;
+    if (input->event_timestamps) {
+        time = ev->input_event_sec * 1000000LL + ev->input_event_usec;
+        stats_max(STAT_INPUT_LAG_US_MAX, now > time ? now - time : 0);
+    }
+    input->origin_us = time;
+
+    stats_add(STAT_KEY_EDGES, 1);
+    if (debounce_edge(&input->debounce, ev->value, time))
+        classify(input, ev->value, time);
+}
+
+/* drains the device, -1 with errno set when it can't be read anymore */
+int input_read(struct input *input) {
+    // before the read, the kernel lets go of its own wakeup source once the events are taken
+    input->wake_epoch = wakelock_acquire();
+
+    while (1) {
+        ssize_t len = input->ops->read(input->fd, input->events, sizeof(input->events));
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN ? 0 : -1;
+        }
+
+        for (size_t i = 0; i < len / sizeof(input->events[0]); i++)
+            handle_event(input, &input->events[i]);
+
+        // a short read means the device is drained, the next poll tells when there's more
+        if (len < (ssize_t)sizeof(input->events))
+            return 0;
+    }
+}
+
+/* the deadline of the last input_timeout() ran out, or something else woke the caller up */
+void input_expire(struct input *input, long long now) {
+    input->origin_us = input->deadline_us;
+    if (input->timeout > 0)
+        flightrec_record(FR_TIMEOUT, 0, input->timeout, 0);
+
+    // a release the debounce filter held back is due before any gesture can expire, at the time of its edge
+    int value = debounce_expire(&input->debounce, now);
+    if (value >= 0)
+        classify(input, value, input->debounce.accepted_time);
+
+    int event = gesture_expire(&input->gesture, now / 1000);
+    if (event != GESTURE_NONE)
+        input->ops->emit(input->data, INPUT_GESTURE, event);
+}
+
+/* once nothing is left to time, a key still held past its long press included, returns the epoch to release */
+unsigned int input_idle(struct input *input) {
+    unsigned int epoch = input->wake_epoch;
+
+    if (epoch == 0 || input->gesture.press_count > 0 || debounce_timeout(&input->debounce, now_us()) >= 0)
+        return 0;
+
+    input->wake_epoch = 0;
+    return epoch;
+}
@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <sys/types.h>
+#include <linux/input.h>
+#include "debounce.h"
+#include "gesture.h"
+
+#define CONFIG_FILE "/etc/assistant-button.conf"
+#define DEFAULT_DEVICE "/dev/input/event1"
+#define DEFAULT_SHORT_PRESS_MAX 500  // ms
+#define DEFAULT_DOUBLE_PRESS_MAX 200 // ms
+#define DEFAULT_DEBOUNCE_MS 8
+#define DEFAULT_DEBOUNCE_MAX_MS 40
+#define ASSISTANT_KEY 112
+
+/* the part of the config the daemon and the reader both read */
+struct input_config {
+    char device[256];
+    char reader_socket[108];
+    int short_press_max;
+    int double_press_max;
+    unsigned int debounce_ms;
+    unsigned int debounce_max_ms;
+    int debounce_adaptive;
+    int wakelock;
+};
+
+enum input_kind {
+    INPUT_PRESS,     // the key went down
+    INPUT_SPECULATE, // a short press is waiting for the double press window
+    INPUT_GESTURE,   // event completed, origin_us is the edge or deadline that completed it
+};
+
+/*
+ * The input stage, the same for the daemon's main loop, its input thread
+ * and the reader: reads the evdev device, stamps, debounces and classifies
+ * the edges and hands the results to emit(). A wakelock is taken before
+ * every read and input_idle() says when it can go.
+ */
+struct input_ops {
+    ssize_t (*read)(int fd, void *buf, size_t size);
+    int (*bound)(void *data); // GESTURE_BOUND_* flags, asked for every timeout and release
+    void (*emit)(void *data, enum input_kind kind, int event);
+};
+
+struct input {
+    int fd;
+    int event_timestamps;    // evdev stamps events with CLOCK_BOOTTIME, edges are timed by those then
+    struct gesture gesture;
+    struct debounce debounce;
+    long long origin_us;     // the edge or deadline that completes the gesture being classified
+    int timeout;             // ms, what the last input_timeout() returned
+    long long deadline_us;   // and when that runs out
+    unsigned int wake_epoch; // of the wakelock held for the press being classified, 0 if none
+    const struct input_ops *ops;
+    void *data;
+    struct input_event events[16];
+};
+
+const char *input_config_file();
+void input_read_config(struct input_config *config, void (*other)(const char *line, void *data), void *data);
+void input_init(struct input *input, const struct input_config *config, const struct input_ops *ops, void *data);
+int input_open(struct input *input, const char *device);
+int input_timeout(struct input *input, long long now);
+int input_read(struct input *input);
+void input_expire(struct input *input, long long now);
+unsigned int input_idle(struct input *input);
+
+#endif // INPUT_H
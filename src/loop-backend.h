@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#ifndef LOOP_BACKEND_H
+#define LOOP_BACKEND_H
+
+#include <poll.h>
+#include <sys/types.h>
+#include <glib.h>
+
+/* how loop_poll() waits, picked once by loop_init() */
+struct loop_backend {
+    const char *name;
+    int (*init)(void);
+    /* waits for the caller's fds and GLib's together, fills in every revents and returns like poll() */
+    int (*wait)(struct pollfd *fds, int nfds, GPollFD *glib_fds, gint glib_nfds, int timeout);
+    ssize_t (*read)(int fd, void *buf, size_t size);
+    /* GLib ran sources, any of its fds may have been closed and its number reused since */
+    void (*dispatched)(void);
+    /* one of the caller's fds is about to be closed, whatever is kept for it goes */
+    void (*forget)(int fd);
+};
+
+extern const struct loop_backend loop_poll_backend;
+extern const struct loop_backend loop_epoll_backend;
+#ifdef HAVE_LIBURING
+extern const struct loop_backend loop_uring_backend;
+#endif
+
+#endif // LOOP_BACKEND_H
@@ -0,0 +1,159 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "loop-backend.h"
+#include "stats.h"
+
+#define EPOLL_MAX_FDS 64
+
+/* the registrations epoll holds, poll() events and epoll ones share their values on Linux */
+static struct watched {
+    int fd;
+    short events;
+    short revents;
+    int registered;
+    int seen; // asked for in this round, the rest is dropped
+} watched[EPOLL_MAX_FDS];
+static int watched_count;
+static int epoll_fd = -1;
+// GLib dispatched since the last round, its fds may be new files under old numbers
+static int stale;
+
+static int epoll_init() {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        perror("Failed to create the epoll instance");
+        return -1;
+    }
+    return 0;
+}
+
+static int ctl(int op, int fd, short events) {
+    struct epoll_event event = { .events = (unsigned short)events, .data.fd = fd };
+
+    stats_add(STAT_LOOP_SYSCALLS, 1);
+    return epoll_ctl(epoll_fd, op, fd, &event);
+}
+
+static struct watched *find(int fd) {
+    for (int i = 0; i < watched_count; i++) {
+        if (watched[i].fd == fd)
+            return &watched[i];
+    }
+    return NULL;
+}
+
+static void watch(int fd, short events, int glib) {
+    struct watched *w = find(fd);
+
+    if (w && w->seen) {
+        // two GLib sources on one fd, epoll gets what either wants
+        if ((w->events | events) == w->events)
+            return;
+        events |= w->events;
+    } else if (w && w->events == events && !(glib && stale)) {
+        w->seen = 1;
+        return;
+    }
+
+    if (w == NULL) {
+        if (watched_count == EPOLL_MAX_FDS) {
+            fprintf(stderr, "Too many fds for the epoll loop backend\n");
+            return;
+        }
+        w = &watched[watched_count++];
+        w->fd = fd;
+        w->registered = 0;
+    }
+
+    // a closed fd drops out of epoll by itself, so its successor under the same number needs adding
+    if (!w->registered || (ctl(EPOLL_CTL_MOD, fd, events) == -1 && errno == ENOENT)) {
+        if (ctl(EPOLL_CTL_ADD, fd, events) == -1)
+            perror("Failed to add an fd to epoll");
+    }
+    w->registered = 1;
+
+    w->events = events;
+    w->seen = 1;
+}
+
+static void drop_unseen() {
+    for (int i = 0; i < watched_count;) {
+        if (watched[i].seen) {
+            watched[i].seen = 0;
+            watched[i].revents = 0;
+            i++;
+            continue;
+        }
+
+        // fails when GLib already closed it, which is fine
+        ctl(EPOLL_CTL_DEL, watched[i].fd, 0);
+        watched[i] = watched[--watched_count];
+    }
+}
+
+static int epoll_wait_all(struct pollfd *fds, int nfds, GPollFD *glib_fds, gint glib_nfds, int timeout) {
+    struct epoll_event events[EPOLL_MAX_FDS];
+    struct watched *w;
+
+    for (int i = 0; i < nfds; i++)
+        watch(fds[i].fd, fds[i].events, 0);
+    for (gint i = 0; i < glib_nfds; i++)
+        watch(glib_fds[i].fd, glib_fds[i].events, 1);
+    stale = 0;
+    drop_unseen();
+
+    stats_add(STAT_LOOP_SYSCALLS, 1);
+    int ret = epoll_wait(epoll_fd, events, EPOLL_MAX_FDS, timeout);
+    int saved_errno = errno;
+
+    for (int i = 0; i < ret; i++) {
+        if ((w = find(events[i].data.fd)))
+            w->revents = events[i].events;
+    }
+
+    for (int i = 0; i < nfds; i++) {
+        w = find(fds[i].fd);
+        fds[i].revents = w ? w->revents & (fds[i].events | POLLERR | POLLHUP) : POLLNVAL;
+    }
+    for (gint i = 0; i < glib_nfds; i++) {
+        w = find(glib_fds[i].fd);
+        glib_fds[i].revents = w ? w->revents & (glib_fds[i].events | G_IO_ERR | G_IO_HUP) : G_IO_NVAL;
+    }
+
+    errno = saved_errno;
+    return ret;
+}
+
+static ssize_t epoll_read(int fd, void *buf, size_t size) {
+    stats_add(STAT_LOOP_SYSCALLS, 1);
+    return read(fd, buf, size);
+}
+
+static void epoll_dispatched() {
+    stale = 1;
+}
+
+static void epoll_forget(int fd) {
+    struct watched *w = find(fd);
+
+    if (w == NULL)
+        return;
+    if (w->registered)
+        ctl(EPOLL_CTL_DEL, fd, 0);
+    *w = watched[--watched_count];
+}
+
+const struct loop_backend loop_epoll_backend = {
+    .name = "epoll",
+    .init = epoll_init,
+    .wait = epoll_wait_all,
+    .read = epoll_read,
+    .dispatched = epoll_dispatched,
+    .forget = epoll_forget,
+};
@@ -0,0 +1,343 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <liburing.h>
+#include "flightrec.h"
+#include "loop-backend.h"
+#include "stats.h"
+
+#define URING_ENTRIES 256
+#define URING_MAX_READERS 4
+#define URING_MAX_POLLS 64
+#define URING_READ_SIZE 384    // 16 evdev events
+#define URING_BUFFERS 8        // per reader, must be a power of two
+#define URING_PENDING_SIZE 4096
+
+/* user_data is a tag in the top byte, for polls a generation and an index below it */
+#define TAG_READ 1ULL
+#define TAG_POLL 2ULL
+#define TAG_CANCEL 3ULL
+#define USER_DATA(tag, generation, index) ((tag) << 56 | (uint64_t)(generation) << 24 | (index))
+
+/*
+ * The caller's fds get a read posted on them for good, multishot where the
+ * kernel has it, so loop_read() hands out what already arrived without a
+ * syscall. GLib's fds get a one shot poll every round, removed again in the
+ * next one if it didn't fire: GLib may have closed them and reused the
+ * numbers since, and a one shot poll can't miss a level that's already up.
+ * That covers child exits too, GLib watches those through pidfds.
+ */
+static struct io_uring ring;
+static int multishot;
+static uint32_t generation;
+
+static struct reader {
+    int fd;        // -1 for a slot given up by loop_forget(), its buffer ring stays for the next one
+    uint32_t generation; // of the reads posted, a cancelled one's late completions don't count
+    int armed;
+    int error; // of a failed read, handed out once the data before it was
+    int eof;
+    struct io_uring_buf_ring *buf_ring;
+    size_t head;
+    size_t len;
+    char pending[URING_PENDING_SIZE]; // read ahead, not taken by loop_read() yet
+    char staging[URING_READ_SIZE];    // where one shot reads land
+} readers[URING_MAX_READERS];
+static int reader_count;
+static char buffers[URING_MAX_READERS][URING_BUFFERS][URING_READ_SIZE];
+
+static uint64_t polls[URING_MAX_POLLS]; // this round's, 0 once completed
+static int poll_count;
+
+static int uring_init() {
+    // completions are only ever reaped by this thread, so the kernel can defer its work until we wait
+    int ret = io_uring_queue_init(URING_ENTRIES, &ring, IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN);
+    if (ret == -EINVAL)
+        ret = io_uring_queue_init(URING_ENTRIES, &ring, 0);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to set up io_uring: %s\n", strerror(-ret));
+        return -1;
+    }
+
+    struct io_uring_probe *probe = io_uring_get_probe_ring(&ring);
+    multishot = probe && io_uring_opcode_supported(probe, IORING_OP_READ_MULTISHOT);
+    if (probe)
+        io_uring_free_probe(probe);
+    return 0;
+}
+
+static struct io_uring_sqe *get_sqe() {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+
+    // the ring is sized for a round, but a GLib with many fds can still fill it
+    if (sqe == NULL) {
+        stats_add(STAT_LOOP_SYSCALLS, 1);
+        io_uring_submit(&ring);
+        sqe = io_uring_get_sqe(&ring);
+    }
+    return sqe;
+}
+
+static struct reader *find_reader(int fd) {
+    for (int i = 0; i < reader_count; i++) {
+        if (readers[i].fd == fd)
+            return &readers[i];
+    }
+    return NULL;
+}
+
+static struct reader *add_reader(int fd) {
+    struct reader *reader = find_reader(-1);
+
+    if (reader == NULL) {
+        if (reader_count == URING_MAX_READERS)
+            return NULL;
+        reader = &readers[reader_count++];
+        memset(reader, 0, sizeof(*reader));
+    }
+
+    int index = reader - readers;
+    reader->fd = fd;
+    reader->armed = 0;
+    reader->error = 0;
+    reader->eof = 0;
+    reader->head = 0;
+    reader->len = 0;
+
+    if (multishot && reader->buf_ring == NULL) {
+        int ret;
+        reader->buf_ring = io_uring_setup_buf_ring(&ring, URING_BUFFERS, index, 0, &ret);
+        if (reader->buf_ring) {
+            for (int i = 0; i < URING_BUFFERS; i++)
+                io_uring_buf_ring_add(reader->buf_ring, buffers[index][i], URING_READ_SIZE, i,
+                                      io_uring_buf_ring_mask(URING_BUFFERS), i);
+            io_uring_buf_ring_advance(reader->buf_ring, URING_BUFFERS);
+        }
+    }
+    return reader;
+}
+
+static void arm_reader(struct reader *reader) {
+    int index = reader - readers;
+    struct io_uring_sqe *sqe = get_sqe();
+    if (sqe == NULL)
+        return;
+
+    if (reader->buf_ring)
+        io_uring_prep_read_multishot(sqe, reader->fd, 0, -1, index);
+    else
+        io_uring_prep_read(sqe, reader->fd, reader->staging, sizeof(reader->staging), -1);
+    io_uring_sqe_set_data64(sqe, USER_DATA(TAG_READ, reader->generation, index));
+    reader->armed = 1;
+}
+
+static void append(struct reader *reader, const char *data, size_t len) {
+    if (reader->head + reader->len + len > sizeof(reader->pending)) {
+        memmove(reader->pending, reader->pending + reader->head, reader->len);
+        reader->head = 0;
+    }
+
+    if (reader->len + len > sizeof(reader->pending)) {
+        // nobody read this fd for a whole buffer's worth, its oldest data is the least useful
+        flightrec_record(FR_ERROR, ENOBUFS, reader->fd, 0);
+        return;
+    }
+
+    memcpy(reader->pending + reader->head + reader->len, data, len);
+    reader->len += len;
+}
+
+static void read_completed(struct reader *reader, uint32_t generation, struct io_uring_cqe *cqe) {
+    int index = reader - readers;
+
+    if (generation != reader->generation) {
+        // a read cancelled by loop_forget(), only its buffer is still ours
+    } else if (cqe->res > 0) {
+        if (cqe->flags & IORING_CQE_F_BUFFER)
+            append(reader, buffers[index][cqe->flags >> IORING_CQE_BUFFER_SHIFT], cqe->res);
+        else
+            append(reader, reader->staging, cqe->res);
+    } else if (cqe->res == 0) {
+        reader->eof = 1;
+    } else if (cqe->res != -ENOBUFS && cqe->res != -EINTR && cqe->res != -EAGAIN) {
+        reader->error = -cqe->res;
+    }
+
+    // the data is copied out already, the buffer can go straight back
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        io_uring_buf_ring_add(reader->buf_ring, buffers[index][bid], URING_READ_SIZE, bid,
+                              io_uring_buf_ring_mask(URING_BUFFERS), 0);
+        io_uring_buf_ring_advance(reader->buf_ring, 1);
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_MORE) && generation == reader->generation)
+        reader->armed = 0;
+}
+
+static void reap(GPollFD *glib_fds, gint glib_nfds) {
+    struct io_uring_cqe *cqe;
+    unsigned int head;
+    unsigned int count = 0;
+
+    io_uring_for_each_cqe(&ring, head, cqe) {
+        uint64_t data = io_uring_cqe_get_data64(cqe);
+        uint32_t index = data & 0xffffff;
+        count++;
+
+        switch (data >> 56) {
+            case TAG_READ:
+                read_completed(&readers[index], (data >> 24) & 0xffffffff, cqe);
+                break;
+            case TAG_POLL:
+                // polls from earlier rounds finish as they're removed, or race the removal
+                if ((uint32_t)(data >> 24) != generation || index >= (uint32_t)glib_nfds)
+                    break;
+                glib_fds[index].revents = cqe->res >= 0 ? cqe->res : G_IO_ERR;
+                polls[index] = 0;
+                break;
+        }
+    }
+    io_uring_cq_advance(&ring, count);
+}
+
+static int uring_wait(struct pollfd *fds, int nfds, GPollFD *glib_fds, gint glib_nfds, int timeout) {
+    int ready = 0;
+
+    for (int i = 0; i < poll_count; i++) {
+        if (polls[i] == 0)
+            continue;
+        struct io_uring_sqe *sqe = get_sqe();
+        if (sqe) {
+            io_uring_prep_poll_remove(sqe, polls[i]);
+            io_uring_sqe_set_data64(sqe, USER_DATA(TAG_CANCEL, 0, 0));
+        }
+    }
+
+    generation++;
+    poll_count = glib_nfds < URING_MAX_POLLS ? glib_nfds : URING_MAX_POLLS;
+    for (gint i = 0; i < glib_nfds; i++)
+        glib_fds[i].revents = 0;
+    for (int i = 0; i < poll_count; i++) {
+        struct io_uring_sqe *sqe = get_sqe();
+        polls[i] = 0;
+        if (sqe == NULL)
+            continue;
+        polls[i] = USER_DATA(TAG_POLL, generation, i);
+        io_uring_prep_poll_add(sqe, glib_fds[i].fd, glib_fds[i].events);
+        io_uring_sqe_set_data64(sqe, polls[i]);
+    }
+
+    for (int i = 0; i < nfds; i++) {
+        struct reader *reader = find_reader(fds[i].fd);
+        if (reader == NULL && (reader = add_reader(fds[i].fd)) == NULL) {
+            fprintf(stderr, "Too many fds for the io_uring loop backend\n");
+            continue;
+        }
+        if (!reader->armed && !reader->error && !reader->eof)
+            arm_reader(reader);
+        if (reader->len || reader->error || reader->eof)
+            ready++;
+    }
+
+    // one syscall submits the round and waits for it, unless something is already there to hand out
+    int ret;
+    stats_add(STAT_LOOP_SYSCALLS, 1);
+    if (ready || timeout == 0) {
+        ret = io_uring_submit(&ring);
+    } else {
+        struct __kernel_timespec spec = {
+            .tv_sec = timeout / 1000,
+            .tv_nsec = (timeout % 1000) * 1000000LL,
+        };
+        struct io_uring_cqe *cqe;
+        ret = io_uring_submit_and_wait_timeout(&ring, &cqe, 1, timeout < 0 ? NULL : &spec, NULL);
+    }
+    reap(glib_fds, glib_nfds);
+
+    ready = 0;
+    for (int i = 0; i < nfds; i++) {
+        struct reader *reader = find_reader(fds[i].fd);
+        fds[i].revents = 0;
+        if (reader && reader->len)
+            fds[i].revents |= POLLIN;
+        if (reader && (reader->error || reader->eof))
+            fds[i].revents |= reader->error ? POLLERR : POLLHUP;
+        if (fds[i].revents)
+            ready++;
+    }
+
+    if (ret < 0 && ret != -ETIME && !ready) {
+        errno = -ret;
+        return -1;
+    }
+    return ready;
+}
+
+static ssize_t uring_read(int fd, void *buf, size_t size) {
+    struct reader *reader = find_reader(fd);
+
+    if (reader == NULL) {
+        stats_add(STAT_LOOP_SYSCALLS, 1);
+        return read(fd, buf, size);
+    }
+
+    if (reader->len) {
+        size_t len = size < reader->len ? size : reader->len;
+        memcpy(buf, reader->pending + reader->head, len);
+        reader->head += len;
+        reader->len -= len;
+        if (reader->len == 0)
+            reader->head = 0;
+        return len;
+    }
+
+    if (reader->error) {
+        errno = reader->error;
+        return -1;
+    }
+    if (reader->eof)
+        return 0;
+
+    errno = EAGAIN;
+    return -1;
+}
+
+/*
+ * The posted read holds on to the file, so closing the fd alone would keep
+ * the other end connected. The cancel has to reach the kernel while the
+ * number still refers to it.
+ */
+static void uring_forget(int fd) {
+    struct reader *reader = find_reader(fd);
+
+    if (reader == NULL || fd < 0)
+        return;
+
+    if (reader->armed) {
+        struct io_uring_sqe *sqe = get_sqe();
+        if (sqe) {
+            io_uring_prep_cancel_fd(sqe, fd, 0);
+            io_uring_sqe_set_data64(sqe, USER_DATA(TAG_CANCEL, 0, 0));
+            stats_add(STAT_LOOP_SYSCALLS, 1);
+            io_uring_submit(&ring);
+        }
+    }
+
+    reader->fd = -1;
+    reader->generation++;
+    reader->armed = 0;
+    reader->len = 0;
+}
+
+const struct loop_backend loop_uring_backend = {
+    .name = "io_uring",
+    .init = uring_init,
+    .wait = uring_wait,
+    .read = uring_read,
+    .forget = uring_forget,
+};
@@ -0,0 +1,227 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include "accounting.h"
+#include "loop-backend.h"
+#include "loop.h"
+#include "stats.h"
+
+#define LOOP_MAX_FDS 64
+
+static GMainContext *context;
+static GPollFD *glib_fds;
+static gint glib_fds_cap;
+static const struct loop_backend *backend;
+
+static int poll_wait(struct pollfd *fds, int nfds, GPollFD *glib, gint glib_nfds, int timeout) {
+    struct pollfd all[nfds + glib_nfds];
+
+    memcpy(all, fds, nfds * sizeof(fds[0]));
+    for (gint i = 0; i < glib_nfds; i++) {
+        all[nfds + i].fd = glib[i].fd;
+        all[nfds + i].events = glib[i].events;
+        all[nfds + i].revents = 0;
+    }
+
+    stats_add(STAT_LOOP_SYSCALLS, 1);
+    int ret = poll(all, nfds + glib_nfds, timeout);
+    int saved_errno = errno;
+
+    for (gint i = 0; i < glib_nfds; i++)
+        glib[i].revents = ret > 0 ? all[nfds + i].revents : 0;
+    for (int i = 0; i < nfds; i++)
+        fds[i].revents = ret > 0 ? all[i].revents : 0;
+
+    errno = saved_errno;
+    return ret;
+}
+
+static ssize_t counted_read(int fd, void *buf, size_t size) {
+    stats_add(STAT_LOOP_SYSCALLS, 1);
+    return read(fd, buf, size);
+}
+
+const struct loop_backend loop_poll_backend = {
+    .name = "poll",
+    .wait = poll_wait,
+    .read = counted_read,
+};
+
+static const struct loop_backend *const backends[] = {
+#ifdef HAVE_LIBURING
+    &loop_uring_backend,
+#endif
+    &loop_epoll_backend,
+    &loop_poll_backend,
+};
+
+/* "auto" takes the first backend the kernel supports, NULL means poll */
+static const struct loop_backend *pick_backend(const char *name) {
+    int automatic = name && strcmp(name, "auto") == 0;
+
+    if (name == NULL)
+        name = loop_poll_backend.name;
+
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (!automatic && strcmp(backends[i]->name, name) != 0)
+            continue;
+        if (backends[i]->init == NULL || backends[i]->init() == 0)
+            return backends[i];
+        // io_uring can be disabled by sysctl or seccomp, epoll is always there
+        fprintf(stderr, "The %s loop backend is unavailable, falling back\n", backends[i]->name);
+        automatic = 1;
+    }
+
+    if (!automatic)
+        fprintf(stderr, "Unknown loop backend %s, using poll\n", name);
+    return &loop_poll_backend;
+}
+
+int loop_init(const char *backend_name) {
+    context = g_main_context_default();
+
+    // we drive the default context by hand from the daemon's own poll
+    if (!g_main_context_acquire(context)) {
+        fprintf(stderr, "Failed to acquire the GLib main context\n");
+        return -1;
+    }
+
+    glib_fds_cap = LOOP_MAX_FDS;
+    glib_fds = g_new(GPollFD, glib_fds_cap);
+    backend = pick_backend(backend_name);
+    return 0;
+}
+
+const char *loop_backend_name() {
+    return backend ? backend->name : loop_poll_backend.name;
+}
+
+/* the caller's fds are input, anything GLib watches has to be claimed by the source it wakes */
+static enum account_subsystem wakeup_cause(struct pollfd *fds, int nfds, int ret, gint glib_nfds, gint glib_timeout) {
+    for (int i = 0; i < nfds; i++) {
+        if (fds[i].revents)
+            return ACCOUNT_INPUT;
+    }
+    for (gint i = 0; i < glib_nfds; i++) {
+        if (glib_fds[i].revents)
+            return ACCOUNT_LOOP;
+    }
+    if (ret < 0)
+        return ACCOUNT_LOOP;
+    // GLib had something ready already, an idle callback or a cross thread invoke
+    return glib_timeout == 0 ? ACCOUNT_OTHER : ACCOUNT_TIMER;
+}
+
+/*
+ * Wait on the caller's fds together with everything GLib wants to watch,
+ * then dispatch whatever GLib sources became ready. Returns the number of
+ * caller fds with events, like poll() would for just those. The caller's
+ * fds have to be read with loop_read(), io_uring reads them ahead.
+ */
+int loop_poll(struct pollfd *fds, int nfds, int timeout) {
+    gint max_priority;
+    gint glib_timeout;
+    gint glib_nfds;
+
+    g_main_context_prepare(context, &max_priority);
+    while ((glib_nfds = g_main_context_query(context, max_priority, &glib_timeout,
+                                             glib_fds, glib_fds_cap)) > glib_fds_cap) {
+        glib_fds_cap = glib_nfds;
+        glib_fds = g_renew(GPollFD, glib_fds, glib_fds_cap);
+    }
+
+    if (glib_timeout >= 0 && (timeout < 0 || glib_timeout < timeout))
+        timeout = glib_timeout;
+
+    int ret = backend->wait(fds, nfds, glib_fds, glib_nfds, timeout);
+    int saved_errno = errno;
+    stats_add(STAT_LOOP_WAKEUPS, 1);
+
+    if (ret < 0) {
+        for (gint i = 0; i < glib_nfds; i++)
+            glib_fds[i].revents = 0;
+    }
+
+    enum account_subsystem cause = wakeup_cause(fds, nfds, ret, glib_nfds, glib_timeout);
+    account_wakeup(cause, timeout);
+
+    if (g_main_context_check(context, max_priority, glib_fds, glib_nfds)) {
+        // sources dispatched next to input aren't input
+        enum account_subsystem previous = account_enter(cause == ACCOUNT_INPUT ? ACCOUNT_OTHER : cause);
+        g_main_context_dispatch(context);
+        if (backend->dispatched)
+            backend->dispatched();
+        account_leave(previous);
+    }
+    account_settle();
+
+    if (ret < 0) {
+        errno = saved_errno;
+        return -1;
+    }
+
+    int ready = 0;
+    for (int i = 0; i < nfds; i++) {
+        if (fds[i].revents)
+            ready++;
+    }
+    return ready;
+}
+
+/* read() for the fds handed to loop_poll() */
+ssize_t loop_read(int fd, void *buf, size_t size) {
+    return backend->read(fd, buf, size);
+}
+
+/* before closing an fd that was handed to loop_poll(), its number may come back as a new file */
+void loop_forget(int fd) {
+    if (backend && backend->forget)
+        backend->forget(fd);
+}
+
+struct invocation {
+    int (*fn)(void *data);
+    void *data;
+    int result;
+    int done;
+    GMutex lock;
+    GCond cond;
+};
+
+static gboolean on_invoke(gpointer data) {
+    struct invocation *inv = data;
+    int result = inv->fn(inv->data);
+
+    g_mutex_lock(&inv->lock);
+    inv->result = result;
+    inv->done = 1;
+    g_cond_signal(&inv->cond);
+    g_mutex_unlock(&inv->lock);
+    return G_SOURCE_REMOVE;
+}
+
+/* runs fn on the main loop and waits for its result, for executor threads calling main thread only code */
+int loop_invoke_sync(int (*fn)(void *data), void *data) {
+    if (context == NULL || g_main_context_is_owner(context))
+        return fn(data);
+
+    struct invocation inv = { .fn = fn, .data = data };
+    g_mutex_init(&inv.lock);
+    g_cond_init(&inv.cond);
+
+    g_main_context_invoke(context, on_invoke, &inv);
+
+    g_mutex_lock(&inv.lock);
+    while (!inv.done)
+        g_cond_wait(&inv.cond, &inv.lock);
+    g_mutex_unlock(&inv.lock);
+
+    g_mutex_clear(&inv.lock);
+    g_cond_clear(&inv.cond);
+    return inv.result;
+}
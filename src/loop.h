@@ -0,0 +1,17 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#ifndef LOOP_H
+#define LOOP_H
+
+#include <poll.h>
+#include <sys/types.h>
+
+int loop_init(const char *backend);
+const char *loop_backend_name();
+int loop_poll(struct pollfd *fds, int nfds, int timeout);
+ssize_t loop_read(int fd, void *buf, size_t size);
+void loop_forget(int fd);
+int loop_invoke_sync(int (*fn)(void *data), void *data);
+
+#endif // LOOP_H
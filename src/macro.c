@@ -0,0 +1,154 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <ctype.h>
+#include <stdio.h>
+#include "macro.h"
+
+#define MAX_CHORD_MODS 8
+
+static struct wtype_command *append_command(struct macro *macro, size_t *cap) {
+    if (macro->command_count == *cap) {
+        *cap = *cap ? *cap * 2 : 8;
+        macro->commands = realloc(macro->commands, *cap * sizeof(macro->commands[0]));
+    }
+    struct wtype_command *cmd = &macro->commands[macro->command_count++];
+    memset(cmd, 0, sizeof(*cmd));
+    return cmd;
+}
+
+static int compile_chord(struct wtype *wtype, struct macro *macro, size_t *cap, char *chord) {
+    enum wtype_mod mods[MAX_CHORD_MODS];
+    size_t mod_count = 0;
+    char *key = chord;
+    char *plus;
+
+    // everything before the last '+' has to be a modifier, the rest is the key
+    while ((plus = strchr(key, '+')) != NULL) {
+        *plus = '\0';
+        enum wtype_mod mod = name_to_mod(key);
+        if (mod == WTYPE_MOD_NONE || mod_count == MAX_CHORD_MODS) {
+            fprintf(stderr, "Invalid modifier '%s'\n", key);
+            return -1;
+        }
+        mods[mod_count++] = mod;
+        key = plus + 1;
+    }
+
+    xkb_keysym_t ks = xkb_keysym_from_name(key, XKB_KEYSYM_CASE_INSENSITIVE);
+    if (ks == XKB_KEY_NoSymbol) {
+        fprintf(stderr, "Unknown key '%s'\n", key);
+        return -1;
+    }
+    unsigned int key_code = get_key_code_by_xkb(wtype, ks);
+
+    for (size_t i = 0; i < mod_count; i++) {
+        struct wtype_command *cmd = append_command(macro, cap);
+        cmd->type = WTYPE_COMMAND_MOD_PRESS;
+        cmd->mod = mods[i];
+    }
+
+    struct wtype_command *cmd = append_command(macro, cap);
+    cmd->type = WTYPE_COMMAND_KEY_PRESS;
+    cmd->single_key_code = key_code;
+    cmd = append_command(macro, cap);
+    cmd->type = WTYPE_COMMAND_KEY_RELEASE;
+    cmd->single_key_code = key_code;
+
+    for (size_t i = mod_count; i > 0; i--) {
+        cmd = append_command(macro, cap);
+        cmd->type = WTYPE_COMMAND_MOD_RELEASE;
+        cmd->mod = mods[i - 1];
+    }
+
+    return 0;
+}
+
+static void unescape(char *text) {
+    char *out = text;
+    for (char *in = text; *in; in++) {
+        if (*in != '\\' || in[1] == '\0') {
+            *out++ = *in;
+            continue;
+        }
+        switch (*++in) {
+            case 'n':
+                *out++ = '\n';
+                break;
+            case 't':
+                *out++ = '\t';
+                break;
+            case 'e':
+                *out++ = '\e';
+                break;
+            default:
+                *out++ = *in;
+        }
+    }
+    *out = '\0';
+}
+
+int macro_compile(struct wtype *wtype, struct macro *macro, const char *source) {
+    char *copy = strdup(source);
+    char *saveptr = NULL;
+    size_t cap = 0;
+    int line_no = 0;
+
+    macro->commands = NULL;
+    macro->command_count = 0;
+
+    for (char *line = strtok_r(copy, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+        line_no++;
+
+        while (isspace((unsigned char)*line))
+            line++;
+        if (*line == '\0' || *line == '#')
+            continue;
+
+        char *arg = line;
+        while (*arg && !isspace((unsigned char)*arg))
+            arg++;
+        if (*arg)
+            *arg++ = '\0';
+
+        int ret = -1;
+        if (strcmp(line, "key") == 0) {
+            char *end = arg + strlen(arg);
+            while (end > arg && isspace((unsigned char)end[-1]))
+                *--end = '\0';
+            ret = compile_chord(wtype, macro, &cap, arg);
+        } else if (strcmp(line, "text") == 0) {
+            unescape(arg);
+            ret = compile_text(wtype, append_command(macro, &cap), arg, 0);
+        } else if (strcmp(line, "sleep") == 0) {
+            char *endptr;
+            long ms = strtol(arg, &endptr, 10);
+            if (endptr != arg && ms >= 0 && ms <= MACRO_MAX_SLEEP_MS) {
+                struct wtype_command *cmd = append_command(macro, &cap);
+                cmd->type = WTYPE_COMMAND_SLEEP;
+                cmd->sleep_ms = ms;
+                ret = 0;
+            }
+        }
+
+        if (ret != 0) {
+            fprintf(stderr, "Invalid macro step '%s' on line %d\n", line, line_no);
+            macro_free(macro);
+            free(copy);
+            return -1;
+        }
+    }
+
+    free(copy);
+    return 0;
+}
+
+void macro_free(struct macro *macro) {
+    for (size_t i = 0; i < macro->command_count; i++) {
+        if (macro->commands[i].type == WTYPE_COMMAND_TEXT)
+            free(macro->commands[i].key_codes);
+    }
+    free(macro->commands);
+    macro->commands = NULL;
+    macro->command_count = 0;
+}
@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#ifndef MACRO_H
+#define MACRO_H
+
+#include <time.h>
+#include "virtkey.h"
+
+/*
+ * A macro is a small program for the virtual keyboard, one step per line:
+ *
+ *   key ctrl+alt+t    press a key with optional modifiers held down
+ *   text Hello\n      type a text snippet, \n \t \e and \\ are escapes
+ *   sleep 250         wait for the given number of milliseconds, at most MACRO_MAX_SLEEP_MS
+ *
+ * Empty lines and lines starting with # are ignored. A sleep does not block the caller,
+ * play_macro() runs the steps before it and resumes the rest from a timeout.
+ */
+#define MACRO_MAX_SLEEP_MS 10000
+
+struct macro {
+    struct wtype_command *commands;
+    size_t command_count;
+    struct timespec mtime;
+};
+
+int macro_compile(struct wtype *wtype, struct macro *macro, const char *source);
+void macro_free(struct macro *macro);
+
+#endif // MACRO_H
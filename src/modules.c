@@ -0,0 +1,254 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include "assistant-button-module.h"
+#include "modules.h"
+#include "utils.h"
+
+#define MAX_MODULES 16
+
+G_STATIC_ASSERT(AB_NOTIFY_PICTURE == NOTIFY_PICTURE);
+G_STATIC_ASSERT(AB_NOTIFY_SCREENSHOT == NOTIFY_SCREENSHOT);
+G_STATIC_ASSERT(AB_NOTIFY_VIDEO == NOTIFY_VIDEO);
+
+static struct loaded_module {
+    char name[64];
+    void *handle;
+    const struct ab_module *module;
+    guint unload_id;
+    int busy; // actions running on executor threads right now
+} modules[MAX_MODULES];
+
+// chain steps load and run modules from the action executor too
+static GMutex modules_lock;
+
+static void host_notify(int kind, const char *body) {
+    if (kind >= 0 && kind < NOTIFY_KIND_COUNT)
+        show_notification((enum notification_kind)kind, body);
+}
+
+static const struct ab_host host = {
+    .notify = host_notify,
+    .run_command = run_command,
+};
+
+static const char *module_dir() {
+    // lets modules be tried out from the build tree
+    const char *dir = getenv("ASSISTANT_BUTTON_MODULE_DIR");
+    return dir ? dir : MODULE_DIR;
+}
+
+static void module_unload(struct loaded_module *loaded) {
+    if (loaded->unload_id)
+        g_source_remove(loaded->unload_id);
+    if (loaded->module->teardown)
+        loaded->module->teardown();
+    dlclose(loaded->handle);
+    memset(loaded, 0, sizeof(*loaded));
+}
+
+static void module_touch(struct loaded_module *loaded);
+
+static gboolean on_module_idle(gpointer data) {
+    struct loaded_module *loaded = data;
+
+    g_mutex_lock(&modules_lock);
+    // an executor thread re-armed the timer while this one was being dispatched
+    if (loaded->unload_id != g_source_get_id(g_main_current_source())) {
+        g_mutex_unlock(&modules_lock);
+        return G_SOURCE_REMOVE;
+    }
+
+    loaded->unload_id = 0;
+    if (loaded->busy) {
+        module_touch(loaded);
+    } else {
+        fprintf(stderr, "Unloading idle module %s\n", loaded->name);
+        module_unload(loaded);
+    }
+    g_mutex_unlock(&modules_lock);
+    return G_SOURCE_REMOVE;
+}
+
+/* every use pushes the idle unload further out, called with modules_lock held */
+static void module_touch(struct loaded_module *loaded) {
+    if (loaded->module->flags & AB_MODULE_RESIDENT)
+        return;
+
+    if (loaded->unload_id)
+        g_source_remove(loaded->unload_id);
+    loaded->unload_id = g_timeout_add_seconds(MODULE_IDLE_UNLOAD_S, on_module_idle, loaded);
+}
+
+/* called with modules_lock held */
+static struct loaded_module *module_load(const char *name) {
+    struct loaded_module *free_slot = NULL;
+
+    if (*name == '\0' || strchr(name, '/') || strlen(name) >= sizeof(modules[0].name)) {
+        fprintf(stderr, "Invalid module name: %s\n", name);
+        return NULL;
+    }
+
+    for (int i = 0; i < MAX_MODULES; i++) {
+        if (modules[i].handle == NULL) {
+            if (free_slot == NULL)
+                free_slot = &modules[i];
+        } else if (strcmp(modules[i].name, name) == 0) {
+            return &modules[i];
+        }
+    }
+
+    if (free_slot == NULL) {
+        fprintf(stderr, "Too many modules loaded, not loading %s\n", name);
+        return NULL;
+    }
+
+    gint64 start = g_get_monotonic_time();
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s.so", module_dir(), name);
+
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        fprintf(stderr, "Failed to load module %s: %s\n", name, dlerror());
+        return NULL;
+    }
+
+    const struct ab_module *module = dlsym(handle, AB_MODULE_SYMBOL);
+    if (module == NULL || module->abi_version != AB_MODULE_ABI_VERSION) {
+        fprintf(stderr, "Module %s has no compatible %s\n", name, AB_MODULE_SYMBOL);
+        dlclose(handle);
+        return NULL;
+    }
+
+    if (module->init && module->init(&host) != 0) {
+        fprintf(stderr, "Module %s failed to initialize\n", name);
+        dlclose(handle);
+        return NULL;
+    }
+
+    strcpy(free_slot->name, name);
+    free_slot->handle = handle;
+    free_slot->module = module;
+    fprintf(stderr, "Loaded module %s in %.1f ms\n", name, (g_get_monotonic_time() - start) / 1000.0);
+    return free_slot;
+}
+
+/* finds an action and marks its module busy, pair with module_release() */
+static const struct ab_action *module_acquire(const char *name, const char *action, struct loaded_module **out) {
+    const struct ab_action *found = NULL;
+
+    g_mutex_lock(&modules_lock);
+    struct loaded_module *loaded = module_load(name);
+    if (loaded == NULL) {
+        g_mutex_unlock(&modules_lock);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < loaded->module->action_count; i++) {
+        if (strcmp(loaded->module->actions[i].name, action) == 0) {
+            found = &loaded->module->actions[i];
+            break;
+        }
+    }
+
+    module_touch(loaded);
+    if (found)
+        loaded->busy++;
+    g_mutex_unlock(&modules_lock);
+
+    if (found == NULL)
+        fprintf(stderr, "Module %s has no action %s\n", name, action);
+    *out = loaded;
+    return found;
+}
+
+static void module_release(struct loaded_module *loaded) {
+    g_mutex_lock(&modules_lock);
+    loaded->busy--;
+    g_mutex_unlock(&modules_lock);
+}
+
+int module_execute(const char *name, const char *action, const char *argument) {
+    struct loaded_module *loaded;
+    const struct ab_action *found = module_acquire(name, action, &loaded);
+    if (found == NULL)
+        return -1;
+
+    // not under the lock, another step may run an action of the same module meanwhile
+    int ret = found->execute(argument);
+    module_release(loaded);
+    return ret;
+}
+
+int module_prewarm(const char *name) {
+    g_mutex_lock(&modules_lock);
+    struct loaded_module *loaded = module_load(name);
+    if (loaded)
+        loaded->busy++;
+    g_mutex_unlock(&modules_lock);
+
+    if (loaded == NULL)
+        return -1;
+
+    if (loaded->module->prewarm)
+        loaded->module->prewarm();
+
+    g_mutex_lock(&modules_lock);
+    loaded->busy--;
+    module_touch(loaded);
+    g_mutex_unlock(&modules_lock);
+    return 0;
+}
+
+/* splits a "module:action [argument]" binding, returns 0 on success */
+int module_parse_binding(const char *binding, struct module_call *call) {
+    int consumed = 0;
+
+    if (sscanf(binding, " %63[^:/ \t\n]:%63s%n", call->name, call->action, &consumed) != 2) {
+        fprintf(stderr, "Invalid module binding: %s\n", binding);
+        return -1;
+    }
+
+    // whatever follows the action, minus surrounding whitespace, is its argument
+    gchar *argument = g_strstrip(g_strdup(binding + consumed));
+    g_strlcpy(call->argument, argument, sizeof(call->argument));
+    g_free(argument);
+    return 0;
+}
+
+/* runs a "module:action [argument]" binding */
+int module_run_binding(const char *binding) {
+    struct module_call call;
+
+    if (module_parse_binding(binding, &call) != 0)
+        return -1;
+    return module_execute(call.name, call.action, *call.argument ? call.argument : NULL);
+}
+
+enum speculation module_speculation(const struct module_call *call) {
+    struct loaded_module *loaded;
+    const struct ab_action *found = module_acquire(call->name, call->action, &loaded);
+    if (found == NULL)
+        return SPECULATE_NEVER;
+
+    enum speculation speculation = SPECULATE_NEVER;
+    if (found->flags & AB_ACTION_SPECULATIVE)
+        speculation = found->undo ? SPECULATE_UNDO : SPECULATE_ABSORB;
+    module_release(loaded);
+    return speculation;
+}
+
+int module_undo(const struct module_call *call) {
+    struct loaded_module *loaded;
+    const struct ab_action *found = module_acquire(call->name, call->action, &loaded);
+    if (found == NULL)
+        return -1;
+
+    int ret = found->undo ? found->undo(*call->argument ? call->argument : NULL) : 0;
+    module_release(loaded);
+    return ret;
+}
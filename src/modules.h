@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#ifndef MODULES_H
+#define MODULES_H
+
+#define MODULE_DIR "/usr/lib/assistant-button/modules"
+#define MODULE_IDLE_UNLOAD_S 300
+
+/* how a binding may run before its gesture is certain */
+enum speculation {
+    SPECULATE_NEVER,
+    SPECULATE_ABSORB, // a wrong guess is left standing
+    SPECULATE_UNDO,   // a wrong guess is reverted
+};
+
+/* a parsed "module:action [argument]" binding */
+struct module_call {
+    char name[64];
+    char action[64];
+    char argument[256];
+};
+
+int module_execute(const char *name, const char *action, const char *argument);
+int module_prewarm(const char *name);
+int module_parse_binding(const char *binding, struct module_call *call);
+int module_run_binding(const char *binding);
+enum speculation module_speculation(const struct module_call *call);
+int module_undo(const struct module_call *call);
+
+#endif // MODULES_H
@@ -0,0 +1,322 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+/*
+ * assistant-button-reader, the system side of split mode. Reads the
+ * device, debounces and classifies presses like the daemon does, and
+ * streams them to the agents. Has no bindings of its own, it waits for
+ * long and double presses whenever any connected agent binds them.
+ *
+ *   assistant-button-reader [device [socket]]
+ *
+ * The package ships its unit disabled, it is enabled together with
+ * SPLIT_MODE=1 in the config, the daemons still read the device otherwise.
+ */
+
+#define _GNU_SOURCE
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "flightrec.h"
+#include "input.h"
+#include "reader.h"
+#include "wakelock.h"
+
+struct agent {
+    int fd;
+    uid_t uid;
+    int bound;
+    int pending; // gestures sent and not dispatched yet
+};
+
+static struct {
+    int listen_fd;
+    struct input_config config;
+    struct input input;
+    struct agent agents[READER_MAX_AGENTS];
+    int agent_count;
+} reader;
+
+static volatile sig_atomic_t dump_requested;
+static volatile sig_atomic_t stop_requested;
+
+static long long now_us() {
+    struct timespec spec;
+    clock_gettime(CLOCK_BOOTTIME, &spec);
+    return spec.tv_sec * 1000000LL + spec.tv_nsec / 1000;
+}
+
+static void drop_agent(int i) {
+    close(reader.agents[i].fd);
+    reader.agents[i] = reader.agents[--reader.agent_count];
+}
+
+/* the gestures the classifier has to wait for, any agent binding one is enough */
+static int bound_gestures(void *data) {
+    int bound = 0;
+
+    for (int i = 0; i < reader.agent_count; i++)
+        bound |= reader.agents[i].bound;
+    return bound;
+}
+
+static int send_message(int fd, int kind, int event, int code) {
+    struct reader_message message = {
+        .kind = kind,
+        .event = event,
+        .code = code,
+        .short_press_max = reader.input.gesture.short_press_max,
+        .double_press_max = reader.input.gesture.double_press_max,
+        .time_us = now_us(),
+        .origin_us = reader.input.origin_us,
+        .press_time = reader.input.gesture.press_time,
+        .last_duration = reader.input.gesture.last_duration,
+        .last_interval = reader.input.gesture.last_interval,
+    };
+
+    return send(fd, &message, sizeof(message), MSG_DONTWAIT | MSG_NOSIGNAL) == sizeof(message) ? 0 : -1;
+}
+
+/* any agent still running a gesture keeps the phone awake */
+static int gestures_pending() {
+    for (int i = 0; i < reader.agent_count; i++) {
+        if (reader.agents[i].pending)
+            return 1;
+    }
+    return 0;
+}
+
+/* an agent too far behind to take another packet loses it rather than holding up the rest */
+static void broadcast(int kind, int event) {
+    for (int i = reader.agent_count - 1; i >= 0; i--) {
+        if (send_message(reader.agents[i].fd, kind, event, 0) == 0) {
+            if (kind == READER_GESTURE)
+                reader.agents[i].pending++;
+            continue;
+        }
+        if (errno == EAGAIN) {
+            flightrec_record(FR_ERROR, EAGAIN, kind, event);
+            continue;
+        }
+        drop_agent(i);
+    }
+}
+
+static void on_input(void *data, enum input_kind kind, int event) {
+    switch (kind) {
+        case INPUT_PRESS:
+            broadcast(READER_PRESS, 0);
+            break;
+        case INPUT_SPECULATE:
+            broadcast(READER_SPECULATE, 0);
+            break;
+        case INPUT_GESTURE:
+            flightrec_record(FR_GESTURE, event, now_us() / 1000 - reader.input.gesture.press_time, 0);
+            broadcast(READER_GESTURE, event);
+            break;
+    }
+}
+
+static const struct input_ops input_ops = {
+    .read = read,
+    .bound = bound_gestures,
+    .emit = on_input,
+};
+
+/* logind keeps a record for every user with a session, online or in front of the phone */
+static int session_user(uid_t uid) {
+    char path[64];
+    char line[64];
+    int found = 0;
+
+    snprintf(path, sizeof(path), READER_USERS_DIR "/%u", (unsigned int)uid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return 0;
+
+    while (!found && fgets(line, sizeof(line), file))
+        found = strcmp(line, "STATE=active\n") == 0 || strcmp(line, "STATE=online\n") == 0;
+    fclose(file);
+    return found;
+}
+
+/* anyone else could hold up every press by claiming to bind everything, or just watch them */
+static int allowed(uid_t uid) {
+    int count = 0;
+
+    if (uid != 0 && !session_user(uid))
+        return 0;
+
+    for (int i = 0; i < reader.agent_count; i++)
+        count += reader.agents[i].uid == uid;
+    return count < READER_MAX_AGENTS_PER_UID;
+}
+
+static void accept_agent() {
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    int fd = accept4(reader.listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1)
+        return;
+
+    if (reader.agent_count == READER_MAX_AGENTS) {
+        fprintf(stderr, "Too many agents, turning one away\n");
+        close(fd);
+        return;
+    }
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) {
+        close(fd);
+        return;
+    }
+
+    if (!allowed(cred.uid)) {
+        fprintf(stderr, "Turning away an agent of uid %u\n", (unsigned int)cred.uid);
+        close(fd);
+        return;
+    }
+
+    if (send_message(fd, READER_HELLO, 0, READER_PROTOCOL_VERSION) != 0) {
+        close(fd);
+        return;
+    }
+    reader.agents[reader.agent_count++] = (struct agent){ .fd = fd, .uid = cred.uid };
+}
+
+/* agents only say what they bind and when they're done with a gesture, a closed one goes away */
+static void read_agent(int i) {
+    struct reader_message message;
+    ssize_t len;
+
+    while ((len = recv(reader.agents[i].fd, &message, sizeof(message), MSG_DONTWAIT)) == sizeof(message)) {
+        if (message.kind == READER_BOUND)
+            reader.agents[i].bound = message.code;
+        else if (message.kind == READER_DONE && reader.agents[i].pending > 0)
+            reader.agents[i].pending--;
+    }
+
+    if (len == 0 || (len < 0 && errno != EAGAIN))
+        drop_agent(i);
+}
+
+static int listen_socket() {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    strncpy(addr.sun_path, reader.config.reader_socket, sizeof(addr.sun_path) - 1);
+    reader.listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (reader.listen_fd == -1) {
+        perror("Failed to create the reader socket");
+        return -1;
+    }
+
+    // left behind by a reader that didn't get to clean up
+    unlink(addr.sun_path);
+    if (bind(reader.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(reader.listen_fd, READER_MAX_AGENTS) != 0) {
+        perror("Failed to listen on the reader socket");
+        close(reader.listen_fd);
+        return -1;
+    }
+
+    // agents run as whichever user is logged in, accept_agent() checks who they are
+    chmod(addr.sun_path, 0666);
+    return 0;
+}
+
+static void on_signal(int sig) {
+    if (sig == SIGUSR1)
+        dump_requested = 1;
+    else
+        stop_requested = 1;
+}
+
+int main(int argc, char *argv[]) {
+    struct pollfd fds[2 + READER_MAX_AGENTS];
+
+    input_read_config(&reader.config, NULL, NULL);
+
+    if (argc > 1) {
+        strncpy(reader.config.device, argv[1], sizeof(reader.config.device) - 1);
+        reader.config.device[sizeof(reader.config.device) - 1] = '\0';
+    }
+
+    if (argc > 2) {
+        strncpy(reader.config.reader_socket, argv[2], sizeof(reader.config.reader_socket) - 1);
+        reader.config.reader_socket[sizeof(reader.config.reader_socket) - 1] = '\0';
+    }
+
+    input_init(&reader.input, &reader.config, &input_ops, NULL);
+    if (input_open(&reader.input, reader.config.device) != 0)
+        return EXIT_FAILURE;
+
+    if (listen_socket() != 0)
+        return EXIT_FAILURE;
+
+    if (reader.config.wakelock)
+        wakelock_init();
+
+    struct sigaction action = { .sa_handler = on_signal };
+    sigaction(SIGUSR1, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+
+    fprintf(stderr, "Reading %s for agents on %s\n", reader.config.device, reader.config.reader_socket);
+
+    while (!stop_requested) {
+        int timeout = input_timeout(&reader.input, now_us());
+
+        fds[0] = (struct pollfd){ .fd = reader.input.fd, .events = POLLIN };
+        fds[1] = (struct pollfd){ .fd = reader.listen_fd, .events = POLLIN };
+        int agent_count = reader.agent_count;
+        for (int i = 0; i < agent_count; i++)
+            fds[2 + i] = (struct pollfd){ .fd = reader.agents[i].fd, .events = POLLIN };
+
+        int ret = poll(fds, 2 + agent_count, timeout);
+        if (ret < 0) {
+            if (errno != EINTR)
+                break;
+        } else if (ret == 0) {
+            input_expire(&reader.input, now_us());
+        } else {
+            // backwards, dropping an agent moves the last one into its slot
+            for (int i = agent_count - 1; i >= 0; i--) {
+                if (fds[2 + i].revents)
+                    read_agent(i);
+            }
+            if (fds[1].revents)
+                accept_agent();
+            if (fds[0].revents && input_read(&reader.input) != 0) {
+                flightrec_record(FR_ERROR, errno, 0, 0);
+                perror("Failed to read the event");
+                break;
+            }
+        }
+
+        // held until every agent dispatched what it was sent, nothing keeps the phone awake for them otherwise
+        if (!gestures_pending()) {
+            unsigned int epoch = input_idle(&reader.input);
+            if (epoch)
+                wakelock_release(epoch);
+        }
+
+        if (dump_requested) {
+            dump_requested = 0;
+            const char *path = flightrec_default_path();
+            if (flightrec_dump(path) == 0)
+                fprintf(stderr, "Flight recorder dumped to %s\n", path);
+        }
+    }
+
+    wakelock_release(0);
+    unlink(reader.config.reader_socket);
+    return stop_requested ? EXIT_SUCCESS : EXIT_FAILURE;
+}
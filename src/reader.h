@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#ifndef READER_H
+#define READER_H
+
+#include <stdint.h>
+
+#define READER_DEFAULT_SOCKET "/run/assistant-button/reader.sock"
+#define READER_PROTOCOL_VERSION 2
+#define READER_MAX_AGENTS 16
+// an agent restarting can overlap with the one it replaces, more than that from one user is someone else
+#define READER_MAX_AGENTS_PER_UID 2
+#define READER_USERS_DIR "/run/systemd/users"
+
+/*
+ * Split mode: assistant-button-reader runs once for the whole system, owns
+ * the evdev device and classifies presses, and streams the results to
+ * every connected agent over a SOCK_SEQPACKET unix socket, one message
+ * per packet. The agents are the per-session daemons with SPLIT_MODE=1,
+ * they run the bindings of whoever is in front of the phone. Only root
+ * and users logind has a session for get to connect.
+ */
+enum reader_message_kind {
+    READER_HELLO,     // reader to agent once connected, code is READER_PROTOCOL_VERSION
+    READER_PRESS,     // reader to agent, the key went down
+    READER_SPECULATE, // reader to agent, a short press is waiting for the double press window
+    READER_GESTURE,   // reader to agent, event completed, origin_us is the edge or deadline that completed it
+    READER_BOUND,     // agent to reader, code is the GESTURE_BOUND_* flags of its bindings, 0 in the background
+    READER_DONE,      // agent to reader, a gesture was dispatched, the reader holds its wakelock until then
+};
+
+/* times are on CLOCK_BOOTTIME, the same clock on both ends */
+struct reader_message {
+    int32_t kind;
+    int32_t event;
+    int32_t code;
+    int32_t short_press_max;  // the reader's limits in ms, on every message from it
+    int32_t double_press_max;
+    int32_t reserved;
+    int64_t time_us;          // when the reader sent it
+    int64_t origin_us;
+    int64_t press_time;       // ms, like the fields below they're copied from the reader's gesture
+    int64_t last_duration;
+    int64_t last_interval;
+};
+
+#endif // READER_H
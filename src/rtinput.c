@@ -0,0 +1,203 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include "accounting.h"
+#include "flightrec.h"
+#include "rtinput.h"
+#include "stats.h"
+
+/* everything the input thread touches, locked into memory as one block */
+static struct {
+    _Atomic unsigned int head; // only the input thread writes it
+    _Atomic unsigned int tail; // only the main loop writes it
+    struct rtinput_item items[RTINPUT_QUEUE_SIZE];
+
+    // published by the main loop, whenever it looked at the bindings or adapted the thresholds
+    _Atomic int bound;
+    _Atomic int short_press_max;
+    _Atomic int double_press_max;
+
+    int wakeup_fd;
+    int speculative;
+    struct input input;
+} rt;
+
+/* CLOCK_BOOTTIME like the main loop, a suspend mid press still counts towards its timing */
+static long long now_us() {
+    struct timespec spec;
+    clock_gettime(CLOCK_BOOTTIME, &spec);
+    return spec.tv_sec * 1000000LL + spec.tv_nsec / 1000;
+}
+
+/* producer side, a full queue drops the item rather than making the input thread wait */
+static void push(int kind, int event, int code) {
+    unsigned int head = atomic_load_explicit(&rt.head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&rt.tail, memory_order_acquire);
+
+    if (head - tail == RTINPUT_QUEUE_SIZE) {
+        stats_add(STAT_RTINPUT_DROPPED, 1);
+        return;
+    }
+
+    struct rtinput_item *item = &rt.items[head & (RTINPUT_QUEUE_SIZE - 1)];
+    item->kind = kind;
+    item->event = event;
+    item->code = code;
+    item->time_us = now_us();
+    item->origin_us = rt.input.origin_us;
+    item->press_time = rt.input.gesture.press_time;
+    item->last_duration = rt.input.gesture.last_duration;
+    item->last_interval = rt.input.gesture.last_interval;
+    atomic_store_explicit(&rt.head, head + 1, memory_order_release);
+
+    uint64_t one = 1;
+    if (write(rt.wakeup_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        flightrec_record(FR_ERROR, errno, 0, 0);
+}
+
+/* consumer side, returns 1 when an item was taken */
+int rtinput_pop(struct rtinput_item *item) {
+    unsigned int tail = atomic_load_explicit(&rt.tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&rt.head, memory_order_acquire);
+
+    if (tail == head)
+        return 0;
+
+    *item = rt.items[tail & (RTINPUT_QUEUE_SIZE - 1)];
+    atomic_store_explicit(&rt.tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+void rtinput_publish(int bound, int short_press_max, int double_press_max) {
+    atomic_store_explicit(&rt.bound, bound, memory_order_relaxed);
+    atomic_store_explicit(&rt.short_press_max, short_press_max, memory_order_relaxed);
+    atomic_store_explicit(&rt.double_press_max, double_press_max, memory_order_relaxed);
+}
+
+static int bound(void *data) {
+    return atomic_load_explicit(&rt.bound, memory_order_relaxed);
+}
+
+static void on_input(void *data, enum input_kind kind, int event) {
+    switch (kind) {
+        case INPUT_PRESS:
+            push(RTINPUT_PRESS, 0, 0);
+            break;
+        case INPUT_SPECULATE:
+            if (rt.speculative)
+                push(RTINPUT_SPECULATE, 0, 0);
+            break;
+        case INPUT_GESTURE:
+            push(RTINPUT_GESTURE, event, 0);
+            break;
+    }
+}
+
+static const struct input_ops input_ops = {
+    .read = read,
+    .bound = bound,
+    .emit = on_input,
+};
+
+static void *input_thread(void *data) {
+    struct pollfd pfd = { .fd = rt.input.fd, .events = POLLIN };
+
+    while (1) {
+        rt.input.gesture.short_press_max = atomic_load_explicit(&rt.short_press_max, memory_order_relaxed);
+        rt.input.gesture.double_press_max = atomic_load_explicit(&rt.double_press_max, memory_order_relaxed);
+
+        int ret = poll(&pfd, 1, input_timeout(&rt.input, now_us()));
+        if (ret > 0) {
+            if (input_read(&rt.input) != 0)
+                break;
+        } else if (ret == 0) {
+            input_expire(&rt.input, now_us());
+        } else if (errno != EINTR) {
+            break;
+        }
+
+        // the main loop lets go of the wakelock once it dispatched everything queued before this
+        unsigned int epoch = input_idle(&rt.input);
+        if (epoch)
+            push(RTINPUT_IDLE, 0, epoch);
+        stats_set(STAT_CPU_US_RTINPUT, account_thread_cpu_us());
+    }
+
+    flightrec_record(FR_ERROR, errno, 0, 0);
+    push(RTINPUT_ERROR, 0, errno);
+    return NULL;
+}
+
+/* starts the input thread on an opened input stage, returns the eventfd to poll for queued items */
+int rtinput_start(const struct input *input, int bound, int speculative, int priority) {
+    pthread_attr_t attr;
+    pthread_t thread;
+    int ret;
+
+    // a page fault in the middle of a press costs more than the memory, so nothing it uses can be paged out
+    if (mlock(&rt, sizeof(rt)) != 0)
+        perror("Failed to lock the input thread state");
+
+    // the thread's own copy, classified with what the main loop publishes
+    rt.input = *input;
+    rt.input.ops = &input_ops;
+    rt.input.data = NULL;
+    rt.speculative = speculative;
+    rtinput_publish(bound, input->gesture.short_press_max, input->gesture.double_press_max);
+
+    rt.wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (rt.wakeup_fd == -1) {
+        perror("Failed to create the input eventfd");
+        return -1;
+    }
+
+    void *stack = mmap(NULL, RTINPUT_STACK_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) {
+        perror("Failed to map the input thread stack");
+        close(rt.wakeup_fd);
+        return -1;
+    }
+    if (mlock(stack, RTINPUT_STACK_SIZE) != 0)
+        perror("Failed to lock the input thread stack");
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, stack, RTINPUT_STACK_SIZE);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    struct sched_param param = { .sched_priority = priority };
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+
+    ret = pthread_create(&thread, &attr, input_thread, NULL);
+    if (ret == EPERM) {
+        // no CAP_SYS_NICE or RLIMIT_RTPRIO, a thread of its own still beats sharing the main loop
+        fprintf(stderr, "Not allowed to use SCHED_FIFO, running the input thread at normal priority\n");
+        pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+        ret = pthread_create(&thread, &attr, input_thread, NULL);
+    } else if (ret == 0) {
+        stats_set(STAT_RTINPUT_PRIORITY, priority);
+    }
+    pthread_attr_destroy(&attr);
+
+    if (ret != 0) {
+        fprintf(stderr, "Failed to start the input thread: %s\n", strerror(ret));
+        munmap(stack, RTINPUT_STACK_SIZE);
+        close(rt.wakeup_fd);
+        return -1;
+    }
+
+    return rt.wakeup_fd;
+}
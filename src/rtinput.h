@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#ifndef RTINPUT_H
+#define RTINPUT_H
+
+#include "input.h"
+
+#define RTINPUT_QUEUE_SIZE 64 // items, must be a power of two
+#define RTINPUT_STACK_SIZE (128 * 1024)
+#define RTINPUT_DEFAULT_PRIORITY 10
+
+/*
+ * Optional low latency input: a SCHED_FIFO thread with locked memory runs
+ * the input stage on the evdev device and hands the results to the main
+ * loop through a wait-free single producer, single consumer queue. An
+ * eventfd wakes the main loop up whenever something was queued.
+ */
+enum rtinput_kind {
+    RTINPUT_PRESS,     // the key went down, press_time is when
+    RTINPUT_SPECULATE, // a short press is waiting for the double press window
+    RTINPUT_GESTURE,   // event completed, origin_us is the edge or deadline that completed it
+    RTINPUT_ERROR,     // the device can't be read anymore, code is errno
+    RTINPUT_IDLE,      // nothing pending anymore, code is the wakelock epoch to release
+};
+
+struct rtinput_item {
+    int kind;
+    int event;
+    int code;
+    long long time_us;    // when the input thread queued it
+    long long origin_us;
+    long long press_time; // ms, like the fields below they're copied from the thread's gesture
+    long last_duration;
+    long last_interval;
+};
+
+int rtinput_start(const struct input *input, int bound, int speculative, int priority);
+int rtinput_pop(struct rtinput_item *item);
+void rtinput_publish(int bound, int short_press_max, int double_press_max);
+
+#endif // RTINPUT_H
@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <stdatomic.h>
+#include "stats.h"
+
+static const char *const stat_names[STAT_COUNT] = {
+    [STAT_KEY_EDGES] = "key_edges",
+    [STAT_FILTERED_EDGES] = "filtered_edges",
+    [STAT_LATE_EDGES] = "late_edges",
+    [STAT_CHATTER_EPISODES] = "chatter_episodes",
+    [STAT_DEBOUNCE_WINDOW_US] = "debounce_window_us",
+    [STAT_SHORT_PRESSES] = "short_presses",
+    [STAT_LONG_PRESSES] = "long_presses",
+    [STAT_DOUBLE_PRESSES] = "double_presses",
+    [STAT_SHORT_PRESS_MAX_MS] = "short_press_max_ms",
+    [STAT_DOUBLE_PRESS_MAX_MS] = "double_press_max_ms",
+    [STAT_SPECULATIVE_RUNS] = "speculative_runs",
+    [STAT_SPECULATIVE_UNDONE] = "speculative_undone",
+    [STAT_SPECULATIVE_ABSORBED] = "speculative_absorbed",
+    [STAT_INPUT_LAG_US_MAX] = "input_lag_us_max",
+    [STAT_GESTURE_LAG_US_TOTAL] = "gesture_lag_us_total",
+    [STAT_GESTURE_LAG_US_MAX] = "gesture_lag_us_max",
+    [STAT_REALTIME_INPUT] = "realtime_input",
+    [STAT_RTINPUT_PRIORITY] = "rtinput_priority",
+    [STAT_RTINPUT_DROPPED] = "rtinput_dropped",
+    [STAT_LOOP_WAKEUPS] = "loop_wakeups",
+    [STAT_LOOP_SYSCALLS] = "loop_syscalls",
+    [STAT_WAKELOCK_HOLDS] = "wakelock_holds",
+    [STAT_WAKELOCK_HELD_US_TOTAL] = "wakelock_held_us_total",
+    [STAT_WAKELOCK_HELD_US_MAX] = "wakelock_held_us_max",
+    [STAT_WAKEUPS_INPUT] = "wakeups_input",
+    [STAT_WAKEUPS_TIMER] = "wakeups_timer",
+    [STAT_WAKEUPS_DBUS] = "wakeups_dbus",
+    [STAT_WAKEUPS_CHILD] = "wakeups_child",
+    [STAT_WAKEUPS_OTHER] = "wakeups_other",
+    [STAT_CPU_US_LOOP] = "cpu_us_loop",
+    [STAT_CPU_US_INPUT] = "cpu_us_input",
+    [STAT_CPU_US_TIMER] = "cpu_us_timer",
+    [STAT_CPU_US_DBUS] = "cpu_us_dbus",
+    [STAT_CPU_US_CHILD] = "cpu_us_child",
+    [STAT_CPU_US_OTHER] = "cpu_us_other",
+    [STAT_CPU_US_RTINPUT] = "cpu_us_rtinput",
+    [STAT_BUSY_LOOPS] = "busy_loops",
+    [STAT_BUSY_LOOP_WAKEUPS_MAX] = "busy_loop_wakeups_max",
+};
+
+static _Atomic uint64_t counters[STAT_COUNT];
+static const char *device = "";
+
+void stats_add(enum stat_counter counter, uint64_t value) {
+    atomic_fetch_add_explicit(&counters[counter], value, memory_order_relaxed);
+}
+
+/* for gauges rather than counters */
+void stats_set(enum stat_counter counter, uint64_t value) {
+    atomic_store_explicit(&counters[counter], value, memory_order_relaxed);
+}
+
+/* for high water marks */
+void stats_max(enum stat_counter counter, uint64_t value) {
+    uint64_t current = atomic_load_explicit(&counters[counter], memory_order_relaxed);
+
+    while (value > current &&
+           !atomic_compare_exchange_weak_explicit(&counters[counter], &current, value,
+                                                  memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+uint64_t stats_get(enum stat_counter counter) {
+    return atomic_load_explicit(&counters[counter], memory_order_relaxed);
+}
+
+const char *stats_name(enum stat_counter counter) {
+    return stat_names[counter];
+}
+
+void stats_set_device(const char *name) {
+    device = name;
+}
+
+const char *stats_device() {
+    return device;
+}
@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/* counters exported through the GetStats D-Bus method, any thread may update them */
+enum stat_counter {
+    STAT_KEY_EDGES,
+    STAT_FILTERED_EDGES,
+    STAT_LATE_EDGES,
+    STAT_CHATTER_EPISODES,
+    STAT_DEBOUNCE_WINDOW_US,
+    STAT_SHORT_PRESSES,
+    STAT_LONG_PRESSES,
+    STAT_DOUBLE_PRESSES,
+    STAT_SHORT_PRESS_MAX_MS,
+    STAT_DOUBLE_PRESS_MAX_MS,
+    STAT_SPECULATIVE_RUNS,
+    STAT_SPECULATIVE_UNDONE,
+    STAT_SPECULATIVE_ABSORBED,
+    STAT_INPUT_LAG_US_MAX,
+    STAT_GESTURE_LAG_US_TOTAL,
+    STAT_GESTURE_LAG_US_MAX,
+    STAT_REALTIME_INPUT,
+    STAT_RTINPUT_PRIORITY,
+    STAT_RTINPUT_DROPPED,
+    STAT_LOOP_WAKEUPS,
+    STAT_LOOP_SYSCALLS,
+    STAT_WAKELOCK_HOLDS,
+    STAT_WAKELOCK_HELD_US_TOTAL,
+    STAT_WAKELOCK_HELD_US_MAX,
+    STAT_WAKEUPS_INPUT,
+    STAT_WAKEUPS_TIMER,
+    STAT_WAKEUPS_DBUS,
+    STAT_WAKEUPS_CHILD,
+    STAT_WAKEUPS_OTHER,
+    STAT_CPU_US_LOOP,
+    STAT_CPU_US_INPUT,
+    STAT_CPU_US_TIMER,
+    STAT_CPU_US_DBUS,
+    STAT_CPU_US_CHILD,
+    STAT_CPU_US_OTHER,
+    STAT_CPU_US_RTINPUT,
+    STAT_BUSY_LOOPS,
+    STAT_BUSY_LOOP_WAKEUPS_MAX,
+    STAT_COUNT
+};
+
+void stats_add(enum stat_counter counter, uint64_t value);
+void stats_set(enum stat_counter counter, uint64_t value);
+void stats_max(enum stat_counter counter, uint64_t value);
+uint64_t stats_get(enum stat_counter counter);
+const char *stats_name(enum stat_counter counter);
+void stats_set_device(const char *device);
+const char *stats_device();
+
+#endif // STATS_H
@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <time.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "assistant-button-status.h"
+#include "statuspage.h"
+#include "stats.h"
+
+_Static_assert(STAT_COUNT <= AB_STATUS_MAX_COUNTERS, "the status page needs room for every counter");
+
+static struct ab_status_page *page;
+
+static uint64_t now_ns(clockid_t clock) {
+    struct timespec spec;
+    clock_gettime(clock, &spec);
+    return spec.tv_sec * 1000000000ULL + spec.tv_nsec;
+}
+
+static void copy_string(char *dest, size_t size, const char *src) {
+    strncpy(dest, src ? src : "", size - 1);
+    dest[size - 1] = '\0';
+}
+
+/* the next seq is odd, readers retry until status_page_end() makes it even again */
+void status_page_begin() {
+    if (page == NULL)
+        return;
+
+    _Atomic uint32_t *seq = (_Atomic uint32_t *)&page->seq;
+    atomic_store_explicit(seq, atomic_load_explicit(seq, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+void status_page_end() {
+    if (page == NULL)
+        return;
+
+    for (int i = 0; i < STAT_COUNT; i++)
+        page->counters[i] = stats_get(i);
+    page->updated_ns = now_ns(CLOCK_MONOTONIC);
+
+    _Atomic uint32_t *seq = (_Atomic uint32_t *)&page->seq;
+    atomic_store_explicit(seq, atomic_load_explicit(seq, memory_order_relaxed) + 1, memory_order_release);
+}
+
+void status_page_set_gesture(int event, int action) {
+    if (page == NULL)
+        return;
+
+    page->last_event = event;
+    page->last_action = action;
+    page->last_event_ns = now_ns(CLOCK_MONOTONIC);
+    page->last_event_realtime_ns = now_ns(CLOCK_REALTIME);
+}
+
+void status_page_set_binding(int event, const char *kind, const char *value) {
+    if (page == NULL || event < AB_STATUS_SHORT_PRESS || event > AB_STATUS_DOUBLE_PRESS)
+        return;
+
+    copy_string(page->bindings[event].kind, sizeof(page->bindings[event].kind), kind);
+    copy_string(page->bindings[event].value, sizeof(page->bindings[event].value), value);
+}
+
+int status_page_init() {
+    char path[512];
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+
+    if (runtime_dir)
+        snprintf(path, sizeof(path), "%s/%s", runtime_dir, AB_STATUS_FILE);
+    else
+        snprintf(path, sizeof(path), "/run/user/%u/%s", getuid(), AB_STATUS_FILE);
+
+    // reused as is across restarts, so readers holding a mapping of it keep seeing updates
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror("Failed to open the status page");
+        return -1;
+    }
+
+    struct stat st;
+    size_t size = (sizeof(struct ab_status_page) + 4095) & ~(size_t)4095;
+    if (fstat(fd, &st) != 0 || ((size_t)st.st_size < size && ftruncate(fd, size) != 0)) {
+        perror("Failed to size the status page");
+        close(fd);
+        return -1;
+    }
+
+    struct ab_status_page *mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        perror("Failed to map the status page");
+        return -1;
+    }
+
+    page = mapped;
+    // a writer that died mid-update left seq odd already
+    if ((page->seq & 1) == 0)
+        status_page_begin();
+    // everything after seq, which has to stay odd meanwhile
+    memset(&page->pid, 0, sizeof(*page) - offsetof(struct ab_status_page, pid));
+    memcpy(page->magic, AB_STATUS_MAGIC, sizeof(page->magic));
+    page->version = AB_STATUS_VERSION;
+    page->size = sizeof(*page);
+    page->pid = getpid();
+    page->counter_count = STAT_COUNT;
+    for (int i = 0; i < STAT_COUNT; i++)
+        copy_string(page->counter_names[i], sizeof(page->counter_names[i]), stats_name(i));
+    status_page_end();
+    return 0;
+}
@@ -0,0 +1,14 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#ifndef STATUSPAGE_H
+#define STATUSPAGE_H
+
+/* the writer side of assistant-button-status.h, main loop only and a no-op until status_page_init() worked */
+int status_page_init();
+void status_page_begin();
+void status_page_set_gesture(int event, int action);
+void status_page_set_binding(int event, const char *kind, const char *value);
+void status_page_end();
+
+#endif // STATUSPAGE_H
@@ -1,46 +1,220 @@
 // SPDX-License-Identifier: GPL-2.0-only
 // Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
 
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <gio/gio.h>
+#include "accounting.h"
 #include "utils.h"
 
+static void on_child_exit(GPid pid, gint status, gpointer data) {
+    enum account_subsystem previous = account_enter(ACCOUNT_CHILD);
+
+    g_spawn_close_pid(pid);
+    account_leave(previous);
+}
+
+/* nothing waits for the commands, the main loop still reaps them so they don't linger as zombies */
+static void reap(pid_t pid) {
+    if (pid > 0)
+        g_child_watch_add(pid, on_child_exit, NULL);
+}
+
 void run_command(const char *command) {
     pid_t pid = fork();
     if (pid == 0) {
         execl("/bin/sh", "sh", "-c", command, NULL);
         _exit(127);
     }
+    reap(pid);
+}
+
+/* a command split up front, spares starting a shell for it */
+void run_argv(char *const argv[]) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    reap(pid);
 }
 
-void show_notification(const char *summary, const char *body) {
-    GDBusConnection *connection;
+/* sd_notify(3) without pulling in libsystemd, does nothing when systemd didn't start us */
+int notify_systemd(const char *state) {
+    const char *socket_path = getenv("NOTIFY_SOCKET");
+    if (socket_path == NULL || (socket_path[0] != '/' && socket_path[0] != '@'))
+        return 0;
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    size_t len = strlen(socket_path);
+    if (len >= sizeof(addr.sun_path))
+        return -1;
+
+    memcpy(addr.sun_path, socket_path, len);
+    // a leading @ is an abstract socket
+    if (addr.sun_path[0] == '@')
+        addr.sun_path[0] = '\0';
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    ssize_t ret = sendto(fd, state, strlen(state), MSG_NOSIGNAL,
+                         (struct sockaddr *)&addr, offsetof(struct sockaddr_un, sun_path) + len);
+    close(fd);
+    return ret < 0 ? -1 : 0;
+}
+
+#define NOTIFY_MIN_INTERVAL_MS 500 // at most one Notify per kind this often
+#define NOTIFY_COALESCE_MS 10000   // events closer than this are counted into one notification
+
+static const struct {
+    const char *summary;
+    const char *summary_many;
+} notification_kinds[] = {
+    [NOTIFY_PICTURE] = { "Picture saved to", "%u pictures saved" },
+    [NOTIFY_SCREENSHOT] = { "Screenshot saved to", "%u screenshots saved" },
+    [NOTIFY_VIDEO] = { "Video saved to", "%u videos saved" },
+};
+
+static struct {
+    guint32 id;           // returned by the notification daemon, reused as replaces_id
+    guint count;
+    gint64 last_event;
+    gint64 last_sent;
+    gboolean in_flight;
+    gboolean dirty;
+    guint flush_id;
+    gchar *body;
+} notifications[NOTIFY_KIND_COUNT];
+
+static GDBusConnection *notify_connection;
+
+static void send_notification(enum notification_kind kind);
+
+static gboolean on_notification_flush(gpointer data) {
+    enum notification_kind kind = GPOINTER_TO_INT(data);
+
+    notifications[kind].flush_id = 0;
+    send_notification(kind);
+    return G_SOURCE_REMOVE;
+}
+
+static void on_notification_sent(GObject *source, GAsyncResult *res, gpointer data) {
+    enum notification_kind kind = GPOINTER_TO_INT(data);
     GError *error = NULL;
 
-    connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
-    if (connection == NULL) {
-        g_printerr("Failed to get session bus: %s\n", error->message);
+    GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+    if (result == NULL) {
+        g_printerr("Failed to show notification: %s\n", error->message);
         g_error_free(error);
+    } else {
+        g_variant_get(result, "(u)", &notifications[kind].id);
+        g_variant_unref(result);
+    }
+
+    notifications[kind].in_flight = FALSE;
+
+    // something new came in while waiting for the reply, update in place with it
+    if (notifications[kind].dirty && notifications[kind].flush_id == 0)
+        send_notification(kind);
+}
+
+static void send_notification(enum notification_kind kind) {
+    gint64 now = g_get_monotonic_time();
+    gint64 next = notifications[kind].last_sent + NOTIFY_MIN_INTERVAL_MS * 1000;
+
+    // one request at a time per kind so the replaces_id is always known
+    if (notifications[kind].in_flight)
+        return;
+
+    if (now < next) {
+        if (notifications[kind].flush_id == 0)
+            notifications[kind].flush_id = g_timeout_add((next - now) / 1000 + 1, on_notification_flush,
+                                                         GINT_TO_POINTER(kind));
         return;
     }
 
-    g_dbus_connection_call_sync(
-        connection,
+    gchar *summary;
+    if (notifications[kind].count > 1)
+        summary = g_strdup_printf(notification_kinds[kind].summary_many, notifications[kind].count);
+    else
+        summary = g_strdup(notification_kinds[kind].summary);
+
+    g_dbus_connection_call(
+        notify_connection,
         "org.freedesktop.Notifications",
         "/org/freedesktop/Notifications",
         "org.freedesktop.Notifications",
         "Notify",
-        g_variant_new("(susssasa{sv}i)", "Assistant Button", 0, "", summary, body, NULL, NULL, -1),
-        NULL,
+        g_variant_new("(susssasa{sv}i)", "Assistant Button", notifications[kind].id, "", summary,
+                      notifications[kind].body, NULL, NULL, -1),
+        G_VARIANT_TYPE("(u)"),
         G_DBUS_CALL_FLAGS_NONE,
         -1,
         NULL,
-        &error
+        on_notification_sent,
+        GINT_TO_POINTER(kind)
     );
 
-    if (error != NULL) {
-        g_printerr("Failed to show notification: %s\n", error->message);
-        g_error_free(error);
+    notifications[kind].in_flight = TRUE;
+    notifications[kind].dirty = FALSE;
+    notifications[kind].last_sent = now;
+    g_free(summary);
+}
+
+struct pending_notification {
+    enum notification_kind kind;
+    gchar *body;
+};
+
+static gboolean on_pending_notification(gpointer data) {
+    struct pending_notification *pending = data;
+
+    show_notification(pending->kind, pending->body);
+    return G_SOURCE_REMOVE;
+}
+
+static void free_pending_notification(gpointer data) {
+    struct pending_notification *pending = data;
+
+    g_free(pending->body);
+    g_free(pending);
+}
+
+void show_notification(enum notification_kind kind, const char *body) {
+    GError *error = NULL;
+
+    // actions on executor threads end up here too, everything below belongs to the main loop
+    if (!g_main_context_is_owner(g_main_context_default())) {
+        struct pending_notification *pending = g_new(struct pending_notification, 1);
+        pending->kind = kind;
+        pending->body = g_strdup(body);
+        g_main_context_invoke_full(NULL, G_PRIORITY_DEFAULT, on_pending_notification,
+                                   pending, free_pending_notification);
+        return;
+    }
+
+    if (notify_connection == NULL) {
+        notify_connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+        if (notify_connection == NULL) {
+            g_printerr("Failed to get session bus: %s\n", error->message);
+            g_error_free(error);
+            return;
+        }
     }
 
-    g_object_unref(connection);
+    gint64 now = g_get_monotonic_time();
+    if (now - notifications[kind].last_event > NOTIFY_COALESCE_MS * 1000)
+        notifications[kind].count = 0;
+
+    notifications[kind].count++;
+    notifications[kind].last_event = now;
+    notifications[kind].dirty = TRUE;
+    g_free(notifications[kind].body);
+    notifications[kind].body = g_strdup(body);
+
+    send_notification(kind);
 }
@@ -4,7 +4,16 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+enum notification_kind {
+    NOTIFY_PICTURE,
+    NOTIFY_SCREENSHOT,
+    NOTIFY_VIDEO,
+    NOTIFY_KIND_COUNT
+};
+
 void run_command(const char *command);
-void show_notification(const char *summary, const char *body);
+void run_argv(char *const argv[]);
+void show_notification(enum notification_kind kind, const char *body);
+int notify_systemd(const char *state);
 
 #endif // UTILS_H
@@ -2,6 +2,12 @@
 // Copyright (c) 2019 Josef Gajdusek
 // Copyright (C) 2023 Bardia Moshiri <fakeshell@bardia.tech>
 
+#define _GNU_SOURCE
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include "virtkey.h"
 
 const struct wl_registry_listener registry_listener = {
@@ -38,13 +44,95 @@ enum wtype_mod name_to_mod(const char *name)
     return WTYPE_MOD_NONE;
 }
 
+static inline size_t hash_key(uint32_t key)
+{
+    // murmur3 finalizer, keysyms and code points cluster heavily in the low bits
+    key ^= key >> 16;
+    key *= 0x85ebca6b;
+    key ^= key >> 13;
+    key *= 0xc2b2ae35;
+    key ^= key >> 16;
+    return key;
+}
+
+static void index_insert(unsigned int *index, size_t cap, uint32_t key, unsigned int key_code)
+{
+    size_t slot = hash_key(key) & (cap - 1);
+    while (index[slot] != 0)
+        slot = (slot + 1) & (cap - 1);
+    index[slot] = key_code;
+}
+
+static void rebuild_index(struct wtype *wtype, size_t cap)
+{
+    free(wtype->xkb_index);
+    free(wtype->wchr_index);
+    wtype->xkb_index = calloc(cap, sizeof(wtype->xkb_index[0]));
+    wtype->wchr_index = calloc(cap, sizeof(wtype->wchr_index[0]));
+    wtype->index_cap = cap;
+
+    // walk in keycode order so the first entry for a keysym keeps winning
+    for (size_t i = 0; i < wtype->keymap_len; i++) {
+        if (lookup_key_code_by_xkb(wtype, wtype->keymap[i].xkb) == 0)
+            index_insert(wtype->xkb_index, cap, wtype->keymap[i].xkb, i + 1);
+        if (wtype->keymap[i].wchr != 0 && lookup_key_code_by_wchar(wtype, wtype->keymap[i].wchr) == 0)
+            index_insert(wtype->wchr_index, cap, wtype->keymap[i].wchr, i + 1);
+    }
+}
+
+unsigned int lookup_key_code_by_xkb(struct wtype *wtype, xkb_keysym_t xkb)
+{
+    if (wtype->index_cap == 0)
+        return 0;
+
+    size_t slot = hash_key(xkb) & (wtype->index_cap - 1);
+    unsigned int key_code;
+    while ((key_code = wtype->xkb_index[slot]) != 0) {
+        if (wtype->keymap[key_code - 1].xkb == xkb)
+            return key_code;
+        slot = (slot + 1) & (wtype->index_cap - 1);
+    }
+    return 0;
+}
+
+unsigned int lookup_key_code_by_wchar(struct wtype *wtype, wchar_t ch)
+{
+    if (wtype->index_cap == 0)
+        return 0;
+
+    size_t slot = hash_key(ch) & (wtype->index_cap - 1);
+    unsigned int key_code;
+    while ((key_code = wtype->wchr_index[slot]) != 0) {
+        if (wtype->keymap[key_code - 1].wchr == ch)
+            return key_code;
+        slot = (slot + 1) & (wtype->index_cap - 1);
+    }
+    return 0;
+}
+
 unsigned int append_keymap_entry(struct wtype *wtype, wchar_t ch, xkb_keysym_t xkb)
 {
-    wtype->keymap = realloc(
-        wtype->keymap, ++wtype->keymap_len * sizeof(wtype->keymap[0])
-    );
-    wtype->keymap[wtype->keymap_len - 1].wchr = ch;
-    wtype->keymap[wtype->keymap_len - 1].xkb = xkb;
+    if (wtype->keymap_len == wtype->keymap_cap) {
+        wtype->keymap_cap = wtype->keymap_cap ? wtype->keymap_cap * 2 : 16;
+        wtype->keymap = realloc(
+            wtype->keymap, wtype->keymap_cap * sizeof(wtype->keymap[0])
+        );
+    }
+    wtype->keymap[wtype->keymap_len].wchr = ch;
+    wtype->keymap[wtype->keymap_len].xkb = xkb;
+    wtype->keymap_len++;
+    wtype->keymap_dirty = 1;
+
+    // keep the index at most half full so probe chains stay short
+    if (wtype->keymap_len * 2 > wtype->index_cap) {
+        rebuild_index(wtype, wtype->index_cap ? wtype->index_cap * 2 : 64);
+    } else {
+        if (lookup_key_code_by_xkb(wtype, xkb) == 0)
+            index_insert(wtype->xkb_index, wtype->index_cap, xkb, wtype->keymap_len);
+        if (ch != 0 && lookup_key_code_by_wchar(wtype, ch) == 0)
+            index_insert(wtype->wchr_index, wtype->index_cap, ch, wtype->keymap_len);
+    }
+
     return wtype->keymap_len;
 }
 
@@ -58,11 +146,9 @@ unsigned int get_key_code_by_wchar(struct wtype *wtype, wchar_t ch)
         { L'\t', XKB_KEY_Tab },
         { L'\e', XKB_KEY_Escape },
     };
-    for (unsigned int i = 0; i < wtype->keymap_len; i++) {
-        if (wtype->keymap[i].wchr == ch) {
-            return i + 1;
-        }
-    }
+    unsigned int key_code = lookup_key_code_by_wchar(wtype, ch);
+    if (key_code != 0)
+        return key_code;
 
     xkb_keysym_t xkb = xkb_utf32_to_keysym(ch);
     for (size_t i = 0; i < ARRAY_SIZE(remap_table); i++) {
@@ -72,19 +158,107 @@ unsigned int get_key_code_by_wchar(struct wtype *wtype, wchar_t ch)
         }
     }
 
+    // the keysym may already be bound through a named key, don't grow the keymap for it
+    key_code = lookup_key_code_by_xkb(wtype, xkb);
+    if (key_code != 0)
+        return key_code;
+
     return append_keymap_entry(wtype, ch, xkb);
 }
 
 unsigned int get_key_code_by_xkb(struct wtype *wtype, xkb_keysym_t xkb)
 {
-    for (unsigned int i = 0; i < wtype->keymap_len; i++) {
-        if (wtype->keymap[i].xkb == xkb)
-            return i + 1;
-    }
+    unsigned int key_code = lookup_key_code_by_xkb(wtype, xkb);
+    if (key_code != 0)
+        return key_code;
 
     return append_keymap_entry(wtype, 0, xkb);
 }
 
+static size_t utf8_decode(const char *s, uint32_t *out)
+{
+    const unsigned char *u = (const unsigned char *)s;
+    if (u[0] < 0x80) {
+        *out = u[0];
+        return 1;
+    }
+    if ((u[0] & 0xe0) == 0xc0 && (u[1] & 0xc0) == 0x80) {
+        *out = ((u[0] & 0x1f) << 6) | (u[1] & 0x3f);
+        return 2;
+    }
+    if ((u[0] & 0xf0) == 0xe0 && (u[1] & 0xc0) == 0x80 && (u[2] & 0xc0) == 0x80) {
+        *out = ((u[0] & 0x0f) << 12) | ((u[1] & 0x3f) << 6) | (u[2] & 0x3f);
+        return 3;
+    }
+    if ((u[0] & 0xf8) == 0xf0 && (u[1] & 0xc0) == 0x80 && (u[2] & 0xc0) == 0x80 && (u[3] & 0xc0) == 0x80) {
+        *out = ((u[0] & 0x07) << 18) | ((u[1] & 0x3f) << 12) | ((u[2] & 0x3f) << 6) | (u[3] & 0x3f);
+        return 4;
+    }
+    return 0;
+}
+
+int compile_text(struct wtype *wtype, struct wtype_command *cmd, const char *text, unsigned int delay_ms)
+{
+    size_t len = strlen(text);
+
+    cmd->type = WTYPE_COMMAND_TEXT;
+    cmd->key_codes = malloc((len + 1) * sizeof(cmd->key_codes[0]));
+    cmd->key_codes_len = 0;
+    cmd->delay_ms = delay_ms;
+    if (cmd->key_codes == NULL)
+        return -1;
+
+    // decode by hand instead of mbstowcs, the daemon never calls setlocale
+    for (size_t i = 0; i < len;) {
+        uint32_t ch;
+        size_t n = utf8_decode(text + i, &ch);
+        if (n == 0) {
+            fprintf(stderr, "Invalid UTF-8 in text at offset %zu\n", i);
+            free(cmd->key_codes);
+            cmd->key_codes = NULL;
+            return -1;
+        }
+        cmd->key_codes[cmd->key_codes_len++] = get_key_code_by_wchar(wtype, ch);
+        i += n;
+    }
+
+    return 0;
+}
+
+static uint32_t event_time_ms()
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1000 + spec.tv_nsec / 1000000;
+}
+
+static void flush_events(struct wtype *wtype)
+{
+    // the socket buffer may be full when sending large batches, wait until it drains
+    while (wl_display_flush(wtype->display) < 0 && errno == EAGAIN) {
+        struct pollfd pfd = {
+            .fd = wl_display_get_fd(wtype->display),
+            .events = POLLOUT,
+        };
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+            break;
+    }
+}
+
+/* called after every event, legacy mode syncs each one while batch mode only flushes */
+static void sync_event(struct wtype *wtype)
+{
+    if (!wtype->batch) {
+        wl_display_roundtrip(wtype->display);
+    } else if (wtype->key_delay_us > 0 || ++wtype->queued_events >= WTYPE_BATCH_FLUSH) {
+        flush_events(wtype);
+        wtype->queued_events = 0;
+    }
+
+    if (wtype->key_delay_us > 0)
+        usleep(wtype->key_delay_us);
+}
+
 void run_mod(struct wtype *wtype, struct wtype_command *cmd)
 {
     if (cmd->type == WTYPE_COMMAND_MOD_PRESS)
@@ -97,41 +271,51 @@ void run_mod(struct wtype *wtype, struct wtype_command *cmd)
         wtype->mod_status & WTYPE_MOD_CAPSLOCK, 0
     );
 
-    wl_display_roundtrip(wtype->display);
+    sync_event(wtype);
 }
 
 void run_key(struct wtype *wtype, struct wtype_command *cmd)
 {
     zwp_virtual_keyboard_v1_key(
-        wtype->keyboard, 0, cmd->single_key_code,
+        wtype->keyboard, event_time_ms(), cmd->single_key_code,
         cmd->type == WTYPE_COMMAND_KEY_PRESS ?
         WL_KEYBOARD_KEY_STATE_PRESSED : WL_KEYBOARD_KEY_STATE_RELEASED
     );
-    wl_display_roundtrip(wtype->display);
+    sync_event(wtype);
 }
 
 void type_keycode(struct wtype *wtype, unsigned int key_code)
 {
     zwp_virtual_keyboard_v1_key(
-        wtype->keyboard, 0, key_code, WL_KEYBOARD_KEY_STATE_PRESSED
+        wtype->keyboard, event_time_ms(), key_code, WL_KEYBOARD_KEY_STATE_PRESSED
     );
-    wl_display_roundtrip(wtype->display);
-    usleep(2000);
+    sync_event(wtype);
     zwp_virtual_keyboard_v1_key(
-        wtype->keyboard, 0, key_code, WL_KEYBOARD_KEY_STATE_RELEASED
+        wtype->keyboard, event_time_ms(), key_code, WL_KEYBOARD_KEY_STATE_RELEASED
     );
-    wl_display_roundtrip(wtype->display);
-    usleep(2000);
+    sync_event(wtype);
 }
 
 void run_text(struct wtype *wtype, struct wtype_command *cmd)
 {
     for (size_t i = 0; i < cmd->key_codes_len; i++) {
         type_keycode(wtype, cmd->key_codes[i]);
-        usleep(cmd->delay_ms * 1000);
+        if (cmd->delay_ms > 0) {
+            if (wtype->batch)
+                flush_events(wtype);
+            usleep(cmd->delay_ms * 1000);
+        }
     }
 }
 
+/* only flushes, the caller ends the run here and waits sleep_ms without blocking */
+void run_sleep(struct wtype *wtype, struct wtype_command *cmd)
+{
+    // whatever was queued before the pause has to reach the compositor first
+    if (wtype->batch)
+        flush_events(wtype);
+}
+
 void run_commands(struct wtype *wtype)
 {
     void (*handlers[])(struct wtype *, struct wtype_command *) = {
@@ -140,10 +324,18 @@ void run_commands(struct wtype *wtype)
         [WTYPE_COMMAND_KEY_PRESS] = run_key,
         [WTYPE_COMMAND_KEY_RELEASE] = run_key,
         [WTYPE_COMMAND_TEXT] = run_text,
+        [WTYPE_COMMAND_SLEEP] = run_sleep,
     };
     for (unsigned int i = 0; i < wtype->command_count; i++) {
         handlers[wtype->commands[i].type](wtype, &wtype->commands[i]);
     }
+
+    // one sync for the whole batch so the caller knows everything reached the compositor
+    if (wtype->batch) {
+        flush_events(wtype);
+        wtype->queued_events = 0;
+        wl_display_roundtrip(wtype->display);
+    }
 }
 
 void print_keysym_name(xkb_keysym_t keysym, FILE *f)
@@ -159,15 +351,15 @@ void print_keysym_name(xkb_keysym_t keysym, FILE *f)
     fprintf(f, "%s", sym_name);
 }
 
-void upload_keymap(struct wtype *wtype)
+int build_keymap(struct wtype *wtype)
 {
-    char filename[] = "/tmp/wtype-XXXXXX";
-    int fd = mkstemp(filename);
-    if (fd < 0)
-        printf("Failed to create the temporary keymap file");
-
-    unlink(filename);
-    FILE *f = fdopen(fd, "w");
+    char *text = NULL;
+    size_t text_len = 0;
+    FILE *f = open_memstream(&text, &text_len);
+    if (f == NULL) {
+        perror("Failed to create the keymap buffer");
+        return -1;
+    }
 
     fprintf(f, "xkb_keymap {\n");
 
@@ -197,14 +389,75 @@ void upload_keymap(struct wtype *wtype)
 
     fprintf(f, "};\n");
     fputc('\0', f);
-    fflush(f);
-    size_t keymap_size = ftell(f);
+    fclose(f);
 
-    zwp_virtual_keyboard_v1_keymap(
-        wtype->keyboard, WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1, fileno(f), keymap_size
-    );
+    // the compositor maps this read-only, seal it so it can never change under it
+    int fd = memfd_create("assistant-button-keymap", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        perror("Failed to create the keymap memfd");
+        free(text);
+        return -1;
+    }
+
+    size_t written = 0;
+    while (written < text_len) {
+        ssize_t ret = write(fd, text + written, text_len - written);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("Failed to write the keymap");
+            close(fd);
+            free(text);
+            return -1;
+        }
+        written += ret;
+    }
+    free(text);
 
-    wl_display_roundtrip(wtype->display);
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0)
+        perror("Failed to seal the keymap memfd");
 
-    fclose(f);
+    if (wtype->keymap_size > 0)
+        close(wtype->keymap_fd);
+
+    wtype->keymap_fd = fd;
+    wtype->keymap_size = text_len;
+    wtype->keymap_uploaded = 0;
+    return 0;
+}
+
+void free_keymap(struct wtype *wtype)
+{
+    if (wtype->keymap_size > 0)
+        close(wtype->keymap_fd);
+
+    free(wtype->keymap);
+    free(wtype->xkb_index);
+    free(wtype->wchr_index);
+    wtype->keymap = NULL;
+    wtype->xkb_index = NULL;
+    wtype->wchr_index = NULL;
+    wtype->keymap_len = 0;
+    wtype->keymap_cap = 0;
+    wtype->index_cap = 0;
+    wtype->keymap_size = 0;
+    wtype->keymap_uploaded = 0;
+}
+
+void upload_keymap(struct wtype *wtype)
+{
+    // only rebuild when a keysym that is not in the current keymap got added
+    if (wtype->keymap_size == 0 || wtype->keymap_dirty) {
+        if (build_keymap(wtype) != 0)
+            return;
+        wtype->keymap_dirty = 0;
+    }
+
+    if (wtype->keymap_uploaded)
+        return;
+
+    zwp_virtual_keyboard_v1_keymap(
+        wtype->keyboard, WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1, wtype->keymap_fd, wtype->keymap_size
+    );
+    wtype->keymap_uploaded = 1;
 }
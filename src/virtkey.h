@@ -13,12 +13,18 @@
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(x[0]))
 
+/* pacing wtype itself uses between every key event */
+#define WTYPE_LEGACY_KEY_DELAY_US 2000
+/* events queued in batch mode before the socket is flushed */
+#define WTYPE_BATCH_FLUSH 64
+
 enum wtype_command_type {
     WTYPE_COMMAND_TEXT = 0,
     WTYPE_COMMAND_MOD_PRESS = 1,
     WTYPE_COMMAND_MOD_RELEASE = 2,
     WTYPE_COMMAND_KEY_PRESS = 3,
     WTYPE_COMMAND_KEY_RELEASE = 4,
+    WTYPE_COMMAND_SLEEP = 5,
 };
 
 enum wtype_mod {
@@ -58,9 +64,27 @@ struct wtype {
     struct zwp_virtual_keyboard_v1 *keyboard;
 
     size_t keymap_len;
+    size_t keymap_cap;
     struct keymap_entry *keymap;
 
+    /* open addressed keysym/wchar -> keycode index, 0 marks an empty slot */
+    size_t index_cap;
+    unsigned int *xkb_index;
+    unsigned int *wchr_index;
+
+    /* compiled keymap, kept in a sealed memfd and reused until an entry is added */
+    int keymap_fd;
+    size_t keymap_size;
+    int keymap_dirty;
+    int keymap_uploaded;
+
     uint32_t mod_status;
+
+    /* batch queues events and syncs once per run_commands(), otherwise every event is a roundtrip */
+    int batch;
+    unsigned int key_delay_us;
+    unsigned int queued_events;
+
     size_t command_count;
     struct wtype_command *commands;
 };
@@ -76,19 +100,24 @@ static const struct { const char *name; enum wtype_mod mod; } mod_names[] = {
 };
 
 extern const struct wl_registry_listener registry_listener;
-void upload_keymap(struct wtype *wtype);
 void handle_wl_event(void *data, struct wl_registry *registry, uint32_t name, const char *interface, uint32_t version);
 void handle_wl_event_remove(void *data, struct wl_registry *registry, uint32_t name);
 enum wtype_mod name_to_mod(const char *name);
+unsigned int lookup_key_code_by_xkb(struct wtype *wtype, xkb_keysym_t xkb);
+unsigned int lookup_key_code_by_wchar(struct wtype *wtype, wchar_t ch);
 unsigned int append_keymap_entry(struct wtype *wtype, wchar_t ch, xkb_keysym_t xkb);
 unsigned int get_key_code_by_wchar(struct wtype *wtype, wchar_t ch);
 unsigned int get_key_code_by_xkb(struct wtype *wtype, xkb_keysym_t xkb);
+int compile_text(struct wtype *wtype, struct wtype_command *cmd, const char *text, unsigned int delay_ms);
 void run_mod(struct wtype *wtype, struct wtype_command *cmd);
 void run_key(struct wtype *wtype, struct wtype_command *cmd);
 void type_keycode(struct wtype *wtype, unsigned int key_code);
 void run_text(struct wtype *wtype, struct wtype_command *cmd);
+void run_sleep(struct wtype *wtype, struct wtype_command *cmd);
 void run_commands(struct wtype *wtype);
 void print_keysym_name(xkb_keysym_t keysym, FILE *f);
+int build_keymap(struct wtype *wtype);
+void free_keymap(struct wtype *wtype);
 void upload_keymap(struct wtype *wtype);
 
 #endif // VIRTKEY_H
@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "flightrec.h"
+#include "stats.h"
+#include "wakelock.h"
+
+static struct {
+    pthread_mutex_t lock;
+    int lock_fd;
+    int unlock_fd;
+    int held;
+    unsigned int epoch;
+    long long acquired_us;
+    long long armed_us; // when the kernel's timeout was last restarted
+} wakelock = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .lock_fd = -1,
+    .unlock_fd = -1,
+};
+
+/* CLOCK_BOOTTIME, so a suspend the lock didn't prevent still shows up in the hold time */
+static long long now_us() {
+    struct timespec spec;
+    clock_gettime(CLOCK_BOOTTIME, &spec);
+    return spec.tv_sec * 1000000LL + spec.tv_nsec / 1000;
+}
+
+/* 0 when the kernel takes wakelocks from us, everything else is a no-op otherwise */
+int wakelock_init() {
+    wakelock.lock_fd = open("/sys/power/wake_lock", O_WRONLY | O_CLOEXEC);
+    wakelock.unlock_fd = open("/sys/power/wake_unlock", O_WRONLY | O_CLOEXEC);
+
+    if (wakelock.lock_fd == -1 || wakelock.unlock_fd == -1) {
+        // no CONFIG_PM_WAKELOCKS, or no write access for the session
+        fprintf(stderr, "Wakelocks unavailable: %s\n", strerror(errno));
+        if (wakelock.lock_fd != -1)
+            close(wakelock.lock_fd);
+        if (wakelock.unlock_fd != -1)
+            close(wakelock.unlock_fd);
+        wakelock.lock_fd = wakelock.unlock_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/* returns the epoch to hand to wakelock_release(), 0 when there's no wakelock to hold */
+unsigned int wakelock_acquire() {
+    if (wakelock.lock_fd == -1)
+        return 0;
+
+    pthread_mutex_lock(&wakelock.lock);
+    long long now = now_us();
+
+    // a press resolving slower than the kernel's timeout restarts it instead of losing the lock
+    if (!wakelock.held || now - wakelock.armed_us > WAKELOCK_TIMEOUT_MS * 1000LL / 2) {
+        char buffer[64];
+        int len = snprintf(buffer, sizeof(buffer), "%s %lld", WAKELOCK_NAME, WAKELOCK_TIMEOUT_MS * 1000000LL);
+
+        if (write(wakelock.lock_fd, buffer, len) == len) {
+            if (!wakelock.held) {
+                wakelock.held = 1;
+                wakelock.acquired_us = now;
+                stats_add(STAT_WAKELOCK_HOLDS, 1);
+            }
+            wakelock.armed_us = now;
+        } else {
+            flightrec_record(FR_ERROR, errno, 0, 0);
+        }
+    }
+
+    if (++wakelock.epoch == 0)
+        wakelock.epoch = 1;
+    unsigned int epoch = wakelock.epoch;
+    pthread_mutex_unlock(&wakelock.lock);
+    return epoch;
+}
+
+/* epoch 0 drops the lock whoever took it, for shutting down */
+void wakelock_release(unsigned int epoch) {
+    if (wakelock.unlock_fd == -1)
+        return;
+
+    pthread_mutex_lock(&wakelock.lock);
+    if (wakelock.held && (epoch == 0 || epoch == wakelock.epoch)) {
+        if (write(wakelock.unlock_fd, WAKELOCK_NAME, strlen(WAKELOCK_NAME)) < 0)
+            flightrec_record(FR_ERROR, errno, 0, 0);
+
+        long long held = now_us() - wakelock.acquired_us;
+        wakelock.held = 0;
+        stats_add(STAT_WAKELOCK_HELD_US_TOTAL, held);
+        stats_max(STAT_WAKELOCK_HELD_US_MAX, held);
+    }
+    pthread_mutex_unlock(&wakelock.lock);
+}
@@ -0,0 +1,21 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+#ifndef WAKELOCK_H
+#define WAKELOCK_H
+
+#define WAKELOCK_NAME "assistant-button"
+/* the kernel drops it by itself after this, so a crash can't keep the phone awake */
+#define WAKELOCK_TIMEOUT_MS 5000
+
+/*
+ * A kernel wakelock through /sys/power/wake_lock, keeping autosleep away
+ * from the time a key edge is read until its gesture was dispatched. Every
+ * acquire returns an epoch, a release only drops the lock when nothing
+ * acquired it since, so the input thread and the main loop can share it.
+ */
+int wakelock_init();
+unsigned int wakelock_acquire();
+void wakelock_release(unsigned int epoch);
+
+#endif // WAKELOCK_H
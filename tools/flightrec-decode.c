@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+/*
+ * Prints a flight recorder dump written on SIGUSR1 or through the
+ * DumpFlightRecorder D-Bus method, one record per line:
+ *
+ *   flightrec-decode /run/user/32011/assistant-button-flightrec-1700000000-1234-0.bin
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "flightrec.h"
+
+static const char *const event_names[] = {
+    [1] = "short",
+    [2] = "long",
+    [3] = "double",
+};
+
+/* enum account_subsystem */
+static const char *const cause_names[] = {
+    [1] = "input",
+    [2] = "timer",
+    [3] = "D-Bus",
+    [4] = "child exit",
+    [5] = "other",
+};
+
+static const char *const step_status_names[] = {
+    [2] = "ok",
+    [3] = "failed",
+    [4] = "timed out",
+    [5] = "skipped",
+};
+
+static const char *event_name(uint16_t code) {
+    if (code < sizeof(event_names) / sizeof(event_names[0]) && event_names[code])
+        return event_names[code];
+    return "?";
+}
+
+static const char *cause_name(uint16_t code) {
+    if (code < sizeof(cause_names) / sizeof(cause_names[0]) && cause_names[code])
+        return cause_names[code];
+    return "?";
+}
+
+static void print_record(const struct flightrec_record *rec) {
+    switch (rec->type) {
+        case FR_INPUT:
+            printf("input type=%lld code=%u value=%lld\n", (long long)rec->b, rec->code, (long long)rec->a);
+            break;
+        case FR_GESTURE:
+            printf("gesture %s duration=%lldms\n", event_name(rec->code), (long long)rec->a);
+            break;
+        case FR_TIMEOUT:
+            printf("timeout after %lldms\n", (long long)rec->a);
+            break;
+        case FR_ACTION:
+            printf("action %lld for %s press took %lldus\n", (long long)rec->a, event_name(rec->code), (long long)rec->b);
+            break;
+        case FR_ERROR:
+            printf("error %s\n", strerror(rec->code));
+            break;
+        case FR_DUMP:
+            printf("dump of %lld records\n", (long long)rec->a);
+            break;
+        case FR_CHAIN_STEP:
+            printf("chain step %u %s after %lldus\n", rec->code,
+                   rec->a >= 0 && rec->a < 6 && step_status_names[rec->a] ? step_status_names[rec->a] : "?",
+                   (long long)rec->b);
+            break;
+        case FR_ROLLBACK:
+            printf("speculative short press %s, status %lld after %lldus\n",
+                   rec->code == 2 ? "undone" : "absorbed", (long long)rec->a, (long long)rec->b);
+            break;
+        case FR_CONTEXT:
+            printf("context screen %s, %s, %s\n", rec->code & 1 ? "off" : "on",
+                   rec->code & 2 ? "locked" : "unlocked", rec->code & 4 ? "an app focused" : "no app focused");
+            break;
+        case FR_WAKEUP:
+            printf("wakeup for %s, timeout %lldms, the one before took %lldus\n", cause_name(rec->code),
+                   (long long)rec->a, (long long)rec->b);
+            break;
+        case FR_BUSY_LOOP:
+            printf("busy loop, %lld wakeups and %lldus on the CPU in a second, mostly %s\n",
+                   (long long)rec->a, (long long)rec->b, cause_name(rec->code));
+            break;
+        default:
+            printf("unknown type=%u code=%u a=%lld b=%lld\n", rec->type, rec->code, (long long)rec->a, (long long)rec->b);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <dump>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (file == NULL) {
+        perror("Failed to open the dump");
+        return EXIT_FAILURE;
+    }
+
+    struct flightrec_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, FLIGHTREC_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "%s is not a flight recorder dump\n", argv[1]);
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+
+    if (header.version != FLIGHTREC_VERSION || header.record_size != sizeof(struct flightrec_record)) {
+        fprintf(stderr, "Unsupported dump version %u with %u byte records\n", header.version, header.record_size);
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+
+    // boottime timestamps only make sense next to the dump time, convert them to wall time
+    int64_t offset_ns = (int64_t)header.realtime_ns - (int64_t)header.boottime_ns;
+    uint64_t prev_ns = 0;
+    struct flightrec_record rec;
+
+    for (uint32_t i = 0; i < header.count && fread(&rec, sizeof(rec), 1, file) == 1; i++) {
+        int64_t wall_ns = (int64_t)rec.timestamp_ns + offset_ns;
+        time_t secs = wall_ns / 1000000000LL;
+        struct tm *t = localtime(&secs);
+        char stamp[32];
+
+        strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", t);
+        printf("%s.%09lld %+12.3fms #%-8llu ", stamp, (long long)(wall_ns % 1000000000LL),
+               prev_ns ? (rec.timestamp_ns - prev_ns) / 1e6 : 0.0, (unsigned long long)rec.seq);
+        print_record(&rec);
+        prev_ns = rec.timestamp_ns;
+    }
+
+    fclose(file);
+    return 0;
+}
@@ -0,0 +1,329 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+/*
+ * Minimal stand-in for a Wayland compositor: it only advertises wl_seat and
+ * zwp_virtual_keyboard_manager_v1 and records what virtual keyboards send it,
+ * so the injection path can be measured without phoc.
+ *
+ * Every request is logged as one line prefixed with the CLOCK_MONOTONIC
+ * receive time in nanoseconds, the same clock virtkey stamps key events with:
+ *
+ *   <ns> keymap format=<n> size=<bytes> hash=<fnv1a>
+ *   <ns> key time=<ms> key=<code> state=<0|1>
+ *   <ns> modifiers depressed=<n> latched=<n> locked=<n> group=<n>
+ *
+ * A summary with throughput and client-to-compositor latency is printed to
+ * stderr on exit.
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <wayland-server.h>
+#include <wayland-server-protocol.h>
+#include "virtual-keyboard-unstable-v1-server-protocol.h"
+
+struct mock {
+    struct wl_display *display;
+    FILE *log;
+    const char *keymap_dir;
+    unsigned long exit_after;
+
+    unsigned long keymaps;
+    unsigned long presses;
+    unsigned long releases;
+    unsigned long modifiers;
+    long long first_key_ns;
+    long long last_key_ns;
+    long long latency_sum_ms;
+    long long latency_max_ms;
+};
+
+struct mock_keyboard {
+    struct mock *mock;
+    int has_keymap;
+};
+
+static long long now_ns() {
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1000000000LL + spec.tv_nsec;
+}
+
+static uint32_t fnv1a(const unsigned char *data, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void save_keymap(struct mock *mock, const void *data, uint32_t size) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/keymap-%lu.xkb", mock->keymap_dir, mock->keymaps);
+
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        perror("Failed to save the keymap");
+        return;
+    }
+    // the keymap is sent with its terminating NUL, don't write that out
+    fwrite(data, 1, size > 0 ? size - 1 : 0, f);
+    fclose(f);
+}
+
+static void keyboard_keymap(struct wl_client *client, struct wl_resource *resource,
+                            uint32_t format, int32_t fd, uint32_t size) {
+    struct mock_keyboard *keyboard = wl_resource_get_user_data(resource);
+    struct mock *mock = keyboard->mock;
+    long long ts = now_ns();
+    uint32_t hash = 0;
+
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        perror("Failed to map the keymap");
+    } else {
+        hash = fnv1a(data, size);
+        if (mock->keymap_dir)
+            save_keymap(mock, data, size);
+        munmap(data, size);
+    }
+    close(fd);
+
+    mock->keymaps++;
+    keyboard->has_keymap = 1;
+    fprintf(mock->log, "%lld keymap format=%u size=%u hash=%08x\n", ts, format, size, hash);
+}
+
+static void keyboard_key(struct wl_client *client, struct wl_resource *resource,
+                         uint32_t time, uint32_t key, uint32_t state) {
+    struct mock_keyboard *keyboard = wl_resource_get_user_data(resource);
+    struct mock *mock = keyboard->mock;
+    long long ts = now_ns();
+
+    // same check the real implementations do
+    if (!keyboard->has_keymap) {
+        wl_resource_post_error(resource, ZWP_VIRTUAL_KEYBOARD_V1_ERROR_NO_KEYMAP,
+                               "key event before a keymap was set");
+        return;
+    }
+
+    if (mock->first_key_ns == 0)
+        mock->first_key_ns = ts;
+    mock->last_key_ns = ts;
+
+    if (state)
+        mock->presses++;
+    else
+        mock->releases++;
+
+    // client timestamps are CLOCK_MONOTONIC milliseconds truncated to 32 bits
+    if (time != 0) {
+        long long latency = (uint32_t)(ts / 1000000) - time;
+        mock->latency_sum_ms += latency;
+        if (latency > mock->latency_max_ms)
+            mock->latency_max_ms = latency;
+    }
+
+    fprintf(mock->log, "%lld key time=%u key=%u state=%u\n", ts, time, key, state);
+
+    if (mock->exit_after && mock->presses + mock->releases >= mock->exit_after)
+        wl_display_terminate(mock->display);
+}
+
+static void keyboard_modifiers(struct wl_client *client, struct wl_resource *resource,
+                               uint32_t mods_depressed, uint32_t mods_latched,
+                               uint32_t mods_locked, uint32_t group) {
+    struct mock_keyboard *keyboard = wl_resource_get_user_data(resource);
+    struct mock *mock = keyboard->mock;
+
+    mock->modifiers++;
+    fprintf(mock->log, "%lld modifiers depressed=%u latched=%u locked=%u group=%u\n",
+            now_ns(), mods_depressed, mods_latched, mods_locked, group);
+}
+
+static void keyboard_destroy(struct wl_client *client, struct wl_resource *resource) {
+    wl_resource_destroy(resource);
+}
+
+static const struct zwp_virtual_keyboard_v1_interface keyboard_impl = {
+    .keymap = keyboard_keymap,
+    .key = keyboard_key,
+    .modifiers = keyboard_modifiers,
+    .destroy = keyboard_destroy,
+};
+
+static void keyboard_resource_destroy(struct wl_resource *resource) {
+    free(wl_resource_get_user_data(resource));
+}
+
+static void manager_create_virtual_keyboard(struct wl_client *client, struct wl_resource *resource,
+                                            struct wl_resource *seat, uint32_t id) {
+    struct mock_keyboard *keyboard = calloc(1, sizeof(*keyboard));
+    struct wl_resource *keyboard_resource = wl_resource_create(
+        client, &zwp_virtual_keyboard_v1_interface, wl_resource_get_version(resource), id
+    );
+    if (keyboard == NULL || keyboard_resource == NULL) {
+        free(keyboard);
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    keyboard->mock = wl_resource_get_user_data(resource);
+    wl_resource_set_implementation(keyboard_resource, &keyboard_impl, keyboard, keyboard_resource_destroy);
+}
+
+static const struct zwp_virtual_keyboard_manager_v1_interface manager_impl = {
+    .create_virtual_keyboard = manager_create_virtual_keyboard,
+};
+
+static void bind_manager(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct wl_resource *resource = wl_resource_create(
+        client, &zwp_virtual_keyboard_manager_v1_interface, version, id
+    );
+    if (resource == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &manager_impl, data, NULL);
+}
+
+/* nobody asks for real input devices, hand out inert resources if they do */
+static void seat_get_device(struct wl_client *client, struct wl_resource *resource,
+                            const struct wl_interface *interface, uint32_t id) {
+    struct wl_resource *device = wl_resource_create(client, interface, wl_resource_get_version(resource), id);
+    if (device == NULL)
+        wl_client_post_no_memory(client);
+}
+
+static void seat_get_pointer(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+    seat_get_device(client, resource, &wl_pointer_interface, id);
+}
+
+static void seat_get_keyboard(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+    seat_get_device(client, resource, &wl_keyboard_interface, id);
+}
+
+static void seat_get_touch(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+    seat_get_device(client, resource, &wl_touch_interface, id);
+}
+
+static void seat_release(struct wl_client *client, struct wl_resource *resource) {
+    wl_resource_destroy(resource);
+}
+
+static const struct wl_seat_interface seat_impl = {
+    .get_pointer = seat_get_pointer,
+    .get_keyboard = seat_get_keyboard,
+    .get_touch = seat_get_touch,
+    .release = seat_release,
+};
+
+static void bind_seat(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct wl_resource *resource = wl_resource_create(client, &wl_seat_interface, version, id);
+    if (resource == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &seat_impl, data, NULL);
+    wl_seat_send_capabilities(resource, WL_SEAT_CAPABILITY_KEYBOARD);
+}
+
+static int handle_signal(int signal_number, void *data) {
+    struct mock *mock = data;
+    wl_display_terminate(mock->display);
+    return 0;
+}
+
+static void print_summary(struct mock *mock) {
+    unsigned long keys = mock->presses + mock->releases;
+    double span_ms = (mock->last_key_ns - mock->first_key_ns) / 1e6;
+
+    fprintf(stderr, "keymaps: %lu\n", mock->keymaps);
+    fprintf(stderr, "key events: %lu (%lu presses, %lu releases), modifier events: %lu\n",
+            keys, mock->presses, mock->releases, mock->modifiers);
+    if (keys > 1 && span_ms > 0)
+        fprintf(stderr, "throughput: %.0f key events/s over %.1f ms\n", keys / (span_ms / 1000.0), span_ms);
+    if (keys > 0)
+        fprintf(stderr, "latency: avg %.2f ms, max %lld ms\n",
+                (double)mock->latency_sum_ms / keys, mock->latency_max_ms);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-s socket] [-o log] [-k keymap-dir] [-n exit-after-key-events]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    struct mock mock = { .log = stdout };
+    const char *socket_name = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:o:k:n:h")) != -1) {
+        switch (opt) {
+            case 's':
+                socket_name = optarg;
+                break;
+            case 'o':
+                mock.log = fopen(optarg, "w");
+                if (mock.log == NULL) {
+                    perror("Failed to open the log file");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'k':
+                mock.keymap_dir = optarg;
+                break;
+            case 'n':
+                mock.exit_after = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    mock.display = wl_display_create();
+    if (mock.display == NULL) {
+        fprintf(stderr, "Failed to create the Wayland display\n");
+        return EXIT_FAILURE;
+    }
+
+    if (socket_name) {
+        if (wl_display_add_socket(mock.display, socket_name) != 0) {
+            fprintf(stderr, "Failed to add socket %s\n", socket_name);
+            return EXIT_FAILURE;
+        }
+    } else {
+        socket_name = wl_display_add_socket_auto(mock.display);
+        if (socket_name == NULL) {
+            fprintf(stderr, "Failed to add a socket\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    wl_global_create(mock.display, &wl_seat_interface, 7, &mock, bind_seat);
+    wl_global_create(mock.display, &zwp_virtual_keyboard_manager_v1_interface, 1, &mock, bind_manager);
+
+    struct wl_event_loop *loop = wl_display_get_event_loop(mock.display);
+    wl_event_loop_add_signal(loop, SIGINT, handle_signal, &mock);
+    wl_event_loop_add_signal(loop, SIGTERM, handle_signal, &mock);
+
+    fprintf(stderr, "WAYLAND_DISPLAY=%s\n", socket_name);
+
+    wl_display_run(mock.display);
+
+    print_summary(&mock);
+    fflush(mock.log);
+    if (mock.log != stdout)
+        fclose(mock.log);
+    wl_display_destroy(mock.display);
+    return 0;
+}
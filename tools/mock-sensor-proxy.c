@@ -0,0 +1,131 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+/*
+ * Stand-in for iio-sensor-proxy on the session bus, for exercising the
+ * manual autorotate action without a real accelerometer:
+ *
+ *   mock-sensor-proxy [initial-orientation] < orientations
+ *
+ * Every line read from stdin (normal, bottom-up, left-up, right-up) becomes
+ * the new AccelerometerOrientation and is announced with PropertiesChanged.
+ * Run the daemon with ASSISTANT_BUTTON_SENSOR_BUS=session to talk to it.
+ */
+
+#include <stdio.h>
+#include <gio/gio.h>
+#include <glib-unix.h>
+
+#define SENSOR_PROXY_NAME "net.hadess.SensorProxy"
+#define SENSOR_PROXY_PATH "/net/hadess/SensorProxy"
+
+static const gchar introspection_xml[] =
+    "<node>"
+    "  <interface name='net.hadess.SensorProxy'>"
+    "    <method name='ClaimAccelerometer'/>"
+    "    <method name='ReleaseAccelerometer'/>"
+    "    <property name='HasAccelerometer' type='b' access='read'/>"
+    "    <property name='AccelerometerOrientation' type='s' access='read'/>"
+    "  </interface>"
+    "</node>";
+
+static GDBusConnection *connection;
+static gchar *orientation;
+static int claims;
+
+static void handle_method_call(GDBusConnection *conn, const gchar *sender, const gchar *object_path,
+                               const gchar *interface_name, const gchar *method_name,
+                               GVariant *parameters, GDBusMethodInvocation *invocation, gpointer data) {
+    if (g_strcmp0(method_name, "ClaimAccelerometer") == 0)
+        claims++;
+    else if (g_strcmp0(method_name, "ReleaseAccelerometer") == 0 && claims > 0)
+        claims--;
+
+    g_print("%s from %s, %d claim(s)\n", method_name, sender, claims);
+    g_dbus_method_invocation_return_value(invocation, NULL);
+}
+
+static GVariant *handle_get_property(GDBusConnection *conn, const gchar *sender, const gchar *object_path,
+                                     const gchar *interface_name, const gchar *property_name,
+                                     GError **error, gpointer data) {
+    if (g_strcmp0(property_name, "HasAccelerometer") == 0)
+        return g_variant_new_boolean(TRUE);
+    return g_variant_new_string(orientation);
+}
+
+static const GDBusInterfaceVTable interface_vtable = {
+    .method_call = handle_method_call,
+    .get_property = handle_get_property,
+};
+
+static void set_orientation(const gchar *value) {
+    GVariantBuilder changed;
+
+    g_free(orientation);
+    orientation = g_strdup(value);
+    g_print("AccelerometerOrientation = %s\n", orientation);
+
+    g_variant_builder_init(&changed, G_VARIANT_TYPE("a{sv}"));
+    g_variant_builder_add(&changed, "{sv}", "AccelerometerOrientation", g_variant_new_string(orientation));
+    g_dbus_connection_emit_signal(connection, NULL, SENSOR_PROXY_PATH, "org.freedesktop.DBus.Properties",
+                                  "PropertiesChanged",
+                                  g_variant_new("(s@a{sv}@as)", SENSOR_PROXY_NAME,
+                                                g_variant_builder_end(&changed),
+                                                g_variant_new_strv(NULL, 0)),
+                                  NULL);
+}
+
+static gboolean on_stdin(gint fd, GIOCondition condition, gpointer data) {
+    GMainLoop *loop = data;
+    char line[64];
+
+    if (fgets(line, sizeof(line), stdin) == NULL) {
+        g_main_loop_quit(loop);
+        return G_SOURCE_REMOVE;
+    }
+
+    g_strstrip(line);
+    if (line[0] != '\0')
+        set_orientation(line);
+    return G_SOURCE_CONTINUE;
+}
+
+static void on_name_lost(GDBusConnection *conn, const gchar *name, gpointer data) {
+    g_printerr("Could not own %s\n", name);
+    g_main_loop_quit(data);
+}
+
+int main(int argc, char *argv[]) {
+    GError *error = NULL;
+    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+
+    orientation = g_strdup(argc > 1 ? argv[1] : "normal");
+
+    connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+    if (connection == NULL) {
+        g_printerr("Failed to get session bus: %s\n", error->message);
+        g_error_free(error);
+        return 1;
+    }
+
+    GDBusNodeInfo *info = g_dbus_node_info_new_for_xml(introspection_xml, NULL);
+    g_dbus_connection_register_object(connection, SENSOR_PROXY_PATH, info->interfaces[0],
+                                      &interface_vtable, NULL, NULL, &error);
+    if (error != NULL) {
+        g_printerr("Failed to register the sensor proxy object: %s\n", error->message);
+        g_error_free(error);
+        return 1;
+    }
+
+    g_bus_own_name_on_connection(connection, SENSOR_PROXY_NAME, G_BUS_NAME_OWNER_FLAGS_NONE,
+                                 NULL, on_name_lost, loop, NULL);
+    g_unix_fd_add(STDIN_FILENO, G_IO_IN | G_IO_HUP, on_stdin, loop);
+
+    g_main_loop_run(loop);
+
+    g_dbus_node_info_unref(info);
+    g_object_unref(connection);
+    g_main_loop_unref(loop);
+    g_free(orientation);
+    return 0;
+}
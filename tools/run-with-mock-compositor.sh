@@ -0,0 +1,30 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-only
+# Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+#
+# Runs a command against a private mock compositor and prints what it received.
+# The event log goes to $MOCK_COMPOSITOR_LOG when set.
+
+here=$(dirname "$0")
+
+if [ -z "$XDG_RUNTIME_DIR" ]; then
+    XDG_RUNTIME_DIR=$(mktemp -d)
+    export XDG_RUNTIME_DIR
+fi
+
+socket="assistant-button-mock-$$"
+"$here/mock-compositor" -s "$socket" -o "${MOCK_COMPOSITOR_LOG:-/dev/null}" &
+pid=$!
+
+i=0
+while [ ! -S "$XDG_RUNTIME_DIR/$socket" ] && [ $i -lt 50 ]; do
+    sleep 0.1
+    i=$((i + 1))
+done
+
+status=0
+WAYLAND_DISPLAY="$socket" "$@" || status=$?
+
+kill "$pid"
+wait "$pid"
+exit $status
@@ -0,0 +1,657 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2024 Bardia Moshiri <fakeshell@bardia.tech>
+
+/*
+ * End to end harness, drives the real daemon through a uinput device:
+ *
+ *   uinput-harness [-n runs] [-r edges/s] [-t storm seconds] [-s short max] [-d double max]
+ *                  [-v record seconds] ./assistant-button
+ *
+ * Creates a device sending KEY_ASSISTANT, starts the daemon on it through
+ * its argv[3] override with a throwaway HOME holding the bindings below and
+ * a config of its own (ASSISTANT_BUTTON_CONFIG), so /etc can't turn on
+ * speculative short presses or adaptive timing behind its back,
+ * plays scripted press patterns and then a press storm, and checks every
+ * ActionPerformed against what the pattern should produce. Needs write
+ * access to /dev/uinput and a session bus of its own, `make stress` runs it
+ * under dbus-run-session and the mock compositor.
+ *
+ * Decision latency is taken from the earliest moment the daemon could have
+ * decided: the release for short and double presses (for a short press the
+ * end of the double press window, a speculative run is only reported then
+ * too), the press plus the short press limit for long presses.
+ *
+ * With -v it binds the long press to the camera module's record toggle and
+ * records that long from videotestsrc with a software encoder, then checks
+ * a finished video landed in ~/Videos. The camera module has to be built,
+ * `make stress STRESS_FLAGS="-v 3"` points the daemon at the build tree's.
+ */
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <linux/uinput.h>
+#include <gio/gio.h>
+
+#define ASSISTANT_KEY 112
+#define DBUS_INTERFACE "io.FuriOS.AssistantButton"
+#define DBUS_PATH "/io/FuriOS/AssistantButton"
+
+#define SHORT_PRESS 1
+#define LONG_PRESS 2
+#define DOUBLE_PRESS 3
+
+#define HOLD_MS 60
+#define GAP_MS 80
+#define MAX_SIGNALS 65536
+#define MAX_EXPECTED 4
+#define STARTUP_TIMEOUT_MS 5000
+#define STORM_PAUSE_EVERY 1024 // edges
+#define RECORD_SETTLE_MS 500    // the video file not growing for this long means it's finished
+#define RECORD_TIMEOUT_MS 10000
+
+/* one run of a pattern, the steps alternate hold and gap times in ms, 0 ends them */
+struct pattern {
+    const char *name;
+    int steps[8];
+    int expected[MAX_EXPECTED];
+};
+
+/* ms are filled in from the daemon's limits, LONG and WINDOW stand for them */
+#define LONG -1
+#define WINDOW -2
+
+static const struct pattern patterns[] = {
+    { "short", { HOLD_MS }, { SHORT_PRESS } },
+    { "double", { HOLD_MS, GAP_MS, HOLD_MS }, { DOUBLE_PRESS } },
+    { "long", { LONG }, { LONG_PRESS } },
+    { "two_shorts", { HOLD_MS, WINDOW, HOLD_MS }, { SHORT_PRESS, SHORT_PRESS } },
+    { "double_then_short", { HOLD_MS, GAP_MS, HOLD_MS, GAP_MS, HOLD_MS }, { DOUBLE_PRESS, SHORT_PRESS } },
+};
+
+/* the daemon's bindings, all of them predefined so nothing gets spawned per press */
+static const struct {
+    const char *file;
+    const char *value;
+} bindings[] = {
+    { "short_press_predefined", "5\n" },  // send_tab
+    { "long_press_predefined", "7\n" },   // send_xf86back
+    { "double_press_predefined", "8\n" }, // send_escape
+};
+
+static struct {
+    gint64 time;
+    int event;
+} signals[MAX_SIGNALS];
+static int signal_count;
+static GMutex signal_lock;
+
+static int uinput_fd = -1;
+static int short_press_max = 500;
+static int double_press_max = 200;
+static pid_t daemon_pid;
+
+static gint64 now_us() {
+    return g_get_monotonic_time();
+}
+
+static void sleep_until(gint64 when) {
+    struct timespec spec = { .tv_sec = when / 1000000, .tv_nsec = when % 1000000 * 1000 };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &spec, NULL) == EINTR)
+        ;
+}
+
+static void on_action_performed(GDBusConnection *conn, const gchar *sender, const gchar *object_path,
+                                const gchar *interface_name, const gchar *signal_name,
+                                GVariant *parameters, gpointer data) {
+    gint32 action, event;
+    gint64 time = now_us();
+
+    g_variant_get(parameters, "(ii)", &action, &event);
+    g_mutex_lock(&signal_lock);
+    if (signal_count < MAX_SIGNALS) {
+        signals[signal_count].time = time;
+        signals[signal_count].event = event;
+        signal_count++;
+    }
+    g_mutex_unlock(&signal_lock);
+}
+
+static int signals_since(int start) {
+    g_mutex_lock(&signal_lock);
+    int count = signal_count - start;
+    g_mutex_unlock(&signal_lock);
+    return count;
+}
+
+static gpointer run_main_loop(gpointer data) {
+    g_main_loop_run(data);
+    return NULL;
+}
+
+static int emit(int type, int code, int value) {
+    struct input_event event = { .type = type, .code = code, .value = value };
+    return write(uinput_fd, &event, sizeof(event)) == sizeof(event) ? 0 : -1;
+}
+
+/* returns when the edge left for the kernel */
+static gint64 key(int value) {
+    if (emit(EV_KEY, ASSISTANT_KEY, value) != 0 || emit(EV_SYN, SYN_REPORT, 0) != 0) {
+        perror("Failed to write to uinput");
+        exit(EXIT_FAILURE);
+    }
+    return now_us();
+}
+
+static int create_device(char *path, size_t size) {
+    struct uinput_setup setup = {
+        .id = { .bustype = BUS_VIRTUAL, .vendor = 0x1, .product = 0x1 },
+        .name = "assistant-button-harness",
+    };
+    char sysname[64];
+    char sysdir[128];
+
+    uinput_fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (uinput_fd == -1) {
+        perror("Failed to open /dev/uinput");
+        return -1;
+    }
+
+    if (ioctl(uinput_fd, UI_SET_EVBIT, EV_KEY) != 0 || ioctl(uinput_fd, UI_SET_KEYBIT, ASSISTANT_KEY) != 0 ||
+        ioctl(uinput_fd, UI_DEV_SETUP, &setup) != 0 || ioctl(uinput_fd, UI_DEV_CREATE) != 0) {
+        perror("Failed to create the uinput device");
+        return -1;
+    }
+
+    if (ioctl(uinput_fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0) {
+        perror("Failed to get the uinput device name");
+        return -1;
+    }
+    snprintf(sysdir, sizeof(sysdir), "/sys/devices/virtual/input/%s", sysname);
+
+    // the event node shows up with the device, devtmpfs doesn't wait for udev
+    for (int tries = 0; tries < 50; tries++) {
+        DIR *dir = opendir(sysdir);
+        struct dirent *entry;
+        while (dir && (entry = readdir(dir))) {
+            if (strncmp(entry->d_name, "event", 5) == 0) {
+                snprintf(path, size, "/dev/input/%s", entry->d_name);
+                closedir(dir);
+                if (access(path, R_OK) == 0)
+                    return 0;
+                dir = NULL;
+                break;
+            }
+        }
+        if (dir)
+            closedir(dir);
+        g_usleep(100000);
+    }
+
+    fprintf(stderr, "No readable event node for %s\n", sysdir);
+    return -1;
+}
+
+static int write_bindings(const char *home) {
+    char path[512];
+    char config[256];
+
+    // the patterns expect exactly one ActionPerformed per gesture, at the limits given on the command line
+    snprintf(path, sizeof(path), "%s/assistant-button.conf", home);
+    snprintf(config, sizeof(config),
+             "SHORT_PRESS_MAX=%d\nDOUBLE_PRESS_MAX=%d\nSPECULATIVE_SHORT_PRESS=0\nADAPTIVE_TIMING=0\nSPLIT_MODE=0\n",
+             short_press_max, double_press_max);
+    if (!g_file_set_contents(path, config, -1, NULL)) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s/.config", home);
+    mkdir(path, 0700);
+    snprintf(path, sizeof(path), "%s/.config/assistant-button", home);
+    mkdir(path, 0700);
+
+    for (size_t i = 0; i < G_N_ELEMENTS(bindings); i++) {
+        snprintf(path, sizeof(path), "%s/.config/assistant-button/%s", home, bindings[i].file);
+        if (!g_file_set_contents(path, bindings[i].value, -1, NULL)) {
+            fprintf(stderr, "Failed to write %s\n", path);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void remove_bindings(const char *home) {
+    char path[512];
+
+    for (size_t i = 0; i < G_N_ELEMENTS(bindings); i++) {
+        snprintf(path, sizeof(path), "%s/.config/assistant-button/%s", home, bindings[i].file);
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/.config/assistant-button/bindings", home);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/.config/assistant-button", home);
+    rmdir(path);
+    snprintf(path, sizeof(path), "%s/assistant-button.conf", home);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/.config", home);
+    rmdir(path);
+    rmdir(home);
+}
+
+static pid_t start_daemon(const char *binary, const char *device, const char *home) {
+    char short_max[16], double_max[16];
+    char config[512];
+
+    snprintf(short_max, sizeof(short_max), "%d", short_press_max);
+    snprintf(double_max, sizeof(double_max), "%d", double_press_max);
+    snprintf(config, sizeof(config), "%s/assistant-button.conf", home);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        setenv("HOME", home, 1);
+        setenv("ASSISTANT_BUTTON_CONFIG", config, 1);
+        setenv("ASSISTANT_BUTTON_CAMERA_SOURCE", "videotestsrc", 0);
+        setenv("ASSISTANT_BUTTON_VIDEO_ENCODER", "x264enc", 0);
+        execl(binary, binary, short_max, double_max, device, (char *)NULL);
+        perror("Failed to start the daemon");
+        _exit(127);
+    }
+    return pid;
+}
+
+static int daemon_alive() {
+    int status;
+    return waitpid(daemon_pid, &status, WNOHANG) == 0;
+}
+
+static GVariant *get_stats(GDBusConnection *conn) {
+    return g_dbus_connection_call_sync(conn, DBUS_INTERFACE, DBUS_PATH, DBUS_INTERFACE, "GetStats",
+                                       NULL, G_VARIANT_TYPE("(a{sv})"), G_DBUS_CALL_FLAGS_NONE,
+                                       1000, NULL, NULL);
+}
+
+static guint64 stat_value(GVariant *stats, const char *name) {
+    GVariant *dict = g_variant_get_child_value(stats, 0);
+    guint64 value = 0;
+
+    g_variant_lookup(dict, name, "t", &value);
+    g_variant_unref(dict);
+    return value;
+}
+
+/* the name is only taken once startup is done with everything but the prewarming */
+static int wait_for_daemon(GDBusConnection *conn) {
+    for (int waited = 0; waited < STARTUP_TIMEOUT_MS; waited += 50) {
+        GVariant *stats = get_stats(conn);
+        if (stats) {
+            g_variant_unref(stats);
+            return 0;
+        }
+        if (!daemon_alive()) {
+            fprintf(stderr, "The daemon exited during startup\n");
+            return -1;
+        }
+        g_usleep(50000);
+    }
+
+    fprintf(stderr, "The daemon didn't show up on the bus\n");
+    return -1;
+}
+
+/* utime and stime of the daemon, in µs */
+static gint64 daemon_cpu_us() {
+    char path[64];
+    char buffer[1024];
+    unsigned long utime, stime;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", daemon_pid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return 0;
+    size_t len = fread(buffer, 1, sizeof(buffer) - 1, file);
+    fclose(file);
+    buffer[len] = '\0';
+
+    // the command name can hold spaces and parentheses, the fields start after its last ')'
+    char *fields = strrchr(buffer, ')');
+    if (fields == NULL || sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                                 &utime, &stime) != 2)
+        return 0;
+    return (gint64)(utime + stime) * 1000000 / sysconf(_SC_CLK_TCK);
+}
+
+static int compare_us(const void *a, const void *b) {
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_ms(gint64 *values, int count, int percentile) {
+    if (count == 0)
+        return 0;
+    int index = (count * percentile + 99) / 100 - 1;
+    return values[index < 0 ? 0 : index] / 1000.0;
+}
+
+static int step_ms(int step) {
+    if (step == LONG)
+        return short_press_max + 300;
+    if (step == WINDOW)
+        return double_press_max + 150;
+    return step;
+}
+
+/*
+ * Plays one run of a pattern and records, for every gesture it should
+ * produce, the earliest time the daemon could have decided on it.
+ */
+static void play(const struct pattern *pattern, gint64 decided[MAX_EXPECTED], gint64 windows[MAX_EXPECTED]) {
+    int expected = 0;
+    int presses = 0;
+    gint64 press = 0;
+
+    for (int i = 0; i < 8 && pattern->steps[i]; i++) {
+        int ms = step_ms(pattern->steps[i]);
+        if (i % 2) {
+            sleep_until(now_us() + ms * 1000LL);
+            continue;
+        }
+
+        press = key(1);
+        presses++;
+        sleep_until(press + ms * 1000LL);
+        gint64 release = key(0);
+
+        if (ms >= short_press_max) {
+            decided[expected] = press + short_press_max * 1000LL;
+            windows[expected++] = 0;
+            presses = 0;
+        } else if (presses == 2) {
+            decided[expected] = release;
+            windows[expected++] = 0;
+            presses = 0;
+        } else if (pattern->steps[i + 1] == 0 || step_ms(pattern->steps[i + 1]) + ms >= double_press_max) {
+            // nothing follows within the window, this one is a short press
+            decided[expected] = release;
+            windows[expected++] = press + double_press_max * 1000LL;
+            presses = 0;
+        }
+    }
+}
+
+static int run_pattern(const struct pattern *pattern, int runs) {
+    gint64 *latencies = g_new(gint64, runs * MAX_EXPECTED);
+    int latency_count = 0;
+    int failures = 0;
+    int expected_count = 0;
+    gint64 cpu = daemon_cpu_us();
+
+    while (expected_count < MAX_EXPECTED && pattern->expected[expected_count])
+        expected_count++;
+
+    for (int run = 0; run < runs; run++) {
+        gint64 decided[MAX_EXPECTED] = { 0 };
+        gint64 windows[MAX_EXPECTED] = { 0 };
+        int start = signals_since(0);
+
+        play(pattern, decided, windows);
+        // long enough for any window to run out and its signal to come through
+        g_usleep((double_press_max + short_press_max + 200) * 1000LL);
+
+        g_mutex_lock(&signal_lock);
+        int count = signal_count - start;
+        int ok = count == expected_count;
+        for (int i = 0; ok && i < count; i++) {
+            gint64 time = signals[start + i].time;
+            ok = signals[start + i].event == pattern->expected[i];
+            // a short press that waited out the double press window is timed from the window's end
+            gint64 from = windows[i] && time >= windows[i] ? windows[i] : decided[i];
+            latencies[latency_count++] = time - from;
+        }
+        g_mutex_unlock(&signal_lock);
+
+        if (!ok) {
+            failures++;
+            fprintf(stderr, "%s run %d: expected %d gestures, got %d\n", pattern->name, run, expected_count, count);
+        }
+    }
+
+    qsort(latencies, latency_count, sizeof(latencies[0]), compare_us);
+    printf("{\"name\":\"pattern_%s\",\"runs\":%d,\"failures\":%d,\"p50_ms\":%.2f,\"p90_ms\":%.2f,"
+           "\"p99_ms\":%.2f,\"max_ms\":%.2f,\"cpu_ms\":%.1f}\n",
+           pattern->name, runs, failures, percentile_ms(latencies, latency_count, 50),
+           percentile_ms(latencies, latency_count, 90), percentile_ms(latencies, latency_count, 99),
+           percentile_ms(latencies, latency_count, 100), (daemon_cpu_us() - cpu) / 1000.0);
+    fflush(stdout);
+    g_free(latencies);
+    return failures;
+}
+
+/*
+ * Edges at random intervals averaging 1/rate, far inside the debounce
+ * window like a chattering switch, with a pause every STORM_PAUSE_EVERY
+ * edges long enough for the daemon to make a press out of them. Checks the daemon keeps up and comes out of
+ * it still classifying presses right.
+ */
+static int run_storm(GDBusConnection *conn, int rate, int seconds) {
+    GVariant *before = get_stats(conn);
+    int start = signals_since(0);
+    gint64 cpu = daemon_cpu_us();
+    gint64 begin = now_us();
+    gint64 end = begin + seconds * 1000000LL;
+    gint64 next = begin;
+    int edges = 0;
+    guint32 seed = 1;
+
+    while (next < end || edges & 1) {
+        sleep_until(next);
+        key(!(edges & 1));
+        edges++;
+
+        // xorshift, reproducible from run to run
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        if (edges % STORM_PAUSE_EVERY == 0)
+            next += (30 + seed % 200) * 1000LL;
+        else
+            next += (gint64)(-log((seed % 10000 + 1) / 10001.0) * 1000000.0 / rate);
+    }
+    gint64 elapsed = now_us() - begin;
+    gint64 storm_cpu = daemon_cpu_us() - cpu;
+
+    g_usleep((double_press_max + short_press_max + 200) * 1000LL);
+    if (!daemon_alive()) {
+        fprintf(stderr, "The daemon died during the storm\n");
+        return 1;
+    }
+
+    GVariant *after = get_stats(conn);
+    guint64 seen = 0, filtered = 0;
+    if (before && after) {
+        seen = stat_value(after, "key_edges") - stat_value(before, "key_edges");
+        filtered = stat_value(after, "filtered_edges") - stat_value(before, "filtered_edges");
+    }
+    if (before)
+        g_variant_unref(before);
+    if (after)
+        g_variant_unref(after);
+
+    printf("{\"name\":\"storm\",\"edges\":%d,\"edges_per_s\":%.0f,\"key_edges\":%" G_GUINT64_FORMAT ","
+           "\"filtered_edges\":%" G_GUINT64_FORMAT ",\"gestures\":%d,\"cpu_percent\":%.1f,\"cpu_us_per_edge\":%.2f}\n",
+           edges, edges * 1e6 / elapsed, seen, filtered, signals_since(start),
+           storm_cpu * 100.0 / elapsed, (double)storm_cpu / edges);
+    fflush(stdout);
+
+    // whatever the storm left behind, the next press has to come out right
+    return run_pattern(&patterns[0], 3);
+}
+
+/* size of the only video under dir, -1 while there is none */
+static goffset video_size(const char *dir, char *name, size_t size) {
+    struct dirent *entry;
+    struct stat st;
+    char path[512];
+    goffset found = -1;
+
+    DIR *videos = opendir(dir);
+    if (videos == NULL)
+        return -1;
+
+    while ((entry = readdir(videos)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        if (stat(path, &st) == 0) {
+            g_strlcpy(name, path, size);
+            found = st.st_size;
+        }
+    }
+    closedir(videos);
+    return found;
+}
+
+/*
+ * Long press to start, long press again after seconds to stop. The stop
+ * latency runs from the second long press being decided until the muxer
+ * stopped writing, which includes draining the encoder.
+ */
+static int run_record(const char *home, int seconds) {
+    char bindings_path[512], videos[512], video[512] = "";
+    int start = signals_since(0);
+
+    snprintf(bindings_path, sizeof(bindings_path), "%s/.config/assistant-button/bindings", home);
+    snprintf(videos, sizeof(videos), "%s/Videos", home);
+    if (!g_file_set_contents(bindings_path, "long_press = record\n", -1, NULL)) {
+        fprintf(stderr, "Failed to write %s\n", bindings_path);
+        return 1;
+    }
+
+    const struct pattern *long_press = &patterns[2];
+    gint64 decided[MAX_EXPECTED], windows[MAX_EXPECTED];
+
+    play(long_press, decided, windows);
+    sleep_until(now_us() + seconds * 1000000LL);
+    play(long_press, decided, windows);
+
+    // done once it has been the same size for RECORD_SETTLE_MS
+    goffset size = -1, last = -1;
+    gint64 changed = now_us();
+    gint64 deadline = decided[0] + RECORD_TIMEOUT_MS * 1000LL;
+    while (now_us() < deadline) {
+        size = video_size(videos, video, sizeof(video));
+        if (size != last) {
+            last = size;
+            changed = now_us();
+        } else if (size > 0 && now_us() - changed >= RECORD_SETTLE_MS * 1000LL) {
+            break;
+        }
+        g_usleep(50000);
+    }
+
+    int failures = signals_since(start) != 2 || size <= 0;
+    printf("{\"name\":\"record\",\"seconds\":%d,\"bytes\":%" G_GINT64_FORMAT ",\"stop_ms\":%.1f,\"ok\":%s}\n",
+           seconds, (gint64)size, (changed - decided[0]) / 1000.0, failures ? "false" : "true");
+    fflush(stdout);
+
+    unlink(bindings_path);
+    if (video[0])
+        unlink(video);
+    rmdir(videos);
+    return failures;
+}
+
+int main(int argc, char *argv[]) {
+    int runs = 20;
+    int rate = 4000;
+    int seconds = 5;
+    int record_seconds = 0;
+    int opt;
+    char device[64];
+    char home[] = "/tmp/assistant-button-harness-XXXXXX";
+    GError *error = NULL;
+
+    while ((opt = getopt(argc, argv, "n:r:t:s:d:v:")) != -1) {
+        switch (opt) {
+            case 'n': runs = atoi(optarg); break;
+            case 'r': rate = atoi(optarg); break;
+            case 't': seconds = atoi(optarg); break;
+            case 's': short_press_max = atoi(optarg); break;
+            case 'd': double_press_max = atoi(optarg); break;
+            case 'v': record_seconds = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n runs] [-r edges/s] [-t storm seconds] [-s short max] [-d double max] [-v record seconds] daemon\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc || runs <= 0 || rate <= 0 || seconds < 0 || record_seconds < 0) {
+        fprintf(stderr, "Usage: %s [-n runs] [-r edges/s] [-t storm seconds] [-s short max] [-d double max] [-v record seconds] daemon\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // a user's own session bus would have the installed daemon on it already
+    if (g_getenv("DBUS_SESSION_BUS_ADDRESS") == NULL) {
+        fprintf(stderr, "No session bus, run this under dbus-run-session\n");
+        return EXIT_FAILURE;
+    }
+
+    GDBusConnection *conn = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+    if (conn == NULL) {
+        fprintf(stderr, "Failed to connect to the session bus: %s\n", error->message);
+        g_error_free(error);
+        return EXIT_FAILURE;
+    }
+
+    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+    g_dbus_connection_signal_subscribe(conn, NULL, DBUS_INTERFACE, "ActionPerformed", DBUS_PATH, NULL,
+                                       G_DBUS_SIGNAL_FLAGS_NONE, on_action_performed, NULL, NULL);
+    GThread *thread = g_thread_new("signals", run_main_loop, loop);
+
+    if (mkdtemp(home) == NULL || write_bindings(home) != 0)
+        return EXIT_FAILURE;
+    if (create_device(device, sizeof(device)) != 0)
+        return EXIT_FAILURE;
+
+    daemon_pid = start_daemon(argv[optind], device, home);
+    if (daemon_pid < 0 || wait_for_daemon(conn) != 0) {
+        if (daemon_pid > 0)
+            kill(daemon_pid, SIGTERM);
+        return EXIT_FAILURE;
+    }
+
+    int failures = 0;
+    for (size_t i = 0; i < G_N_ELEMENTS(patterns); i++)
+        failures += run_pattern(&patterns[i], runs);
+    if (seconds > 0)
+        failures += run_storm(conn, rate, seconds);
+    if (record_seconds > 0)
+        failures += run_record(home, record_seconds);
+
+    if (!daemon_alive()) {
+        fprintf(stderr, "The daemon exited\n");
+        failures++;
+    } else {
+        kill(daemon_pid, SIGTERM);
+        waitpid(daemon_pid, NULL, 0);
+    }
+
+    ioctl(uinput_fd, UI_DEV_DESTROY);
+    close(uinput_fd);
+    g_main_loop_quit(loop);
+    g_thread_join(thread);
+
+    remove_bindings(home);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}